@@ -495,6 +495,78 @@ void application_impl::open_chain_database() const
       _chain_db->enable_standby_votes_tracking( _options->at("enable-standby-votes-tracking").as<bool>() );
    }
 
+   if( _options->count("block-log-compression") > 0 )
+   {
+      _chain_db->enable_block_log_compression( _options->at("block-log-compression").as<bool>() );
+   }
+
+   if( _options->count("replay-queue-blocks") > 0 )
+   {
+      _chain_db->node_properties().replay_queue_blocks = _options->at("replay-queue-blocks").as<uint32_t>();
+   }
+
+   if( _options->count("replay-queue-size-mb") > 0 )
+   {
+      _chain_db->node_properties().replay_queue_bytes
+            = uint64_t( _options->at("replay-queue-size-mb").as<uint32_t>() ) * 1024 * 1024;
+   }
+
+   if( _options->count("state-checkpoint-interval") > 0 )
+   {
+      _chain_db->node_properties().state_checkpoint_interval
+            = _options->at("state-checkpoint-interval").as<uint32_t>();
+   }
+
+   if( _options->count("parallel-authority-checks") > 0 )
+   {
+      _chain_db->node_properties().parallel_authority_checks
+            = _options->at("parallel-authority-checks").as<bool>();
+   }
+
+   if( _options->count("authority-cache-size") > 0 )
+   {
+      _chain_db->node_properties().authority_cache_size = _options->at("authority-cache-size").as<uint32_t>();
+   }
+
+   if( _options->count("pending-pool-size-mb") > 0 )
+   {
+      _chain_db->node_properties().pending_pool_bytes
+            = uint64_t( _options->at("pending-pool-size-mb").as<uint32_t>() ) * 1024 * 1024;
+   }
+
+   if( _options->count("pending-pool-eviction") > 0 )
+   {
+      const std::string policy = _options->at("pending-pool-eviction").as<std::string>();
+      FC_ASSERT( policy == "fee-rate" || policy == "oldest",
+                 "Invalid pending-pool-eviction value ${p}, expected fee-rate or oldest", ("p",policy) );
+      _chain_db->node_properties().pending_pool_evict_oldest = ( policy == "oldest" );
+   }
+
+   if( _options->count("track-state-hash") > 0 )
+   {
+      _chain_db->node_properties().track_state_hash = _options->at("track-state-hash").as<bool>();
+   }
+
+   if( _options->count("slow-block-threshold-ms") > 0 )
+   {
+      _chain_db->node_properties().slow_block_threshold_ms = _options->at("slow-block-threshold-ms").as<uint32_t>();
+   }
+
+   if( _options->count("cache-block-changes") > 0 )
+   {
+      _chain_db->node_properties().cache_block_changes = _options->at("cache-block-changes").as<bool>();
+   }
+
+   if( _options->count("fork-db-full-blocks") > 0 )
+   {
+      _chain_db->node_properties().fork_db_full_blocks = _options->at("fork-db-full-blocks").as<uint32_t>();
+   }
+
+   if( _options->count("enable-operation-profiling") > 0 )
+   {
+      _chain_db->enable_operation_profiling( _options->at("enable-operation-profiling").as<bool>() );
+   }
+
    if( _options->count("replay-blockchain") > 0 || _options->count("revalidate-blockchain") > 0 )
       _chain_db->wipe( _data_dir / "blockchain", false );
 
@@ -776,6 +848,11 @@ message application_impl::get_item(const item_id& id)
    return trx_message( _chain_db->get_recent_transaction( id.item_hash ) );
 } FC_CAPTURE_AND_RETHROW( (id) ) }
 
+std::vector<std::vector<char>> application_impl::get_packed_blocks(uint32_t first_block_num, uint32_t block_count)
+{ try {
+   return _chain_db->fetch_packed_blocks_by_number( first_block_num, block_count );
+} FC_CAPTURE_AND_RETHROW( (first_block_num)(block_count) ) }
+
 chain_id_type application_impl::get_chain_id() const
 {
    return _chain_db->get_chain_id();
@@ -1148,6 +1225,48 @@ void application::set_program_options(boost::program_options::options_descriptio
          ("enable-standby-votes-tracking", bpo::value<bool>()->implicit_value(true),
           "Whether to enable tracking of votes of standby witnesses and committee members. "
           "Set it to true to provide accurate data to API clients, set to false for slightly better performance.")
+         ("block-log-compression", bpo::value<bool>()->implicit_value(true),
+          "Whether to store new blocks compressed in the block log. Saves disk space on archive nodes, "
+          "existing blocks stay readable whether this is enabled or not.")
+         ("replay-queue-blocks", bpo::value<uint32_t>()->default_value(1000),
+          "Maximum number of blocks read and precomputed ahead of the block being applied during replay")
+         ("replay-queue-size-mb", bpo::value<uint32_t>()->default_value(64),
+          "Maximum size in MiB of packed blocks read ahead of the block being applied during replay")
+         ("state-checkpoint-interval", bpo::value<uint32_t>()->default_value(0),
+          "Save the object database in the background each time this many more blocks became irreversible, "
+          "so that a restart after a crash only replays the blocks since. 0 disables it")
+         ("parallel-authority-checks", bpo::value<bool>()->implicit_value(true),
+          "Whether to check the authorities of all transactions of a block in parallel before applying it. "
+          "Only the authority checks run in parallel, the operations are still applied one by one in block order. "
+          "Checks invalidated by earlier transactions of the block are repeated, the result is the same either way")
+         ("authority-cache-size", bpo::value<uint32_t>()->default_value(10000),
+          "Number of transactions whose passed authority checks are kept, so that they are not checked again "
+          "when included in a block, as long as the accounts involved do not change. 0 disables it")
+         ("pending-pool-size-mb", bpo::value<uint32_t>()->default_value(64),
+          "Maximum total size in MiB of the pending transactions, 0 for no limit. Transactions generated locally "
+          "are accepted beyond it")
+         ("pending-pool-eviction", bpo::value<std::string>()->default_value("fee-rate"),
+          "Which pending transactions to drop when the pending-pool-size-mb limit is reached, either fee-rate "
+          "to drop those paying the lowest fee per byte, or oldest")
+         ("track-state-hash", bpo::value<bool>()->implicit_value(true),
+          "Whether to maintain a hash of all objects, logged after every block and returned by get_state_hash. "
+          "Allows to compare the state of two nodes, costs some time whenever an object changes")
+         ("slow-block-threshold-ms", bpo::value<uint32_t>()->default_value(1000),
+          "Log the time spent in each phase of applying a block, including each observer of the chain, "
+          "for blocks that take at least this many milliseconds to apply, 0 to disable")
+         ("cache-block-changes", bpo::value<bool>()->default_value(false),
+          "Whether to keep the object changes of reversible blocks, so that switching back to a fork applies "
+          "them again instead of the transactions of its blocks. Costs a copy of every object a block changes. "
+          "Blocks applied again this way are not announced as applied blocks, so API block subscriptions and "
+          "transaction confirmations miss them, and the witness, debug_witness, elasticsearch, es_objects and "
+          "snapshot plugins do not see them. Only enable it on nodes that use none of these")
+         ("fork-db-full-blocks", bpo::value<uint32_t>()->default_value(64),
+          "Number of blocks before the head block that are kept in memory with their transactions for switching "
+          "forks, older reversible blocks keep only their headers and are read from the block log when needed. "
+          "0 to keep all")
+         ("enable-operation-profiling", bpo::value<bool>()->implicit_value(true),
+          "Whether to collect per operation type counts, evaluation times and latency histograms, returned by "
+          "get_operation_profile and logged at shutdown")
          ("api-limit-get-account-history-operations",
           bpo::value<uint64_t>()->default_value(default_opts.api_limit_get_account_history_operations),
           "For history_api::get_account_history_operations to set max limit value")
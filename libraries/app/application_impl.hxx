@@ -90,6 +90,11 @@ class application_impl : public net::node_delegate, public std::enable_shared_fr
        */
       graphene::net::message get_item(const graphene::net::item_id& id) override;
 
+      /**
+       * Returns consecutive blocks of our chain as they are stored in the block database.
+       */
+      std::vector<std::vector<char>> get_packed_blocks(uint32_t first_block_num, uint32_t block_count) override;
+
       graphene::chain::chain_id_type get_chain_id()const override;
 
       /**
@@ -335,6 +335,52 @@ witness_schedule_object database_api_impl::get_witness_schedule()const
    return _db.get_witness_schedule_object();
 }
 
+optional<state_hash> database_api::get_state_hash()const
+{
+   return my->get_state_hash();
+}
+
+optional<state_hash> database_api_impl::get_state_hash()const
+{
+   const auto& hash = _db.head_state_hash();
+   if( !hash.valid() )
+      return optional<state_hash>();
+   return state_hash{ _db.head_block_num(), _db.head_block_id(), *hash };
+}
+
+optional<vector<operation_profile>> database_api::get_operation_profile()const
+{
+   return my->get_operation_profile();
+}
+
+optional<vector<operation_profile>> database_api_impl::get_operation_profile()const
+{
+   const operation_profiler* profiler = _db.get_operation_profiler();
+   if( !profiler )
+      return optional<vector<operation_profile>>();
+   return profiler->get_profiles();
+}
+
+database::precompute_stats database_api::get_precompute_stats()const
+{
+   return my->get_precompute_stats();
+}
+
+database::precompute_stats database_api_impl::get_precompute_stats()const
+{
+   return _db.get_precompute_stats();
+}
+
+fork_database_memory_usage database_api::get_fork_database_memory_usage()const
+{
+   return my->get_fork_database_memory_usage();
+}
+
+fork_database_memory_usage database_api_impl::get_fork_database_memory_usage()const
+{
+   return _db.get_fork_database_memory_usage();
+}
+
 //////////////////////////////////////////////////////////////////////
 //                                                                  //
 // Keys                                                             //
@@ -64,6 +64,10 @@ class database_api_impl : public std::enable_shared_from_this<database_api_impl>
       chain_id_type get_chain_id()const;
       dynamic_global_property_object get_dynamic_global_properties()const;
       witness_schedule_object get_witness_schedule()const;
+      optional<state_hash> get_state_hash()const;
+      optional<vector<operation_profile>> get_operation_profile()const;
+      database::precompute_stats get_precompute_stats()const;
+      fork_database_memory_usage get_fork_database_memory_usage()const;
 
       // Keys
       vector<flat_set<account_id_type>> get_key_references( vector<public_key_type> key )const;
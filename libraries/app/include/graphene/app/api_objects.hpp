@@ -142,6 +142,13 @@ namespace graphene { namespace app {
       account_id_type            side2_account_id = GRAPHENE_NULL_ACCOUNT;
    };
 
+   struct state_hash
+   {
+      uint32_t       block_num;
+      block_id_type  block_id;
+      fc::sha256     hash; ///< commitment to all objects after the block, see database::head_state_hash()
+   };
+
    struct extended_asset_object : asset_object
    {
       extended_asset_object() {}
@@ -190,5 +197,6 @@ FC_REFLECT( graphene::app::market_volume, (time)(base)(quote)(base_volume)(quote
 FC_REFLECT( graphene::app::market_trade, (sequence)(date)(price)(amount)(value)(type)
             (side1_account_id)(side2_account_id) )
 
+FC_REFLECT( graphene::app::state_hash, (block_num)(block_id)(hash) )
 FC_REFLECT_DERIVED( graphene::app::extended_asset_object, (graphene::chain::asset_object),
                     (total_in_collateral)(total_backing_collateral) )
@@ -227,6 +227,39 @@ class database_api
        */
       witness_schedule_object get_witness_schedule()const;
 
+      /**
+       * @brief Get the hash of all objects after the head block
+       * @return the head block and the state hash, or null if the node does not track the state hash
+       *
+       * Two nodes that applied the same blocks report the same hash, which allows to compare their state
+       * without exporting it. The node needs to be started with track-state-hash enabled.
+       */
+      optional<state_hash> get_state_hash()const;
+
+      /**
+       * @brief Get per operation type statistics of the evaluation of operations by this node
+       * @return count, failures, cumulative evaluate and apply times and their latency percentiles of each
+       *         operation type evaluated since the node started, the most time consuming first, or null if the
+       *         node does not profile operations
+       *
+       * The node needs to be started with enable-operation-profiling enabled.
+       */
+      optional<vector<operation_profile>> get_operation_profile()const;
+
+      /**
+       * @brief Get the wall time this node spent precomputing digests and signatures of blocks
+       * @return number of blocks and transactions precomputed since the node started, and the latest, highest
+       *         and total wall time of a block in microseconds, for received blocks and for the replay
+       */
+      database::precompute_stats get_precompute_stats()const;
+
+      /**
+       * @brief Get the estimated memory held by the fork database of this node
+       * @return number of reversible blocks, how many of them are held without their transactions, and the bytes
+       *         held for blocks, witness schedules and cached block changes
+       */
+      fork_database_memory_usage get_fork_database_memory_usage()const;
+
       //////////
       // Keys //
       //////////
@@ -989,6 +1022,10 @@ FC_API(graphene::app::database_api,
    (get_chain_id)
    (get_dynamic_global_properties)
    (get_witness_schedule)
+   (get_state_hash)
+   (get_operation_profile)
+   (get_precompute_stats)
+   (get_fork_database_memory_usage)
 
    // Keys
    (get_key_references)
@@ -23,9 +23,17 @@
  */
 #include <graphene/chain/block_database.hpp>
 #include <graphene/protocol/fee_schedule.hpp>
+#include <fc/interprocess/file_mapping.hpp>
+#include <fc/io/fstream.hpp>
 #include <fc/io/raw.hpp>
 #include <boost/endian/buffers.hpp>
 
+#include <zlib.h>
+
+#include <algorithm>
+#include <cstring>
+#include <thread>
+
 namespace graphene { namespace chain {
 
 struct index_entry
@@ -43,6 +51,133 @@ FC_REFLECT( graphene::chain::index_entry, (block_pos)(block_size)(block_id) );
 
 namespace graphene { namespace chain {
 
+namespace detail {
+
+   /**
+    * A read-only mapping of the first @ref size bytes of a file. The mapping may reach beyond the current
+    * end of the file, bytes appended later become visible through it, bytes beyond the end must not be read.
+    */
+   class mapped_file
+   {
+      public:
+         mapped_file( const fc::path& filename, uint64_t size )
+         : _mapping( filename.generic_string().c_str(), fc::read_only ),
+           _region( _mapping, fc::read_only, 0, size ),
+           _size( size ) {}
+
+         const char* data()const { return static_cast<const char*>( _region.get_address() ); }
+         uint64_t    size()const { return _size; }
+
+      private:
+         fc::file_mapping  _mapping;
+         fc::mapped_region _region;
+         uint64_t          _size;
+   };
+
+   /**
+    * Returns a mapping of @ref filename covering at least @ref required bytes. If the current mapping is
+    * too small it is replaced by one at least twice its size, so that a log growing by one block at a time
+    * is remapped O(log n) times rather than once per block. The caller must make sure that
+    * required <= file_size and must never read beyond file_size.
+    */
+   static std::shared_ptr<const mapped_file> map_file( std::shared_ptr<const mapped_file>& current_map,
+                                                       const fc::path& filename, uint64_t file_size,
+                                                       uint64_t required )
+   {
+      auto current = std::atomic_load( &current_map );
+      if( current && current->size() >= required )
+         return current;
+      static const uint64_t min_map_size = 1024 * 1024;
+      const uint64_t capacity = std::max( { file_size, min_map_size, current ? 2 * current->size() : 0 } );
+      auto fresh = std::make_shared<const mapped_file>( filename, capacity );
+      std::atomic_store( &current_map, fresh );
+      return fresh;
+   }
+
+   /// Marks an index entry whose record is compressed, block sizes never come close to 2GB
+   static const uint32_t compressed_flag = 0x80000000u;
+   /// zlib only uses the last 32KB of a preset dictionary
+   static const size_t   dictionary_size = 32 * 1024;
+
+   static uint32_t record_size( const index_entry& e )
+   {
+      return e.block_size.value() & ~compressed_flag;
+   }
+
+   static bool is_compressed( const index_entry& e )
+   {
+      return ( e.block_size.value() & compressed_flag ) != 0;
+   }
+
+   /**
+    * A compressed record is the varint-encoded size of the packed block followed by the
+    * zlib stream of the packed block, compressed against the preset dictionary.
+    */
+   static std::vector<char> compress_record( const std::vector<char>& packed, const std::string& dictionary )
+   {
+      z_stream zs;
+      std::memset( &zs, 0, sizeof(zs) );
+      FC_ASSERT( deflateInit( &zs, Z_DEFAULT_COMPRESSION ) == Z_OK );
+      if( deflateSetDictionary( &zs, (const Bytef*)dictionary.data(), dictionary.size() ) != Z_OK )
+      {
+         deflateEnd( &zs );
+         FC_THROW( "Unable to set block compression dictionary" );
+      }
+
+      const fc::unsigned_int raw_size( packed.size() );
+      const size_t header_size = fc::raw::pack_size( raw_size );
+      std::vector<char> result( header_size + deflateBound( &zs, packed.size() ) );
+      fc::datastream<char*> ds( result.data(), header_size );
+      fc::raw::pack( ds, raw_size );
+
+      zs.next_in   = (Bytef*)packed.data();
+      zs.avail_in  = packed.size();
+      zs.next_out  = (Bytef*)result.data() + header_size;
+      zs.avail_out = result.size() - header_size;
+      const int status = deflate( &zs, Z_FINISH );
+      deflateEnd( &zs );
+      FC_ASSERT( status == Z_STREAM_END, "Block compression failed with status ${s}", ("s",status) );
+      result.resize( header_size + zs.total_out );
+      return result;
+   }
+
+   static std::vector<char> decompress_record( const char* data, size_t size, const std::string& dictionary )
+   {
+      fc::datastream<const char*> ds( data, size );
+      fc::unsigned_int raw_size;
+      fc::raw::unpack( ds, raw_size );
+      std::vector<char> result( raw_size.value );
+
+      z_stream zs;
+      std::memset( &zs, 0, sizeof(zs) );
+      FC_ASSERT( inflateInit( &zs ) == Z_OK );
+      zs.next_in   = (Bytef*)( data + ds.tellp() );
+      zs.avail_in  = ds.remaining();
+      zs.next_out  = (Bytef*)result.data();
+      zs.avail_out = result.size();
+      int status = inflate( &zs, Z_FINISH );
+      if( status == Z_NEED_DICT )
+      {
+         if( inflateSetDictionary( &zs, (const Bytef*)dictionary.data(), dictionary.size() ) == Z_OK )
+            status = inflate( &zs, Z_FINISH );
+      }
+      inflateEnd( &zs );
+      FC_ASSERT( status == Z_STREAM_END && zs.total_out == result.size(),
+                 "Block decompression failed with status ${s}", ("s",status) );
+      return result;
+   }
+
+} // detail
+
+block_database::block_database()
+: _index_size(0), _blocks_size(0), _blocks_read_pos(0), _index_version(0)
+{
+}
+
+block_database::~block_database()
+{
+}
+
 void block_database::open( const fc::path& dbdir )
 { try {
    fc::create_directories(dbdir);
@@ -50,15 +185,32 @@ void block_database::open( const fc::path& dbdir )
    _blocks.exceptions(std::ios_base::failbit | std::ios_base::badbit);
 
    _index_filename = dbdir / "index";
+   _blocks_filename = dbdir / "blocks";
+   _dictionary_filename = dbdir / "dictionary";
    if( !fc::exists( _index_filename ) )
    {
      _block_num_to_pos.open( _index_filename.generic_string().c_str(), std::fstream::binary | std::fstream::in | std::fstream::out | std::fstream::trunc);
-     _blocks.open( (dbdir/"blocks").generic_string().c_str(), std::fstream::binary | std::fstream::in | std::fstream::out | std::fstream::trunc);
+     _blocks.open( _blocks_filename.generic_string().c_str(), std::fstream::binary | std::fstream::in | std::fstream::out | std::fstream::trunc);
    }
    else
    {
      _block_num_to_pos.open( _index_filename.generic_string().c_str(), std::fstream::binary | std::fstream::in | std::fstream::out );
-     _blocks.open( (dbdir/"blocks").generic_string().c_str(), std::fstream::binary | std::fstream::in | std::fstream::out );
+     _blocks.open( _blocks_filename.generic_string().c_str(), std::fstream::binary | std::fstream::in | std::fstream::out );
+   }
+
+   std::atomic_store( &_index_map, std::shared_ptr<const detail::mapped_file>() );
+   std::atomic_store( &_blocks_map, std::shared_ptr<const detail::mapped_file>() );
+   _index_size = fc::file_size( _index_filename );
+   _blocks_size = fc::file_size( _blocks_filename );
+   _blocks_read_pos = 0;
+
+   std::atomic_store( &_dictionary, std::shared_ptr<const std::string>() );
+   _dictionary_samples.clear();
+   if( fc::exists( _dictionary_filename ) )
+   {
+      auto dictionary = std::make_shared<std::string>();
+      fc::read_file_contents( _dictionary_filename, *dictionary );
+      std::atomic_store( &_dictionary, std::shared_ptr<const std::string>( std::move( dictionary ) ) );
    }
 } FC_CAPTURE_AND_RETHROW( (dbdir) ) }
 
@@ -69,6 +221,10 @@ bool block_database::is_open()const
 
 void block_database::close()
 {
+  std::atomic_store( &_index_map, std::shared_ptr<const detail::mapped_file>() );
+  std::atomic_store( &_blocks_map, std::shared_ptr<const detail::mapped_file>() );
+  _index_size = 0;
+  _blocks_size = 0;
   _blocks.close();
   _block_num_to_pos.close();
 }
@@ -79,7 +235,12 @@ void block_database::flush()
   _block_num_to_pos.flush();
 }
 
-void block_database::store( const block_id_type& _id, const signed_block& b )
+void block_database::store( const block_id_type& id, const signed_block& b )
+{
+   store( id, b, fc::raw::pack( b ) );
+}
+
+void block_database::store( const block_id_type& _id, const signed_block& b, const vector<char>& packed )
 {
    block_id_type id = _id;
    if( id == block_id_type() )
@@ -87,48 +248,149 @@ void block_database::store( const block_id_type& _id, const signed_block& b )
       id = b.id();
       elog( "id argument of block_database::store() was not initialized for block ${id}", ("id", id) );
    }
-   _block_num_to_pos.seekp( sizeof( index_entry ) * int64_t(block_header::num_from_id(id)) );
    index_entry e;
    _blocks.seekp( 0, _blocks.end );
-   auto vec = fc::raw::pack( b );
+   vector<char> compressed;
+   const vector<char>* vec = &packed;
    e.block_pos  = _blocks.tellp();
-   e.block_size = vec.size();
    e.block_id   = id;
-   _blocks.write( vec.data(), vec.size() );
-   _block_num_to_pos.write( (char*)&e, sizeof(e) );
+   if( _compress && !std::atomic_load( &_dictionary ) )
+      collect_dictionary_sample( packed );
+   const auto dictionary = std::atomic_load( &_dictionary );
+   if( _compress && dictionary )
+   {
+      compressed = detail::compress_record( packed, *dictionary );
+      vec = &compressed;
+      e.block_size = vec->size() | detail::compressed_flag;
+   }
+   else
+      e.block_size = vec->size();
+   _blocks.write( vec->data(), vec->size() );
+   // readers go through the mapping, so the data has to reach the file before it becomes visible to them
+   _blocks.flush();
+   _blocks_size = e.block_pos.value() + vec->size();
+
+   const uint64_t index_pos = sizeof( index_entry ) * uint64_t(block_header::num_from_id(id));
+   if( index_pos < _index_size )
+      write_index_entry( index_pos, e ); // a fork replaced a block readers may be looking at
+   else
+   {
+      // appended entries are invisible to readers until the size is updated below
+      _block_num_to_pos.seekp( index_pos );
+      _block_num_to_pos.write( (char*)&e, sizeof(e) );
+      _block_num_to_pos.flush();
+      _index_size = index_pos + sizeof(e);
+   }
+}
+
+void block_database::write_index_entry( uint64_t index_pos, const index_entry& e )
+{
+   ++_index_version; // odd: a rewrite is in progress
+   _block_num_to_pos.seekp( index_pos );
+   _block_num_to_pos.write( (const char*)&e, sizeof(e) );
+   _block_num_to_pos.flush();
+   ++_index_version;
 }
 
 void block_database::remove( const block_id_type& id )
 { try {
    index_entry e;
-   int64_t index_pos = sizeof(e) * int64_t(block_header::num_from_id(id));
-   _block_num_to_pos.seekg( 0, _block_num_to_pos.end );
-   if ( _block_num_to_pos.tellg() <= index_pos )
+   const uint32_t block_num = block_header::num_from_id(id);
+   if( !read_index_entry( block_num, e ) )
       FC_THROW_EXCEPTION(fc::key_not_found_exception, "Block ${id} not contained in block database", ("id", id));
 
-   _block_num_to_pos.seekg( index_pos );
-   _block_num_to_pos.read( (char*)&e, sizeof(e) );
-
    if( e.block_id == id )
    {
       e.block_size = 0;
-      _block_num_to_pos.seekp( sizeof(e) * int64_t(block_header::num_from_id(id)) );
-      _block_num_to_pos.write( (char*)&e, sizeof(e) );
+      write_index_entry( sizeof(e) * uint64_t(block_num), e );
    }
 } FC_CAPTURE_AND_RETHROW( (id) ) }
 
+bool block_database::read_index_entry( uint32_t block_num, index_entry& e )const
+{
+   const uint64_t index_pos = sizeof(index_entry) * uint64_t(block_num);
+   const uint64_t index_end = index_pos + sizeof(index_entry);
+   const uint64_t index_size = _index_size;
+   if( index_size < index_end )
+      return false;
+   auto index = detail::map_file( _index_map, _index_filename, index_size, index_end );
+   // entries can be rewritten in place by store() and remove(), retry until we got one that was not torn
+   uint64_t version;
+   do
+   {
+      while( ( version = _index_version.load( std::memory_order_acquire ) ) & 1 )
+         std::this_thread::yield();
+      std::memcpy( (char*)&e, index->data() + index_pos, sizeof(e) );
+      std::atomic_thread_fence( std::memory_order_acquire );
+   } while( version != _index_version.load( std::memory_order_relaxed ) );
+   return true;
+}
+
+void block_database::collect_dictionary_sample( const std::vector<char>& packed_block )
+{
+   _dictionary_samples.insert( _dictionary_samples.end(), packed_block.begin(), packed_block.end() );
+   if( _dictionary_samples.size() < detail::dictionary_size )
+      return;
+
+   // the most recent blocks are the best predictor of what follows, keep the tail
+   auto dictionary = std::make_shared<const std::string>( _dictionary_samples.end() - detail::dictionary_size,
+                                                          _dictionary_samples.end() );
+   _dictionary_samples.clear();
+   _dictionary_samples.shrink_to_fit();
+
+   // the dictionary must be on disk before the first record compressed with it
+   std::ofstream out( _dictionary_filename.generic_string().c_str(),
+                      std::ofstream::binary | std::ofstream::out | std::ofstream::trunc );
+   out.write( dictionary->data(), dictionary->size() );
+   out.close();
+   FC_ASSERT( out, "Unable to write block compression dictionary ${f}", ("f",_dictionary_filename) );
+   std::atomic_store( &_dictionary, dictionary );
+   ilog( "Created block compression dictionary ${f}", ("f",_dictionary_filename) );
+}
+
+optional<signed_block> block_database::read_block( const index_entry& e )const
+{
+   const uint64_t block_end = e.block_pos.value() + detail::record_size( e );
+   const uint64_t blocks_size = _blocks_size;
+   if( detail::record_size( e ) == 0 || blocks_size < block_end )
+      return optional<signed_block>();
+   auto blocks = detail::map_file( _blocks_map, _blocks_filename, blocks_size, block_end );
+   signed_block result;
+   if( detail::is_compressed( e ) )
+   {
+      const auto dictionary = std::atomic_load( &_dictionary );
+      FC_ASSERT( dictionary, "Compressed block found but the compression dictionary is missing" );
+      const auto packed = detail::decompress_record( blocks->data() + e.block_pos.value(), detail::record_size( e ),
+                                                     *dictionary );
+      fc::datastream<const char*> ds( packed.data(), packed.size() );
+      fc::raw::unpack( ds, result );
+   }
+   else
+   {
+      fc::datastream<const char*> ds( blocks->data() + e.block_pos.value(), detail::record_size( e ) );
+      fc::raw::unpack( ds, result );
+   }
+   _blocks_read_pos = block_end;
+   FC_ASSERT( result.id() == e.block_id );
+   return result;
+}
+
+void block_database::truncate_index( uint64_t new_size )const
+{
+   // drop our mapping first, some platforms refuse to shrink a mapped file
+   std::atomic_store( &_index_map, std::shared_ptr<const detail::mapped_file>() );
+   _index_size = new_size;
+   fc::resize_file( _index_filename, new_size );
+}
+
 bool block_database::contains( const block_id_type& id )const
 {
    if( id == block_id_type() )
       return false;
 
    index_entry e;
-   int64_t index_pos = sizeof(e) * int64_t(block_header::num_from_id(id));
-   _block_num_to_pos.seekg( 0, _block_num_to_pos.end );
-   if ( _block_num_to_pos.tellg() < int64_t(index_pos + sizeof(e)) )
+   if( !read_index_entry( block_header::num_from_id(id), e ) )
       return false;
-   _block_num_to_pos.seekg( index_pos );
-   _block_num_to_pos.read( (char*)&e, sizeof(e) );
 
    return e.block_id == id && e.block_size.value() > 0;
 }
@@ -137,14 +399,9 @@ block_id_type block_database::fetch_block_id( uint32_t block_num )const
 {
    assert( block_num != 0 );
    index_entry e;
-   int64_t index_pos = sizeof(e) * int64_t(block_num);
-   _block_num_to_pos.seekg( 0, _block_num_to_pos.end );
-   if ( _block_num_to_pos.tellg() <= index_pos )
+   if( !read_index_entry( block_num, e ) )
       FC_THROW_EXCEPTION(fc::key_not_found_exception, "Block number ${block_num} not contained in block database", ("block_num", block_num));
 
-   _block_num_to_pos.seekg( index_pos );
-   _block_num_to_pos.read( (char*)&e, sizeof(e) );
-
    FC_ASSERT( e.block_id != block_id_type(), "Empty block_id in block_database (maybe corrupt on disk?)" );
    return e.block_id;
 }
@@ -154,23 +411,12 @@ optional<signed_block> block_database::fetch_optional( const block_id_type& id )
    try
    {
       index_entry e;
-      int64_t index_pos = sizeof(e) * int64_t(block_header::num_from_id(id));
-      _block_num_to_pos.seekg( 0, _block_num_to_pos.end );
-      if ( _block_num_to_pos.tellg() <= index_pos )
+      if( !read_index_entry( block_header::num_from_id(id), e ) )
          return {};
 
-      _block_num_to_pos.seekg( index_pos );
-      _block_num_to_pos.read( (char*)&e, sizeof(e) );
-
       if( e.block_id != id ) return optional<signed_block>();
 
-      vector<char> data( e.block_size.value() );
-      _blocks.seekg( e.block_pos.value() );
-      if (e.block_size.value())
-         _blocks.read( data.data(), e.block_size.value() );
-      auto result = fc::raw::unpack<signed_block>(data);
-      FC_ASSERT( result.id() == e.block_id );
-      return result;
+      return read_block( e );
    }
    catch (const fc::exception&)
    {
@@ -186,19 +432,45 @@ optional<signed_block> block_database::fetch_by_number( uint32_t block_num )cons
    try
    {
       index_entry e;
-      int64_t index_pos = sizeof(e) * int64_t(block_num);
-      _block_num_to_pos.seekg( 0, _block_num_to_pos.end );
-      if ( _block_num_to_pos.tellg() <= index_pos )
+      if( !read_index_entry( block_num, e ) )
          return {};
 
-      _block_num_to_pos.seekg( index_pos, _block_num_to_pos.beg );
-      _block_num_to_pos.read( (char*)&e, sizeof(e) );
+      return read_block( e );
+   }
+   catch (const fc::exception&)
+   {
+   }
+   catch (const std::exception&)
+   {
+   }
+   return optional<signed_block>();
+}
+
+optional<std::vector<char>> block_database::fetch_packed_by_number( uint32_t block_num, block_id_type& id )const
+{
+   try
+   {
+      index_entry e;
+      if( !read_index_entry( block_num, e ) )
+         return {};
 
-      vector<char> data( e.block_size.value() );
-      _blocks.seekg( e.block_pos.value() );
-      _blocks.read( data.data(), e.block_size.value() );
-      auto result = fc::raw::unpack<signed_block>(data);
-      FC_ASSERT( result.id() == e.block_id );
+      const uint64_t block_end = e.block_pos.value() + detail::record_size( e );
+      const uint64_t blocks_size = _blocks_size;
+      if( detail::record_size( e ) == 0 || blocks_size < block_end )
+         return {};
+      auto blocks = detail::map_file( _blocks_map, _blocks_filename, blocks_size, block_end );
+      const char* record = blocks->data() + e.block_pos.value();
+      optional<std::vector<char>> result;
+      if( detail::is_compressed( e ) )
+      {
+         const auto dictionary = std::atomic_load( &_dictionary );
+         FC_ASSERT( dictionary, "Compressed block found but the compression dictionary is missing" );
+         result = detail::decompress_record( record, detail::record_size( e ), *dictionary );
+      }
+      else
+         result = std::vector<char>( record, record + detail::record_size( e ) );
+      _blocks_read_pos = block_end;
+      id = e.block_id;
       return result;
    }
    catch (const fc::exception&)
@@ -207,7 +479,7 @@ optional<signed_block> block_database::fetch_by_number( uint32_t block_num )cons
    catch (const std::exception&)
    {
    }
-   return optional<signed_block>();
+   return {};
 }
 
 optional<index_entry> block_database::last_index_entry()const {
@@ -215,33 +487,20 @@ optional<index_entry> block_database::last_index_entry()const {
    {
       index_entry e;
 
-      _block_num_to_pos.seekg( 0, _block_num_to_pos.end );
-      std::streampos pos = _block_num_to_pos.tellg();
-      if( pos < long(sizeof(index_entry)) )
+      uint64_t pos = _index_size;
+      if( pos < sizeof(index_entry) )
          return optional<index_entry>();
 
       pos -= pos % sizeof(index_entry);
 
-      _blocks.seekg( 0, _block_num_to_pos.end );
-      const std::streampos blocks_size = _blocks.tellg();
       while( pos > 0 )
       {
          pos -= sizeof(index_entry);
-         _block_num_to_pos.seekg( pos );
-         _block_num_to_pos.read( (char*)&e, sizeof(e) );
-         if( _block_num_to_pos.gcount() == sizeof(e) && e.block_size.value() > 0
-                && int64_t(e.block_pos.value() + e.block_size.value()) <= blocks_size )
+         if( read_index_entry( pos / sizeof(index_entry), e ) && e.block_size.value() > 0 )
             try
             {
-               vector<char> data( e.block_size.value() );
-               _blocks.seekg( e.block_pos.value() );
-               _blocks.read( data.data(), e.block_size.value() );
-               if( _blocks.gcount() == long(e.block_size.value()) )
-               {
-                  const signed_block block = fc::raw::unpack<signed_block>(data);
-                  if( block.id() == e.block_id )
-                     return e;
-               }
+               if( read_block( e ).valid() )
+                  return e;
             }
             catch (const fc::exception&)
             {
@@ -249,7 +508,7 @@ optional<index_entry> block_database::last_index_entry()const {
             catch (const std::exception&)
             {
             }
-         fc::resize_file( _index_filename, pos );
+         truncate_index( pos );
       }
    }
    catch (const fc::exception&)
@@ -277,13 +536,12 @@ optional<block_id_type> block_database::last_id()const
 
 size_t block_database::blocks_current_position()const
 {
-   return (size_t)_blocks.tellg();
+   return (size_t)_blocks_read_pos;
 }
 
 size_t block_database::total_block_size()const
 {
-   _blocks.seekg( 0, _blocks.end );
-   return (size_t)_blocks.tellg();
+   return (size_t)_blocks_size;
 }
 
 } }
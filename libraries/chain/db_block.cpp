@@ -28,6 +28,7 @@
 #include <graphene/chain/hardfork.hpp>
 
 #include <graphene/chain/block_summary_object.hpp>
+#include <graphene/chain/custom_authority_object.hpp>
 #include <graphene/chain/global_property_object.hpp>
 #include <graphene/chain/operation_history_object.hpp>
 
@@ -70,18 +71,37 @@ optional<signed_block> database::fetch_block_by_id( const block_id_type& id )con
    auto b = _fork_db.fetch_block( id );
    if( !b )
       return _block_id_to_block.fetch_optional(id);
-   return b->data;
+   return _fork_db.fetch_full_block( *b );
 }
 
 optional<signed_block> database::fetch_block_by_number( uint32_t num )const
 {
    auto results = _fork_db.fetch_block_by_number(num);
    if( results.size() == 1 )
-      return results[0]->data;
+      return _fork_db.fetch_full_block( *results[0] );
    else
       return _block_id_to_block.fetch_by_number(num);
 }
 
+vector<vector<char>> database::fetch_packed_blocks_by_number( uint32_t first_block_num, uint32_t block_count )const
+{
+   vector<vector<char>> result;
+   if( first_block_num == 0 || first_block_num > head_block_num() )
+      return result;
+   const uint32_t last_block_num = static_cast<uint32_t>( std::min<uint64_t>( head_block_num(),
+                                                       uint64_t(first_block_num) + block_count - 1 ) );
+   result.reserve( last_block_num - first_block_num + 1 );
+   for( uint32_t num = first_block_num; num <= last_block_num; ++num )
+   {
+      block_id_type id;
+      auto packed = _block_id_to_block.fetch_packed_by_number( num, id );
+      if( !packed.valid() )
+         break;
+      result.push_back( std::move( *packed ) );
+   }
+   return result;
+}
+
 const signed_transaction& database::get_recent_transaction(const transaction_id_type& trx_id) const
 {
    auto& index = get_index_type<transaction_index>().indices().get<by_trx_id>();
@@ -114,22 +134,21 @@ std::vector<block_id_type> database::get_block_ids_on_fork(block_id_type head_of
  *
  * @return true if we switched forks as a result of this push.
  */
-bool database::push_block(const signed_block& new_block, uint32_t skip)
+bool database::push_block(const signed_block& new_block, uint32_t skip, const vector<char>* packed_block)
 {
 //   idump((new_block.block_num())(new_block.id())(new_block.timestamp)(new_block.previous));
    bool result;
    detail::with_skip_flags( *this, skip, [&]()
    {
-      detail::without_pending_transactions( *this, std::move(_pending_tx),
-      [&]()
+      detail::without_pending_transactions( *this, [&]()
       {
-         result = _push_block(new_block);
+         result = _push_block(new_block, packed_block);
       });
    });
    return result;
 }
 
-bool database::_push_block(const signed_block& new_block)
+bool database::_push_block(const signed_block& new_block, const vector<char>* packed_block)
 { try {
    uint32_t skip = get_node_properties().skip_flags;
 
@@ -167,11 +186,7 @@ bool database::_push_block(const signed_block& new_block)
                ilog( "pushing block from fork #${n} ${id}", ("n",(*ritr)->data.block_num())("id",(*ritr)->id) );
                optional<fc::exception> except;
                try {
-                  undo_database::session session = _undo_db.start_undo_session();
-                  apply_block( (*ritr)->data, skip );
-                  update_witnesses( **ritr );
-                  _block_id_to_block.store( (*ritr)->id, (*ritr)->data );
-                  session.commit();
+                  apply_fork_block( **ritr, skip );
                }
                catch ( const fc::exception& e ) { except = e; }
                if( except )
@@ -198,14 +213,13 @@ bool database::_push_block(const signed_block& new_block)
                   for( auto ritr2 = branches.second.rbegin(); ritr2 != branches.second.rend(); ++ritr2 )
                   {
                      ilog( "pushing block #${n} ${id}", ("n",(*ritr2)->data.block_num())("id",(*ritr2)->id) );
-                     auto session = _undo_db.start_undo_session();
-                     apply_block( (*ritr2)->data, skip );
-                     _block_id_to_block.store( (*ritr2)->id, (*ritr2)->data );
-                     session.commit();
+                     apply_fork_block( **ritr2, skip );
                   }
                   throw *except;
                }
          }
+         if( _node_property_object.fork_db_full_blocks > 0 )
+            _fork_db.release_transactions( head_block_id(), _node_property_object.fork_db_full_blocks );
          return true;
       }
       else return false;
@@ -213,20 +227,75 @@ bool database::_push_block(const signed_block& new_block)
 
    try {
       auto session = _undo_db.start_undo_session();
-      apply_block(new_block, skip);
+      apply_block(new_block, skip, packed_block);
+      record_block_changes( *new_head );
       if( new_block.timestamp.sec_since_epoch() > now - 86400 )
          update_witnesses( *new_head );
-      _block_id_to_block.store(new_block.id(), new_block);
+      if( packed_block != nullptr )
+         _block_id_to_block.store(new_block.id(), new_block, *packed_block);
+      else
+         _block_id_to_block.store(new_block.id(), new_block);
       session.commit();
    } catch ( const fc::exception& e ) {
       elog("Failed to push new block:\n${e}", ("e", e.to_detail_string()));
       _fork_db.remove( new_block.id() );
       throw;
    }
+   // applied blocks are in _block_id_to_block, the fork database only needs the headers of older ones
+   if( _node_property_object.fork_db_full_blocks > 0 )
+      _fork_db.release_transactions( new_block.id(), _node_property_object.fork_db_full_blocks );
 
    return false;
 } FC_CAPTURE_AND_RETHROW( (new_block) ) }
 
+void database::record_block_changes( fork_item& fork_entry )const
+{
+   // without undo sessions there are no changes to keep, and the block can not be switched away from anyway
+   if( _node_property_object.cache_block_changes && _undo_db.enabled() )
+      fork_entry.changes = std::make_shared<const graphene::db::redo_state>( _undo_db.get_redo_state() );
+}
+
+void database::apply_fork_block( fork_item& fork_entry, uint32_t skip )
+{
+   auto session = _undo_db.start_undo_session();
+   if( !fork_entry.changes || !redo_block_changes( fork_entry ) )
+   {
+      _fork_db.load_transactions( fork_entry );
+      apply_block( fork_entry.data, skip );
+      record_block_changes( fork_entry );
+   }
+   update_witnesses( fork_entry );
+   _block_id_to_block.store( fork_entry.id, fork_entry.data );
+   session.commit();
+}
+
+bool database::redo_block_changes( const fork_item& fork_entry )
+{
+   // the block was applied on top of the same state before, so its transactions are not checked again
+   try {
+      auto session = _undo_db.start_undo_session();
+      _undo_db.redo( *fork_entry.changes );
+      session.merge();
+   } catch( const fc::exception& e ) {
+      wlog( "Unable to redo the changes of block #${n} ${id}, applying it: ${e}",
+            ("n",fork_entry.num)("id",fork_entry.id)("e",e.to_detail_string()) );
+      return false;
+   }
+   ++_redone_fork_blocks;
+
+   // what _apply_block() does besides changing objects, except notifying applied_block: the objects plugins
+   // create for the block are part of the changes, but what observers of applied_block keep or send outside
+   // of the database is not, see node_property_object::cache_block_changes
+   const dynamic_global_property_object& dgp = get_dynamic_global_properties();
+   _undo_db.set_max_size( dgp.head_block_number - dgp.last_irreversible_block_num + 1 );
+   _fork_db.set_max_size( dgp.head_block_number - dgp.last_irreversible_block_num + 1 );
+   if( state_hash_enabled() )
+      _head_state_hash = get_state_hash();
+   notify_changed_objects();
+   update_state_checkpoint();
+   return true;
+}
+
 void database::verify_signing_witness( const signed_block& new_block, const fork_item& fork_entry )const
 {
    FC_ASSERT( new_block.timestamp >= fork_entry.next_block_time );
@@ -263,7 +332,7 @@ void database::update_witnesses( fork_item& fork_entry )const
  * will allow the transaction to be pushed even if it causes the pending block size to exceed the maximum block size.
  * Although the transaction will probably not propagate further now, as the peers are likely to have their pending
  * queues full as well, it will be kept in the queue to be propagated later when a new block flushes out the pending
- * queues.
+ * queues. The size limit of the pending transaction pool does not apply to it either.
  */
 processed_transaction database::push_transaction( const precomputable_transaction& trx, uint32_t skip )
 { try {
@@ -277,8 +346,68 @@ processed_transaction database::push_transaction( const precomputable_transactio
    return result;
 } FC_CAPTURE_AND_RETHROW( (trx) ) }
 
+namespace {
+   /// Gets the fee and the fee payer of an operation
+   struct operation_fee_visitor
+   {
+      typedef void result_type;
+      asset&           fee;
+      account_id_type& fee_payer;
+
+      template<typename Op>
+      void operator()( const Op& op )const
+      {
+         fee = op.fee;
+         fee_payer = op.fee_payer();
+      }
+   };
+}
+
+/// @return the fees of all operations of trx in core asset, at the current core exchange rates
+static share_type fees_in_core( const database& db, const transaction& trx, account_id_type& fee_payer )
+{
+   share_type total;
+   for( size_t i = 0; i < trx.operations.size(); ++i )
+   {
+      asset fee;
+      account_id_type payer;
+      trx.operations[i].visit( operation_fee_visitor{ fee, payer } );
+      if( i == 0 )
+         fee_payer = payer;
+      if( fee.asset_id == asset_id_type() )
+         total += fee.amount;
+      else if( const asset_object* fee_asset = db.find( fee.asset_id ) )
+         total += ( fee * fee_asset->options.core_exchange_rate ).amount;
+   }
+   return total;
+}
+
 processed_transaction database::_push_transaction( const precomputable_transaction& trx )
 {
+   const uint32_t skip = get_node_properties().skip_flags;
+   const transaction_id_type trx_id = trx.id();
+
+   GRAPHENE_ASSERT( !_pending_pool.contains( trx_id ), duplicate_transaction,
+                    "Transaction '${txid}' is pending already", ("txid",trx_id) );
+
+   pending_transaction entry;
+   entry.id = trx_id;
+   entry.expiration = trx.expiration;
+   entry.packed_size = fc::raw::pack_size( trx );
+   entry.fee = fees_in_core( *this, trx, entry.fee_payer );
+   entry.fee_rate = pending_transaction_pool::fee_rate( entry.fee, entry.packed_size );
+   entry.applied = true;
+
+   // Locally generated transactions are accepted even if the pool is full
+   _pending_pool.set_max_bytes( ( skip & skip_block_size_check ) ? 0 : get_node_properties().pending_pool_bytes );
+   _pending_pool.set_eviction_policy( get_node_properties().pending_pool_evict_oldest
+                                      ? pending_transaction_pool::evict_oldest
+                                      : pending_transaction_pool::evict_lowest_fee_rate );
+   // Evicted transactions that are part of the pending state leave it when it is next rebuilt
+   FC_ASSERT( _pending_pool.can_accept( entry.packed_size, entry.fee_rate ),
+              "The pending transaction pool is full",
+              ("fee",entry.fee)("packed_size",entry.packed_size)("pool_bytes",_pending_pool.total_bytes()) );
+
    // If this is the first transaction pushed after applying a block, start a new undo session.
    // This allows us to quickly rewind to the clean state of the head block, in case a new block arrives.
    if( !_pending_tx_session.valid() )
@@ -290,18 +419,120 @@ processed_transaction database::_push_transaction( const precomputable_transacti
    // apply the changes.
 
    auto temp_session = _undo_db.start_undo_session();
-   auto processed_trx = _apply_transaction( trx );
-   _pending_tx.push_back(processed_trx);
+   processed_transaction processed_trx = _apply_transaction( trx );
 
    // notify_changed_objects();
    // The transaction applied successfully. Merge its changes into the pending block session.
    temp_session.merge();
 
+   entry.results_size = fc::raw::pack_size( processed_trx.operation_results );
+   entry.packed_size += entry.results_size;
+   entry.trx = processed_trx;
+   const vector<pending_transaction> evicted = _pending_pool.add( std::move(entry) );
+   if( !evicted.empty() )
+      dlog( "Evicted ${n} transactions from the pending pool, ${b} bytes are pending",
+            ("n",evicted.size())("b",_pending_pool.total_bytes()) );
+
    // notify anyone listening to pending transactions
    notify_on_pending_transaction( trx );
    return processed_trx;
 }
 
+bool database::apply_pending_transaction( const transaction_id_type& id )
+{
+   const pending_transaction* entry = _pending_pool.find( id );
+   if( entry == nullptr || entry->applied )
+      return entry != nullptr;
+
+   if( !_pending_tx_session.valid() )
+      _pending_tx_session = _undo_db.start_undo_session();
+   try
+   {
+      auto temp_session = _undo_db.start_undo_session();
+      processed_transaction processed_trx = _apply_transaction( entry->trx );
+      const uint32_t results_size = fc::raw::pack_size( processed_trx.operation_results );
+      temp_session.merge();
+      _pending_pool.set_applied( id, std::move(processed_trx), results_size );
+   }
+   catch( const fc::exception& )
+   { // drop invalid transactions
+      _pending_pool.remove( id );
+      return false;
+   }
+   notify_on_pending_transaction( entry->trx );
+   return true;
+}
+
+void database::apply_unapplied_pending_transactions()
+{
+   if( _pending_pool.unapplied_count() == 0 )
+      return;
+   vector<transaction_id_type> unapplied;
+   unapplied.reserve( _pending_pool.unapplied_count() );
+   for( const pending_transaction& entry : _pending_pool.indices().get<pending_transaction_pool::by_sequence>() )
+      if( !entry.applied )
+         unapplied.push_back( entry.id );
+
+   for( const transaction_id_type& id : unapplied )
+   {
+      if( apply_pending_transaction( id ) )
+         ++_pending_reapply_stats.reapplied;
+      else
+         ++_pending_reapply_stats.failed;
+   }
+}
+
+void database::unapply_pending_transactions()
+{
+   _pending_pool.set_none_applied();
+   _pending_tx_session.reset();
+}
+
+void database::restore_pending_transactions( const block_id_type& old_head_id )
+{
+   const bool head_changed = ( head_block_id() != old_head_id );
+   pending_reapply_stats stats;
+   if( !head_changed )
+      stats = _pending_reapply_stats; // the block was rejected, keep counting for the current head
+   _pending_reapply_stats = pending_reapply_stats();
+
+   const size_t pool_size = _pending_pool.size();
+   stats.expired += _pending_pool.remove_expired( head_block_time() );
+
+   vector<transaction_id_type> included;
+   for( const pending_transaction& entry : _pending_pool.indices().get<pending_transaction_pool::by_sequence>() )
+      if( is_known_transaction( entry.id ) )
+         included.push_back( entry.id );
+   for( const transaction_id_type& id : included )
+      _pending_pool.remove( id );
+   stats.included += included.size();
+
+   for( const auto& tx : _popped_tx )
+   {
+      try {
+         if( !is_known_transaction( tx.id() ) ) {
+            _push_transaction( tx );
+            ++stats.reapplied;
+         }
+      } catch ( const fc::exception& ) { // ignore invalid transactions
+         ++stats.failed;
+      }
+   }
+   _popped_tx.clear();
+
+   // The new blocks may have changed anything the others read, not only what they wrote, so all of them
+   // are applied again to keep the pending state up to date
+   apply_unapplied_pending_transactions();
+   stats.reapplied += _pending_reapply_stats.reapplied;
+   stats.failed += _pending_reapply_stats.failed;
+   _pending_reapply_stats = stats;
+
+   if( head_changed && pool_size > 0 )
+      dlog( "Pending transactions after block #${n}: ${r} applied again, ${i} included, ${e} expired, ${f} failed",
+            ("n",head_block_num())("r",stats.reapplied)("i",stats.included)
+            ("e",stats.expired)("f",stats.failed) );
+}
+
 processed_transaction database::validate_transaction( const signed_transaction& trx )
 {
    auto session = _undo_db.start_undo_session();
@@ -403,7 +634,8 @@ signed_block database::_generate_block(
    {
       // Note: if this check failed (which won't happen in normal situations),
       // we would have temporarily broken the invariant that
-      // _pending_tx_session is the result of applying _pending_tx.
+      // _pending_tx_session is the result of applying the applied
+      // transactions of _pending_pool.
       // In this case, when the node received a new block,
       // the push_block() call will re-create the _pending_tx_session.
       FC_ASSERT( witness_id(*this).signing_key == block_signing_private_key.get_public_key() );
@@ -422,44 +654,73 @@ signed_block database::_generate_block(
    _pending_tx_session = _undo_db.start_undo_session();
 
    uint64_t postponed_tx_count = 0;
-   for( const processed_transaction& tx : _pending_tx )
+   vector<vector<char>> packed_transactions;
+   /// @return false if the transaction failed
+   auto try_include = [&]( const pending_transaction& entry, optional<fc::exception>& error )
    {
-      size_t new_total_size = total_block_size + fc::raw::pack_size( tx );
-
       // postpone transaction if it would make block too big
-      if( new_total_size > maximum_block_size )
+      if( total_block_size + entry.packed_size > maximum_block_size )
       {
          postponed_tx_count++;
-         continue;
+         return true;
       }
 
       try
       {
          auto temp_session = _undo_db.start_undo_session();
-         processed_transaction ptx = _apply_transaction( tx );
-
-         // We have to recompute pack_size(ptx) because it may be different
-         // than pack_size(tx) (i.e. if one or more results increased
-         // their size)
-         new_total_size = total_block_size + fc::raw::pack_size( ptx );
+         processed_transaction ptx = _apply_transaction( entry.trx );
+
+         // The results may have a different size than when the transaction
+         // was pushed (i.e. if one or more results increased their size).
+         // The transaction is serialized once here, the merkle root and
+         // the serialized block are built from that.
+         vector<char> packed_tx = fc::raw::pack( ptx );
+         const size_t new_total_size = total_block_size + packed_tx.size();
          // postpone transaction if it would make block too big
          if( new_total_size > maximum_block_size )
          {
             postponed_tx_count++;
-            continue;
+            return true;
          }
 
          temp_session.merge();
 
          total_block_size = new_total_size;
-         pending_block.transactions.push_back( ptx );
+         pending_block.transactions.push_back( std::move(ptx) );
+         packed_transactions.push_back( std::move(packed_tx) );
       }
       catch ( const fc::exception& e )
       {
-         // Do nothing, transaction will not be re-applied
-         wlog( "Transaction was not processed while generating block due to ${e}", ("e", e) );
-         wlog( "The transaction was ${t}", ("t", tx) );
+         error = e;
+         return false;
       }
+      return true;
+   };
+
+   // Transactions paying the most fee per byte go first. A transaction can depend on one paying less, so
+   // a failed one is tried once more if other transactions were included after it failed.
+   struct failed_transaction
+   {
+      const pending_transaction* entry;
+      size_t                     included_before;
+      optional<fc::exception>    error;
+   };
+   vector<failed_transaction> failed_tx;
+   for( const pending_transaction& entry : _pending_pool.indices().get<pending_transaction_pool::by_fee_rate>() )
+   {
+      optional<fc::exception> error;
+      if( !try_include( entry, error ) )
+         failed_tx.push_back( { &entry, pending_block.transactions.size(), std::move(error) } );
+   }
+   vector<transaction_id_type> dropped_tx;
+   for( failed_transaction& failed : failed_tx )
+   {
+      if( failed.included_before < pending_block.transactions.size() && try_include( *failed.entry, failed.error ) )
+         continue;
+      // Do nothing, transaction will not be re-applied
+      wlog( "Transaction was not processed while generating block due to ${e}", ("e", *failed.error) );
+      wlog( "The transaction was ${t}", ("t", failed.entry->trx) );
+      dropped_tx.push_back( failed.entry->id );
    }
    if( postponed_tx_count > 0 )
    {
@@ -468,21 +729,27 @@ signed_block database::_generate_block(
 
    _pending_tx_session.reset();
 
-   // We have temporarily broken the invariant that
-   // _pending_tx_session is the result of applying _pending_tx, as
-   // _pending_tx now consists of the set of postponed transactions.
-   // However, the push_block() call below will re-create the
-   // _pending_tx_session.
+   // None of the pending transactions is part of the pending state now,
+   // the push_block() call below will re-create the _pending_tx_session
+   // from those that are not in the block. Failed ones are dropped here,
+   // so that they are not applied again.
+   for( const transaction_id_type& id : dropped_tx )
+      _pending_pool.remove( id );
+   unapply_pending_transactions();
 
    pending_block.previous = head_block_id();
    pending_block.timestamp = when;
-   pending_block.transaction_merkle_root = pending_block.calculate_merkle_root();
+   pending_block.transaction_merkle_root = pending_block.calculate_merkle_root( packed_transactions );
    pending_block.witness = witness_id;
 
    if( !(skip & skip_witness_signature) )
       pending_block.sign( block_signing_private_key );
 
-   push_block( pending_block, skip | skip_transaction_signatures ); // skip authority check when pushing self-generated blocks
+   // the block database stores the block assembled from the serialized transactions
+   const vector<char> packed_block = pending_block.pack_with_transactions( packed_transactions );
+
+   push_block( pending_block, skip | skip_transaction_signatures, // skip authority check when pushing self-generated blocks
+               &packed_block );
 
    return pending_block;
 } FC_CAPTURE_AND_RETHROW( (witness_id) ) }
@@ -503,14 +770,17 @@ void database::pop_block()
       fork_db_head = _fork_db.fetch_block( head_block_id() );
       FC_ASSERT( fork_db_head, "Trying to pop() block that's not in fork database!?" );
    }
+   // the stored block is overwritten if another block with its number is applied
+   _fork_db.load_transactions( *fork_db_head );
    pop_undo();
+   if( state_hash_enabled() )
+      _head_state_hash = get_state_hash();
    _popped_tx.insert( _popped_tx.begin(), fork_db_head->data.transactions.begin(), fork_db_head->data.transactions.end() );
 } FC_CAPTURE_AND_RETHROW() }
 
 void database::clear_pending()
 { try {
-   assert( (_pending_tx.size() == 0) || _pending_tx_session.valid() );
-   _pending_tx.clear();
+   _pending_pool.clear();
    _pending_tx_session.reset();
 } FC_CAPTURE_AND_RETHROW() }
 
@@ -542,7 +812,7 @@ const vector<optional< operation_history_object > >& database::get_applied_opera
 
 //////////////////// private methods ////////////////////
 
-void database::apply_block( const signed_block& next_block, uint32_t skip )
+void database::apply_block( const signed_block& next_block, uint32_t skip, const vector<char>* packed_block )
 {
    auto block_num = next_block.block_num();
    if( _checkpoints.size() && _checkpoints.rbegin()->second != block_id_type() )
@@ -557,20 +827,42 @@ void database::apply_block( const signed_block& next_block, uint32_t skip )
 
    detail::with_skip_flags( *this, skip, [&]()
    {
-      _apply_block( next_block );
+      _apply_block( next_block, packed_block );
    } );
    return;
 }
 
-void database::_apply_block( const signed_block& next_block )
+/// @return whether custom authorities exist that could authorize op for account, now or at another time
+static bool may_use_custom_authorities( const database& db, account_id_type account, const operation& op )
+{
+   const auto& index = db.get_index_type<custom_authority_index>().indices().get<by_account_custom>();
+   auto range = index.equal_range( boost::make_tuple( account, unsigned_int(op.which()), true ) );
+   return range.first != range.second;
+}
+
+void database::_apply_block( const signed_block& next_block, const vector<char>* packed_block )
 { try {
    uint32_t next_block_num = next_block.block_num();
    uint32_t skip = get_node_properties().skip_flags;
    _applied_ops.clear();
 
+   const fc::time_point block_start = fc::time_point::now();
+   fc::time_point phase_start = block_start;
+   // stores the time since the end of the previous phase
+   auto end_phase = [&phase_start]( uint64_t& usec ) {
+      const fc::time_point now = fc::time_point::now();
+      usec = uint64_t( ( now - phase_start ).count() );
+      phase_start = now;
+   };
+   block_apply_timing& timing = _block_apply_timing;
+   timing = block_apply_timing();
+   timing.block_num = next_block_num;
+   timing.transactions = next_block.transactions.size();
+
    if( !(skip & skip_block_size_check) )
    {
-      FC_ASSERT( fc::raw::pack_size(next_block) <= get_global_properties().parameters.maximum_block_size );
+      const size_t block_size = packed_block != nullptr ? packed_block->size() : fc::raw::pack_size(next_block);
+      FC_ASSERT( block_size <= get_global_properties().parameters.maximum_block_size );
    }
 
    FC_ASSERT( (skip & skip_merkle_check) || next_block.transaction_merkle_root == next_block.calculate_merkle_root(),
@@ -581,6 +873,7 @@ void database::_apply_block( const signed_block& next_block )
               ("id",next_block.id()) );
 
    const witness_object& signing_witness = validate_block_header(skip, next_block);
+   end_phase( timing.header_usec );
    const auto& global_props = get_global_properties();
    const auto& dynamic_global_props = get_dynamic_global_properties();
    bool maint_needed = (dynamic_global_props.next_maintenance_time <= next_block.timestamp);
@@ -594,17 +887,39 @@ void database::_apply_block( const signed_block& next_block )
    _current_block_num    = next_block_num;
    _current_trx_in_block = 0;
 
+   // Authorities are checked in parallel against the state at the start of the block, the transactions
+   // themselves are applied serially below. A passed check is used unless an earlier transaction of the
+   // block changed one of the accounts it read, in which case the transaction is checked again when applied.
+   vector<authority_check> authority_checks;
+   _block_authority_generation.reset();
+   if( _node_property_object.parallel_authority_checks && !(skip & skip_transaction_signatures)
+       && next_block.transactions.size() > 1 )
+   {
+      authority_checks = check_authorities_parallel( next_block );
+      _block_authority_generation = _authority_generation;
+   }
+   end_phase( timing.authority_checks_usec );
+
    for( const auto& trx : next_block.transactions )
    {
+      uint32_t trx_skip = skip;
+      if( !authority_checks.empty() )
+      {
+         const authority_check& check = authority_checks[_current_trx_in_block];
+         if( check.passed && authorities_unchanged_since( check.accounts, *_block_authority_generation ) )
+            trx_skip |= skip_transaction_signatures;
+      }
       /* We do not need to push the undo state for each transaction
        * because they either all apply and are valid or the
        * entire block fails to apply.  We only need an "undo" state
        * for transactions when validating broadcast transactions or
        * when building a block.
        */
-      apply_transaction( trx, skip );
+      apply_transaction( trx, trx_skip );
       ++_current_trx_in_block;
    }
+   _block_authority_generation.reset();
+   end_phase( timing.transactions_usec );
 
    _current_op_in_trx    = 0;
    _current_virtual_op   = 0;
@@ -613,21 +928,30 @@ void database::_apply_block( const signed_block& next_block )
    update_global_dynamic_data( next_block, missed );
    update_signing_witness(signing_witness, next_block);
    update_last_irreversible_block();
+   end_phase( timing.witness_updates_usec );
 
    process_tickets();
+   end_phase( timing.tickets_usec );
 
    // Are we at the maintenance interval?
    if( maint_needed )
       perform_chain_maintenance(next_block, global_props);
+   end_phase( timing.maintenance_usec );
 
    create_block_summary(next_block);
    clear_expired_transactions();
+   end_phase( timing.expired_transactions_usec );
    clear_expired_proposals();
+   end_phase( timing.expired_proposals_usec );
    clear_expired_orders();
+   end_phase( timing.expired_orders_usec );
    clear_expired_htlcs();
+   end_phase( timing.expired_htlcs_usec );
    update_expired_feeds();       // this will update expired feeds and some core exchange rates
    update_core_exchange_rates(); // this will update remaining core exchange rates
+   end_phase( timing.feeds_usec );
    update_withdraw_permissions();
+   end_phase( timing.withdraw_permissions_usec );
 
    // n.b., update_maintenance_flag() happens this late
    // because get_slot_time() / get_slot_at_time() is needed above
@@ -638,12 +962,31 @@ void database::_apply_block( const signed_block& next_block )
    update_witness_schedule();
    if( !_node_property_object.debug_updates.empty() )
       apply_debug_updates();
+   end_phase( timing.witness_schedule_usec );
+
+   if( state_hash_enabled() )
+   {
+      _head_state_hash = get_state_hash();
+      dlog( "State hash after block ${n}: ${h}", ("n",next_block_num)("h",*_head_state_hash) );
+   }
+   end_phase( timing.state_hash_usec );
 
    // notify observers that the block has been applied
    notify_applied_block( next_block ); //emit
    _applied_ops.clear();
+   end_phase( timing.applied_block_usec );
 
    notify_changed_objects();
+   end_phase( timing.changed_objects_usec );
+
+   update_state_checkpoint();
+   end_phase( timing.state_checkpoint_usec );
+
+   timing.total_usec = uint64_t( ( phase_start - block_start ).count() );
+   const uint64_t slow_block_usec = uint64_t( _node_property_object.slow_block_threshold_ms ) * 1000;
+   if( slow_block_usec > 0 && timing.total_usec >= slow_block_usec )
+      wlog( "Block #${n} took ${t} ms to apply: ${timing}",
+            ("n",next_block_num)("t",timing.total_usec / 1000)("timing",timing) );
 } FC_CAPTURE_AND_RETHROW( (next_block.block_num()) )  }
 
 
@@ -677,17 +1020,31 @@ processed_transaction database::_apply_transaction(const signed_transaction& trx
    const chain_parameters& chain_parameters = get_global_properties().parameters;
    eval_state._trx = &trx;
 
-   if( !(skip & skip_transaction_signatures) )
+   if( !(skip & skip_transaction_signatures) && !is_authority_verified( trx ) )
    {
       bool allow_non_immediate_owner = true;
-      auto get_active = [this]( account_id_type id ) { return &id(*this).active; };
-      auto get_owner  = [this]( account_id_type id ) { return &id(*this).owner;  };
-      auto get_custom = [this]( account_id_type id, const operation& op, rejected_predicate_map* rejects ) {
+      flat_set<account_id_type> accounts;
+      bool uses_custom_authorities = false;
+      auto get_active = [this,&accounts]( account_id_type id ) {
+         accounts.insert( id );
+         return &id(*this).active;
+      };
+      auto get_owner  = [this,&accounts]( account_id_type id ) {
+         accounts.insert( id );
+         return &id(*this).owner;
+      };
+      auto get_custom = [this,&accounts,&uses_custom_authorities]( account_id_type id, const operation& op,
+                                                                  rejected_predicate_map* rejects ) {
+         accounts.insert( id );
+         uses_custom_authorities = uses_custom_authorities || may_use_custom_authorities( *this, id, op );
          return get_viable_custom_authorities(id, op, rejects);
       };
 
       trx.verify_authority(chain_id, get_active, get_owner, get_custom, allow_non_immediate_owner,
                            false, get_global_properties().parameters.max_authority_depth);
+      // custom authorities can expire, checks that depend on them are not kept
+      if( !uses_custom_authorities )
+         remember_verified_authority( trx, std::move( accounts ) );
    }
 
    //Skip all manner of expiration and TaPoS checking if we're on block 1; It's impossible that the transaction is
@@ -751,6 +1108,146 @@ operation_result database::apply_operation(transaction_evaluation_state& eval_st
    return result;
 } FC_CAPTURE_AND_RETHROW( (op) ) }
 
+void database::on_authority_change( account_id_type account )
+{
+   _authority_changes[account] = ++_authority_generation;
+   if( _authority_changes.size() > _verified_authorities.size() + 1024 )
+      prune_authority_changes();
+}
+
+bool database::authorities_unchanged_since( const flat_set<account_id_type>& accounts, uint64_t generation )const
+{
+   for( const auto& account : accounts )
+   {
+      auto itr = _authority_changes.find( account );
+      if( itr != _authority_changes.end() && itr->second > generation )
+         return false;
+   }
+   return true;
+}
+
+bool database::is_authority_verified( const signed_transaction& trx )const
+{
+   if( _verified_authorities.empty() )
+      return false;
+   auto itr = _verified_authorities.find( trx.id() );
+   if( itr == _verified_authorities.end() )
+      return false;
+   const verified_authority& entry = itr->second;
+   return entry.signatures == trx.signatures
+          && entry.max_depth == get_global_properties().parameters.max_authority_depth
+          && authorities_unchanged_since( entry.accounts, entry.generation );
+}
+
+void database::remember_verified_authority( const signed_transaction& trx, flat_set<account_id_type>&& accounts )
+{
+   const uint32_t limit = _node_property_object.authority_cache_size;
+   if( limit == 0 )
+      return;
+   verified_authority& entry = _verified_authorities[trx.id()];
+   entry.signatures = trx.signatures;
+   entry.accounts = std::move( accounts );
+   entry.generation = _authority_generation;
+   entry.max_depth = get_global_properties().parameters.max_authority_depth;
+   entry.sequence = ++_verified_authority_sequence;
+   _verified_authority_order.emplace_back( trx.id(), entry.sequence );
+   while( _verified_authorities.size() > limit || _verified_authority_order.size() > 2 * size_t(limit) )
+   {
+      const auto& oldest = _verified_authority_order.front();
+      auto itr = _verified_authorities.find( oldest.first );
+      // entries that were checked again since appear again later in the order
+      if( itr != _verified_authorities.end() && itr->second.sequence == oldest.second )
+         _verified_authorities.erase( itr );
+      _verified_authority_order.pop_front();
+   }
+}
+
+void database::prune_authority_changes()
+{
+   const auto prune = [this]() {
+      uint64_t needed_since = _authority_generation;
+      for( const auto& item : _verified_authorities )
+         needed_since = std::min( needed_since, item.second.generation );
+      if( _block_authority_generation.valid() )
+         needed_since = std::min( needed_since, *_block_authority_generation );
+      for( auto itr = _authority_changes.begin(); itr != _authority_changes.end(); )
+      {
+         if( itr->second <= needed_since )
+            itr = _authority_changes.erase( itr );
+         else
+            ++itr;
+      }
+   };
+   prune();
+   if( _authority_changes.size() > _verified_authorities.size() + 1024 )
+   {
+      // old checks keep too many changes alive, start over
+      _verified_authorities.clear();
+      _verified_authority_order.clear();
+      prune();
+   }
+}
+
+vector<database::authority_check> database::check_authorities_parallel( const signed_block& block )const
+{
+   const size_t count = block.transactions.size();
+   vector<authority_check> checks( count );
+   const chain_id_type& chain_id = get_chain_id();
+   const uint32_t max_depth = get_global_properties().parameters.max_authority_depth;
+
+   // transactions verified before, e.g. when they were received, need no new check
+   vector<bool> verified( count );
+   for( size_t i = 0; i < count; ++i )
+      if( is_authority_verified( block.transactions[i] ) )
+      {
+         verified[i] = true;
+         checks[i].passed = true;
+         checks[i].accounts = _verified_authorities.find( block.transactions[i].id() )->second.accounts;
+      }
+
+   // nothing modifies the database until all workers are done
+   const size_t chunks = fc::asio::default_io_service_scope::get_num_threads();
+   const size_t chunk_size = ( count + chunks - 1 ) / chunks;
+   std::vector<fc::future<void>> workers;
+   workers.reserve( chunks );
+   for( size_t base = 0; base < count; base += chunk_size )
+      workers.push_back( fc::do_parallel( [this,&block,&checks,&verified,&chain_id,max_depth,base,chunk_size,count] () {
+         for( size_t i = base; i < std::min( base + chunk_size, count ); ++i )
+         {
+            if( verified[i] )
+               continue;
+            authority_check& check = checks[i];
+            bool uses_custom_authorities = false;
+            auto get_active = [this,&check]( account_id_type id ) {
+               check.accounts.insert( id );
+               return &id(*this).active;
+            };
+            auto get_owner = [this,&check]( account_id_type id ) {
+               check.accounts.insert( id );
+               return &id(*this).owner;
+            };
+            // custom authorities build their predicates lazily, which is not thread safe, so transactions
+            // that could use them are left to the check done when applying them
+            auto get_custom = [this,&check,&uses_custom_authorities]( account_id_type id, const operation& op,
+                                                                     rejected_predicate_map* ) {
+               check.accounts.insert( id );
+               uses_custom_authorities = uses_custom_authorities || may_use_custom_authorities( *this, id, op );
+               return vector<authority>();
+            };
+            try {
+               block.transactions[i].verify_authority( chain_id, get_active, get_owner, get_custom, true,
+                                                       false, max_depth );
+               check.passed = !uses_custom_authorities;
+            } catch( ... ) {
+               // the check done when applying the transaction reports the failure
+            }
+         }
+      }) );
+   for( auto& worker : workers )
+      worker.wait();
+   return checks;
+}
+
 const witness_object& database::validate_block_header( uint32_t skip, const signed_block& next_block )const
 {
    FC_ASSERT( head_block_id() == next_block.previous, "", ("head_block_id",head_block_id())("next.prev",next_block.previous) );
@@ -797,8 +1294,59 @@ bool database::before_last_checkpoint()const
 static const uint32_t skip_expensive = database::skip_transaction_signatures | database::skip_witness_signature
                                        | database::skip_merkle_check | database::skip_transaction_dupe_check;
 
+namespace detail {
+
+   /**
+    * The precomputation of a block, split into one task per transaction and tasks recovering signatures.
+    * Workers take the next task when they are done with one, so a costly transaction only delays the worker
+    * running it.
+    */
+   struct precompute_work
+   {
+      /// A transaction, or the signature of one of the @ref recoveries
+      struct task
+      {
+         static constexpr uint32_t no_recovery = std::numeric_limits<uint32_t>::max();
+         uint32_t trx;
+         uint32_t recovery;
+      };
+
+      /// A signature recovered by its own task rather than by the task of its transaction
+      struct recovery
+      {
+         uint32_t              trx;
+         const signature_type* signature;
+         public_key_type       key;
+      };
+
+      precompute_work( const signed_block& b, const uint32_t s )
+         : block( b ), skip( s ), digests( b.transactions.size() ), first_recovery( b.transactions.size() ),
+           skip_signatures( new bool[b.transactions.size()] ),
+           missing_keys( new std::atomic<uint32_t>[b.transactions.size()] ) {}
+
+      const signed_block&                      block;
+      const uint32_t                           skip;
+      fc::time_point                           started = fc::time_point::now();
+
+      std::vector<task>                        tasks;
+      std::atomic<size_t>                      next_task{0};
+      std::atomic<uint32_t>                    running_workers{0};
+
+      std::vector<recovery>                    recoveries;
+      /// Per transaction: signature digest and first of its @ref recoveries, if its signatures are recovered
+      std::vector<digest_type>                 digests;
+      std::vector<uint32_t>                    first_recovery;
+      /// Per transaction: whether its task leaves out the signature keys
+      std::unique_ptr<bool[]>                  skip_signatures;
+      /// Per transaction: number of its signatures still to recover
+      std::unique_ptr<std::atomic<uint32_t>[]> missing_keys;
+   };
+
+} // namespace detail
+
 template<typename Trx>
-void database::_precompute_parallel( const Trx* trx, const size_t count, const uint32_t skip )const
+void database::_precompute_parallel( const Trx* trx, const size_t count, const uint32_t skip,
+                                     const bool* skip_signatures )const
 {
    for( size_t i = 0; i < count; ++i, ++trx )
    {
@@ -807,28 +1355,139 @@ void database::_precompute_parallel( const Trx* trx, const size_t count, const u
          trx->get_packed_size();
       if( !(skip&skip_transaction_dupe_check) )
          trx->id();
-      if( !(skip&skip_transaction_signatures) )
+      if( !(skip&skip_transaction_signatures) && !( skip_signatures && skip_signatures[i] ) )
          trx->get_signature_keys( get_chain_id() );
    }
 }
 
+std::shared_ptr<detail::precompute_work> database::_make_precompute_work( const signed_block& block,
+                                                                         const uint32_t skip )const
+{
+   auto work = std::make_shared<detail::precompute_work>( block, skip );
+   const uint32_t count = block.transactions.size();
+   for( uint32_t i = 0; i < count; ++i )
+   {
+      const processed_transaction& trx = block.transactions[i];
+      // signatures of transactions whose authorities were verified before are not needed, unless the
+      // verification no longer holds when the block is applied
+      bool skip_signatures = ( skip & skip_transaction_signatures ) || is_authority_verified( trx );
+      work->missing_keys[i] = 0;
+      if( !skip_signatures && trx.signatures.size() > 1 )
+      {
+         skip_signatures = true;
+         work->digests[i] = trx.sig_digest( get_chain_id() );
+         work->first_recovery[i] = work->recoveries.size();
+         work->missing_keys[i] = trx.signatures.size();
+         for( const signature_type& sig : trx.signatures )
+            work->recoveries.push_back( { i, &sig, public_key_type() } );
+      }
+      work->skip_signatures[i] = skip_signatures;
+   }
+
+   // the signatures are the costly part, they are worked on first
+   const uint32_t signatures = work->recoveries.size();
+   work->tasks.reserve( signatures + count );
+   for( uint32_t r = 0; r < signatures; ++r )
+      work->tasks.push_back( { work->recoveries[r].trx, r } );
+   for( uint32_t i = 0; i < count; ++i )
+      work->tasks.push_back( { i, detail::precompute_work::task::no_recovery } );
+   return work;
+}
+
+void database::_run_precompute_tasks( detail::precompute_work& work )const
+{
+   for( size_t next = work.next_task++; next < work.tasks.size(); next = work.next_task++ )
+   {
+      const detail::precompute_work::task& task = work.tasks[next];
+      if( task.recovery == detail::precompute_work::task::no_recovery )
+      {
+         _precompute_parallel( &work.block.transactions[task.trx], 1, work.skip,
+                               &work.skip_signatures[task.trx] );
+         continue;
+      }
+      detail::precompute_work::recovery& recovery = work.recoveries[task.recovery];
+      recovery.key = fc::ecc::public_key( *recovery.signature, work.digests[task.trx] );
+      // the worker recovering the last signature of a transaction stores all of them
+      if( --work.missing_keys[task.trx] > 0 )
+         continue;
+      const processed_transaction& trx = work.block.transactions[task.trx];
+      vector<public_key_type> keys;
+      keys.reserve( trx.signatures.size() );
+      for( uint32_t k = 0; k < trx.signatures.size(); ++k )
+         keys.push_back( work.recoveries[work.first_recovery[task.trx] + k].key );
+      trx.set_signature_keys( keys );
+   }
+}
+
+void database::record_precompute_time( const fc::time_point& start, const size_t transactions )const
+{
+   const uint64_t usec = ( fc::time_point::now() - start ).count();
+   ++_precompute_blocks;
+   _precompute_transactions += transactions;
+   _precompute_last_usec = usec;
+   _precompute_total_usec += usec;
+   uint64_t max_usec = _precompute_max_usec;
+   while( usec > max_usec && !_precompute_max_usec.compare_exchange_weak( max_usec, usec ) );
+}
+
+database::precompute_stats database::get_precompute_stats()const
+{
+   precompute_stats stats;
+   stats.blocks          = _precompute_blocks;
+   stats.transactions    = _precompute_transactions;
+   stats.last_block_usec = _precompute_last_usec;
+   stats.max_block_usec  = _precompute_max_usec;
+   stats.total_usec      = _precompute_total_usec;
+   return stats;
+}
+
+void database::_precompute_block( const signed_block& block, const uint32_t skip )const
+{
+   // the replay pipeline runs blocks in parallel, so the transactions of a block are precomputed one after the
+   // other. This runs in replay workers while the thread applying blocks modifies the verified authorities, so
+   // unlike _make_precompute_work() it does not look at them, and recovers all signatures.
+   const fc::time_point start = fc::time_point::now();
+   if( !block.transactions.empty() )
+      _precompute_parallel( &block.transactions[0], block.transactions.size(), skip );
+   record_precompute_time( start, block.transactions.size() );
+   if( !(skip&skip_witness_signature) )
+      block.signee();
+   if( !(skip&skip_merkle_check) )
+      block.calculate_merkle_root();
+   block.id();
+}
+
 fc::future<void> database::precompute_parallel( const signed_block& block, const uint32_t skip )const
 { try {
+   const fc::time_point start = fc::time_point::now();
    std::vector<fc::future<void>> workers;
-   if( !block.transactions.empty() )
+   if( block.transactions.empty() )
+      record_precompute_time( start, 0 );
+   else
    {
       if( (skip & skip_expensive) == skip_expensive )
+      {
          _precompute_parallel( &block.transactions[0], block.transactions.size(), skip );
+         record_precompute_time( start, block.transactions.size() );
+      }
       else
       {
-         uint32_t chunks = fc::asio::default_io_service_scope::get_num_threads();
-         uint32_t chunk_size = ( block.transactions.size() + chunks - 1 ) / chunks;
-         workers.reserve( chunks + 1 );
-         for( size_t base = 0; base < block.transactions.size(); base += chunk_size )
-            workers.push_back( fc::do_parallel( [this,&block,base,chunk_size,skip] () {
-               _precompute_parallel( &block.transactions[base],
-                                     base + chunk_size < block.transactions.size() ? chunk_size : block.transactions.size() - base,
-                                     skip );
+         const size_t num_threads = fc::asio::default_io_service_scope::get_num_threads();
+         auto work = _make_precompute_work( block, skip );
+         const size_t threads = std::min( num_threads, work->tasks.size() );
+         work->running_workers = threads;
+         workers.reserve( threads + 1 );
+         for( size_t i = 0; i < threads; ++i )
+            workers.push_back( fc::do_parallel( [this,work] () {
+               try {
+                  _run_precompute_tasks( *work );
+               } catch( ... ) {
+                  if( --work->running_workers == 0 )
+                     record_precompute_time( work->started, work->block.transactions.size() );
+                  throw;
+               }
+               if( --work->running_workers == 0 )
+                  record_precompute_time( work->started, work->block.transactions.size() );
             }) );
       }
    }
@@ -143,6 +143,23 @@ void database::initialize_evaluators()
    register_evaluator<reveal_create_evaluator>();
 }
 
+namespace {
+   /// Reports the account of every object added, modified or removed in an index
+   class authority_change_observer : public graphene::db::index_observer
+   {
+      public:
+         explicit authority_change_observer( std::function<void(const object&)> on_change )
+         : _on_change( std::move( on_change ) ) {}
+
+         virtual void on_add( const object& obj ) override    { _on_change( obj ); }
+         virtual void on_remove( const object& obj ) override { _on_change( obj ); }
+         virtual void on_modify( const object& obj ) override { _on_change( obj ); }
+
+      private:
+         std::function<void(const object&)> _on_change;
+   };
+}
+
 void database::initialize_indexes()
 {
    reset_indexes();
@@ -152,22 +169,28 @@ void database::initialize_indexes()
    add_index< primary_index<asset_index, 13> >(); // 8192 assets per chunk
    add_index< primary_index<force_settlement_index> >();
 
-   add_index< primary_index<account_index, 20> >(); // ~1 million accounts per chunk
+   auto acnt_index = add_index< primary_index<account_index, 20> >(); // ~1 million accounts per chunk
+   acnt_index->add_observer( std::make_shared<authority_change_observer>( [this]( const object& obj ) {
+      on_authority_change( account_id_type( obj.id ) );
+   } ) );
    add_index< primary_index<committee_member_index, 8> >(); // 256 members per chunk
    add_index< primary_index<witness_index, 10> >(); // 1024 witnesses per chunk
    add_index< primary_index<limit_order_index > >();
    add_index< primary_index<call_order_index > >();
    add_index< primary_index<proposal_index > >();
    add_index< primary_index<withdraw_permission_index > >();
-   add_index< primary_index<vesting_balance_index> >();
-   add_index< primary_index<worker_index> >();
-   add_index< primary_index<balance_index> >();
+   add_index< primary_index<vesting_balance_index, direct_auto> >();
+   add_index< primary_index<worker_index, direct_auto> >();
+   add_index< primary_index<balance_index, direct_auto> >(); // genesis balances, removed when claimed
    add_index< primary_index< htlc_index> >();
-   add_index< primary_index< custom_authority_index> >();
+   auto custom_auth_index = add_index< primary_index< custom_authority_index> >();
+   custom_auth_index->add_observer( std::make_shared<authority_change_observer>( [this]( const object& obj ) {
+      on_authority_change( static_cast<const custom_authority_object&>( obj ).account );
+   } ) );
    add_index< primary_index<ticket_index> >();
 
    //Implementation object indexes
-   add_index< primary_index<transaction_index                             > >();
+   add_index< primary_index<transaction_index,                 direct_auto > >(); // moving window of ids
 
    auto bal_idx = add_index< primary_index<account_balance_index          > >();
    bal_idx->add_secondary_index<balances_by_account_index>();
@@ -181,8 +204,8 @@ void database::initialize_indexes()
    add_index< primary_index<simple_index<chain_property_object          > > >();
    add_index< primary_index<simple_index<witness_schedule_object        > > >();
    add_index< primary_index<simple_index<budget_record_object           > > >();
-   add_index< primary_index< special_authority_index                      > >();
-   add_index< primary_index< buyback_index                                > >();
+   add_index< primary_index< special_authority_index,         direct_auto > >();
+   add_index< primary_index< buyback_index,                   direct_auto > >();
    add_index< primary_index< simple_index< fba_accumulator_object       > > >();
 
    add_index< primary_index< personal_data_index,                       20> >();
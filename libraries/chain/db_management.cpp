@@ -33,12 +33,15 @@
 #include <graphene/protocol/fee_schedule.hpp>
 
 #include <fc/io/fstream.hpp>
+#include <fc/io/raw.hpp>
+#include <fc/thread/parallel.hpp>
+#include <fc/thread/thread.hpp>
 
+#include <atomic>
+#include <deque>
 #include <fstream>
 #include <functional>
 #include <iostream>
-#include <queue>
-#include <tuple>
 
 namespace graphene { namespace chain {
 
@@ -46,6 +49,13 @@ database::database()
 {
    initialize_indexes();
    initialize_evaluators();
+
+   applied_block.set_combiner( timed_slots_combiner( &_block_apply_timing.applied_block_observers_usec ) );
+   new_objects.set_combiner( timed_slots_combiner( &_block_apply_timing.new_objects_observers_usec ) );
+   changed_objects.set_combiner( timed_slots_combiner( &_block_apply_timing.changed_objects_observers_usec ) );
+   removed_objects.set_combiner( timed_slots_combiner( &_block_apply_timing.removed_objects_observers_usec ) );
+
+   _fork_db.set_block_loader( [this]( const block_id_type& id ) { return _block_id_to_block.fetch_optional( id ); } );
 }
 
 database::~database()
@@ -53,6 +63,67 @@ database::~database()
    clear_pending();
 }
 
+namespace detail {
+
+   /// A block travelling through the replay pipeline, see database::reindex()
+   struct replay_item
+   {
+      uint32_t                         block_num   = 0;
+      uint32_t                         skip        = 0;
+      size_t                           end_pos     = 0;
+      size_t                           packed_size = 0;
+      bool                             missing     = false;
+      block_id_type                    id;
+      std::vector<char>                packed;
+      signed_block                     block;
+      fc::time_point                   queued_at;
+      std::shared_ptr<fc::exception>   error;
+      fc::promise<void>::ptr           ready = fc::promise<void>::create( "replay_item" );
+
+      void wait()const { fc::future<void>( ready ).wait(); }
+   };
+
+   /// State shared between the stages of the replay pipeline
+   struct replay_pipeline
+   {
+      fc::time_point_sec     dupe_check_from;
+      std::atomic<uint64_t>  queued_bytes{0};
+
+      // microseconds spent in each stage, and waiting in front of it
+      std::atomic<uint64_t>  read_time{0};
+      std::atomic<uint64_t>  deserialize_time{0};
+      std::atomic<uint64_t>  deserialize_stall{0};
+      std::atomic<uint64_t>  precompute_time{0};
+      std::atomic<uint64_t>  precompute_stall{0};
+      uint64_t               apply_time = 0;
+      uint64_t               apply_stall = 0;
+      uint64_t               read_ahead_full = 0;
+
+      void log_stats()const
+      {
+         auto sec = []( uint64_t usec ) { return double(usec) / 1000000.0; };
+         ilog( "   Replay pipeline: apply ${a}s, waiting for input ${as}s; read ${r}s; "
+               "deserialize ${d}s, queued ${ds}s; precompute ${p}s, queued ${ps}s; read-ahead full ${f} times",
+               ("a", sec(apply_time))("as", sec(apply_stall))("r", sec(read_time))
+               ("d", sec(deserialize_time))("ds", sec(deserialize_stall))
+               ("p", sec(precompute_time))("ps", sec(precompute_stall))("f", read_ahead_full) );
+      }
+   };
+
+   static uint64_t usec_since( const fc::time_point& start )
+   {
+      return uint64_t( ( fc::time_point::now() - start ).count() );
+   }
+
+} // detail
+
+/**
+ * Replays the block log through a pipeline:
+ * - a reader thread fetches packed blocks sequentially from the block log,
+ * - deserialization and signature/digest precomputation run as separate tasks on the worker threads,
+ * - the calling thread applies the blocks in order.
+ * Read-ahead is bounded by node_property_object::replay_queue_blocks and replay_queue_bytes.
+ */
 void database::reindex( fc::path data_dir )
 { try {
    auto last_block = _block_id_to_block.last();
@@ -81,86 +152,184 @@ void database::reindex( fc::path data_dir )
 
    size_t total_block_size = _block_id_to_block.total_block_size();
    const auto& gpo = get_global_properties();
-   std::queue< std::tuple< size_t, signed_block, fc::future< void > > > blocks;
+   const size_t max_queue_blocks = std::max<uint32_t>( 1, get_node_properties().replay_queue_blocks );
+   const uint64_t max_queue_bytes = std::max<uint64_t>( 1, get_node_properties().replay_queue_bytes );
+
+   auto pipeline = std::make_shared<detail::replay_pipeline>();
+   pipeline->dupe_check_from = last_block->timestamp - gpo.parameters.maximum_time_until_expiration;
+   std::deque< std::shared_ptr<detail::replay_item> > blocks;
+   fc::thread reader( "reindex_reader" );
+
+   // stages still in flight reference the block log, make sure they are done when leaving
+   struct replay_queue_drainer
+   {
+      std::deque< std::shared_ptr<detail::replay_item> >& queue;
+      void drain()
+      {
+         for( const auto& item : queue )
+            item->wait();
+         queue.clear();
+      }
+      ~replay_queue_drainer()
+      {
+         try { drain(); } catch( ... ) {}
+      }
+   } drainer{ blocks };
+
+   auto precompute = [this,pipeline]( std::shared_ptr<detail::replay_item> item ) {
+      auto stage_start = fc::time_point::now();
+      pipeline->precompute_stall += uint64_t( ( stage_start - item->queued_at ).count() );
+      try
+      {
+         _precompute_block( item->block, item->skip );
+      }
+      catch( const fc::exception& e )
+      {
+         item->error = e.dynamic_copy_exception();
+      }
+      catch( const std::exception& e )
+      {
+         item->error = std::make_shared<fc::std_exception_wrapper>( fc::std_exception_wrapper::from_current_exception( e ) );
+      }
+      pipeline->precompute_time += detail::usec_since( stage_start );
+      item->ready->set_value();
+   };
+
+   auto deserialize = [this,pipeline,precompute]( std::shared_ptr<detail::replay_item> item ) {
+      auto stage_start = fc::time_point::now();
+      pipeline->deserialize_stall += uint64_t( ( stage_start - item->queued_at ).count() );
+      try
+      {
+         item->block = fc::raw::unpack<signed_block>( item->packed );
+         item->missing = ( item->block.id() != item->id );
+      }
+      catch( const fc::exception& ) { item->missing = true; }
+      catch( const std::exception& ) { item->missing = true; }
+      item->packed = std::vector<char>();
+      pipeline->deserialize_time += detail::usec_since( stage_start );
+
+      if( item->missing )
+      {
+         item->ready->set_value();
+         return;
+      }
+      if( item->block.timestamp >= pipeline->dupe_check_from )
+         item->skip &= ~skip_transaction_dupe_check;
+      item->queued_at = fc::time_point::now();
+      fc::do_parallel( [precompute,item] () { precompute( item ); } );
+   };
+
+   auto schedule = [&]( uint32_t block_num ) {
+      auto item = std::make_shared<detail::replay_item>();
+      item->block_num = block_num;
+      item->skip = skip;
+      blocks.push_back( item );
+      reader.async( [this,pipeline,deserialize,item] () {
+         auto stage_start = fc::time_point::now();
+         auto packed = _block_id_to_block.fetch_packed_by_number( item->block_num, item->id );
+         item->end_pos = _block_id_to_block.blocks_current_position();
+         pipeline->read_time += detail::usec_since( stage_start );
+         if( !packed.valid() )
+         {
+            item->missing = true;
+            item->ready->set_value();
+            return;
+         }
+         item->packed = std::move( *packed );
+         item->packed_size = item->packed.size();
+         pipeline->queued_bytes += item->packed_size;
+         item->queued_at = fc::time_point::now();
+         fc::do_parallel( [deserialize,item] () { deserialize( item ); } );
+      }, "reindex_read" );
+   };
+
    uint32_t next_block_num = head_block_num() + 1;
    uint32_t i = next_block_num;
    while( next_block_num <= last_block_num || !blocks.empty() )
    {
-      if( next_block_num <= last_block_num && blocks.size() < 20 )
+      while( next_block_num <= last_block_num && blocks.size() < max_queue_blocks
+             && pipeline->queued_bytes < max_queue_bytes )
+         schedule( next_block_num++ );
+      if( next_block_num <= last_block_num )
+         ++pipeline->read_ahead_full;
+
+      auto wait_start = fc::time_point::now();
+      std::shared_ptr<detail::replay_item> item = blocks.front();
+      item->wait();
+      pipeline->apply_stall += detail::usec_since( wait_start );
+      blocks.pop_front();
+      pipeline->queued_bytes -= item->packed_size;
+
+      if( item->missing )
       {
-         const size_t processed_block_size = _block_id_to_block.blocks_current_position();
-         fc::optional< signed_block > block = _block_id_to_block.fetch_by_number( next_block_num++ );
-         if( block.valid() )
-         {
-            if( block->timestamp >= last_block->timestamp - gpo.parameters.maximum_time_until_expiration )
-               skip &= ~skip_transaction_dupe_check;
-            blocks.emplace( processed_block_size, std::move(*block), fc::future<void>() );
-            std::get<2>(blocks.back()) = precompute_parallel( std::get<1>(blocks.back()), skip );
-         }
-         else
+         wlog( "Reindexing terminated due to gap:  Block ${i} does not exist!", ("i", i) );
+         // the reader may still be busy with later blocks
+         drainer.drain();
+         uint32_t dropped_count = 0;
+         while( true )
          {
-            wlog( "Reindexing terminated due to gap:  Block ${i} does not exist!", ("i", i) );
-            uint32_t dropped_count = 0;
-            while( true )
-            {
-               fc::optional< block_id_type > last_id = _block_id_to_block.last_id();
-               // this can trigger if we attempt to e.g. read a file that has block #2 but no block #1
-               if( !last_id.valid() )
-                  break;
-               // we've caught up to the gap
-               if( block_header::num_from_id( *last_id ) <= i )
-                  break;
-               _block_id_to_block.remove( *last_id );
-               dropped_count++;
-            }
-            wlog( "Dropped ${n} blocks from after the gap", ("n", dropped_count) );
-            next_block_num = last_block_num + 1; // don't load more blocks
+            fc::optional< block_id_type > last_id = _block_id_to_block.last_id();
+            // this can trigger if we attempt to e.g. read a file that has block #2 but no block #1
+            if( !last_id.valid() )
+               break;
+            // we've caught up to the gap
+            if( block_header::num_from_id( *last_id ) < i )
+               break;
+            _block_id_to_block.remove( *last_id );
+            dropped_count++;
          }
+         wlog( "Dropped ${n} blocks from after the gap", ("n", dropped_count) );
+         next_block_num = last_block_num + 1; // don't load more blocks
+         continue;
+      }
+      if( item->error )
+         item->error->dynamic_rethrow_exception();
+      if( !(item->skip & skip_transaction_dupe_check) )
+         skip &= ~skip_transaction_dupe_check;
+
+      const signed_block& block = item->block;
+
+      if( i % 10000 == 0 )
+      {
+         std::stringstream bysize;
+         std::stringstream bynum;
+         size_t current_pos = item->end_pos;
+         if( current_pos > total_block_size )
+            total_block_size = current_pos;
+         bysize << std::fixed << std::setprecision(5) << double(current_pos) / total_block_size * 100;
+         bynum << std::fixed << std::setprecision(5) << double(i)*100/last_block_num;
+         ilog(
+            "   [by size: ${size}%   ${processed} of ${total}]   [by num: ${num}%   ${i} of ${last}]",
+            ("size", bysize.str())
+            ("processed", current_pos)
+            ("total", total_block_size)
+            ("num", bynum.str())
+            ("i", i)
+            ("last", last_block_num)
+         );
+         pipeline->log_stats();
       }
+      if( i == undo_point )
+      {
+         ilog( "Writing database to disk at block ${i}", ("i",i) );
+         flush();
+         ilog( "Done" );
+      }
+      auto apply_start = fc::time_point::now();
+      if( i < undo_point )
+         apply_block( block, skip );
       else
       {
-         std::get<2>(blocks.front()).wait();
-         const signed_block& block = std::get<1>(blocks.front());
-
-         if( i % 10000 == 0 )
-         {
-            std::stringstream bysize;
-            std::stringstream bynum;
-            size_t current_pos = std::get<0>(blocks.front());
-            if( current_pos > total_block_size )
-               total_block_size = current_pos;
-            bysize << std::fixed << std::setprecision(5) << double(current_pos) / total_block_size * 100;
-            bynum << std::fixed << std::setprecision(5) << double(i)*100/last_block_num;
-            ilog(
-               "   [by size: ${size}%   ${processed} of ${total}]   [by num: ${num}%   ${i} of ${last}]",
-               ("size", bysize.str())
-               ("processed", current_pos)
-               ("total", total_block_size)
-               ("num", bynum.str())
-               ("i", i)
-               ("last", last_block_num)
-            );
-         }
-         if( i == undo_point )
-         {
-            ilog( "Writing database to disk at block ${i}", ("i",i) );
-            flush();
-            ilog( "Done" );
-         }
-         if( i < undo_point )
-            apply_block( block, skip );
-         else
-         {
-            _undo_db.enable();
-            push_block( block, skip );
-         }
-         blocks.pop();
-         i++;
+         _undo_db.enable();
+         push_block( block, skip );
       }
+      pipeline->apply_time += detail::usec_since( apply_start );
+      i++;
    }
    _undo_db.enable();
    auto end = fc::time_point::now();
    ilog( "Done reindexing, elapsed time: ${t} sec", ("t",double((end-start).count())/1000000.0 ) );
+   pipeline->log_stats();
 } FC_CAPTURE_AND_RETHROW( (data_dir) ) }
 
 void database::wipe(const fc::path& data_dir, bool include_blocks)
@@ -200,6 +369,12 @@ void database::open(
       }
 
       object_database::open(data_dir);
+      // loading objects does not notify index observers, so nothing verified before can be trusted
+      _verified_authorities.clear();
+      _verified_authority_order.clear();
+      _authority_changes.clear();
+      if( _node_property_object.track_state_hash )
+         enable_state_hash();
 
       _block_id_to_block.open(data_dir / "database" / "block_num_to_block");
 
@@ -223,6 +398,12 @@ void database::open(
                     ("last_block->id", last_block)("head_block_id",head_block_num()) );
          reindex( data_dir );
       }
+      if( state_hash_enabled() )
+      {
+         _head_state_hash = get_state_hash();
+         ilog( "State hash at block ${n}: ${h}", ("n",head_block_num())("h",*_head_state_hash) );
+      }
+      _last_state_checkpoint = get_dynamic_global_properties().last_irreversible_block_num;
       _opened = true;
    }
    FC_CAPTURE_LOG_AND_RETHROW( (data_dir) )
@@ -233,6 +414,18 @@ void database::close(bool rewind)
    if (!_opened)
       return;
       
+   if( _operation_profiler )
+   {
+      ilog( "Operation profile since the database was opened:" );
+      _operation_profiler->log();
+   }
+   const precompute_stats precomputed = get_precompute_stats();
+   if( precomputed.blocks > 0 )
+      ilog( "Precomputed ${b} blocks with ${t} transactions since the database was opened, "
+            "${a} us on average, at most ${m} us",
+            ("b",precomputed.blocks)("t",precomputed.transactions)
+            ("a",precomputed.total_usec / precomputed.blocks)("m",precomputed.max_block_usec) );
+
    // TODO:  Save pending tx's on close()
    clear_pending();
 
@@ -274,4 +467,12 @@ void database::close(bool rewind)
    _opened = false;
 }
 
+void database::enable_operation_profiling( bool enable )
+{
+   if( !enable )
+      _operation_profiler.reset();
+   else if( !_operation_profiler )
+      _operation_profiler.reset( new operation_profiler() );
+}
+
 } }
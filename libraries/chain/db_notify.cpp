@@ -562,7 +562,7 @@ void database::notify_changed_objects()
         for( const auto& item : head_undo.old_values )
         {
           changed_ids.push_back(item.first);
-          get_relevant_accounts(item.second.get(), changed_accounts_impacted, false);
+          get_relevant_accounts(item.second, changed_accounts_impacted, false);
         }
 
         if( changed_ids.size() )
@@ -578,7 +578,7 @@ void database::notify_changed_objects()
         for( const auto& item : head_undo.removed )
         {
           removed_ids.emplace_back( item.first );
-          auto obj = item.second.get();
+          const object* obj = item.second;
           removed.emplace_back( obj );
           get_relevant_accounts(obj, removed_accounts_impacted, false);
         }
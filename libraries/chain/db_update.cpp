@@ -141,6 +141,22 @@ void database::update_last_irreversible_block()
    }
 }
 
+void database::update_state_checkpoint()
+{
+   const uint32_t interval = get_node_properties().state_checkpoint_interval;
+   // the checkpoint is taken as of the oldest undo session, so all changes must be tracked
+   if( interval == 0 || !_undo_db.enabled() )
+      return;
+   const uint32_t last_irreversible = get_dynamic_global_properties().last_irreversible_block_num;
+   if( last_irreversible < _last_state_checkpoint + interval )
+      return;
+   if( start_checkpoint() )
+   {
+      dlog( "Started state checkpoint, last irreversible block is ${n}", ("n",last_irreversible) );
+      _last_state_checkpoint = last_irreversible;
+   }
+}
+
 void database::clear_expired_transactions()
 { try {
    //Look for expired transactions in the deduplication list, and remove them.
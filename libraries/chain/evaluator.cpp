@@ -40,6 +40,10 @@ database& generic_evaluator::db()const { return trx_state->db(); }
    operation_result generic_evaluator::start_evaluate( transaction_evaluation_state& eval_state, const operation& op, bool apply )
    { try {
       trx_state   = &eval_state;
+      operation_profiler* profiler = db().get_operation_profiler();
+      if( profiler )
+         return profiled_evaluate( *profiler, op, apply );
+
       //check_required_authorities(op);
       auto result = evaluate( op );
 
@@ -47,6 +51,27 @@ database& generic_evaluator::db()const { return trx_state->db(); }
       return result;
    } FC_CAPTURE_AND_RETHROW() }
 
+   operation_result generic_evaluator::profiled_evaluate( operation_profiler& profiler, const operation& op, bool apply )
+   {
+      const int which = op.which();
+      try {
+         auto start = operation_profiler::clock::now();
+         auto result = evaluate( op );
+         auto evaluated = operation_profiler::clock::now();
+         profiler.record_evaluate( which, evaluated - start );
+
+         if( apply )
+         {
+            result = this->apply( op );
+            profiler.record_apply( which, operation_profiler::clock::now() - evaluated );
+         }
+         return result;
+      } catch( ... ) {
+         profiler.record_failure( which );
+         throw;
+      }
+   }
+
    void generic_evaluator::prepare_fee(account_id_type account_id, asset fee)
    {
       const database& d = db();
@@ -189,6 +189,67 @@ pair<fork_database::branch_type,fork_database::branch_type>
    return result;
 } FC_CAPTURE_AND_RETHROW( (first)(second) ) }
 
+void fork_database::release_transactions( const block_id_type& head_id, uint32_t depth )
+{
+   item_ptr item = fetch_block( head_id );
+   for( uint32_t i = 0; item && i <= depth; ++i )
+      item = item->prev.lock();
+   // older blocks were released before, unless this branch was not the head branch back then
+   while( item && !item->compact )
+   {
+      signed_block header_only;
+      static_cast<signed_block_header&>( header_only ) = item->data;
+      item->data = std::move( header_only );
+      item->compact = true;
+      item = item->prev.lock();
+   }
+}
+
+void fork_database::load_transactions( fork_item& item )const
+{ try {
+   if( !item.compact )
+      return;
+   item.data = fetch_full_block( item );
+   item.compact = false;
+} FC_CAPTURE_AND_RETHROW( (item.id) ) }
+
+signed_block fork_database::fetch_full_block( const fork_item& item )const
+{ try {
+   if( !item.compact )
+      return item.data;
+   FC_ASSERT( _block_loader, "no block loader to load the transactions of a compact block" );
+   optional<signed_block> block = _block_loader( item.id );
+   FC_ASSERT( block.valid() && block->id() == item.id, "the block of a compact fork item is not stored" );
+   return std::move( *block );
+} FC_CAPTURE_AND_RETHROW( (item.id) ) }
+
+fork_database_memory_usage fork_database::get_memory_usage()const
+{
+   fork_database_memory_usage usage;
+   for( const item_ptr& item : _index )
+   {
+      ++usage.blocks;
+      usage.total_bytes += sizeof( fork_item );
+      if( item->compact )
+         ++usage.compact_blocks;
+      else
+         usage.block_bytes += fc::raw::pack_size( item->data );
+      if( item->scheduled_witnesses )
+         usage.scheduled_witness_bytes += item->scheduled_witnesses->capacity()
+                                          * sizeof( pair< witness_id_type, public_key_type > );
+      if( item->changes )
+      {
+         usage.cached_change_objects += item->changes->objects.size();
+         for( const auto& obj : item->changes->objects )
+            usage.cached_change_bytes += obj->object_size();
+         usage.cached_change_bytes += item->changes->removed.size() * sizeof( object_id_type )
+                  + item->changes->next_ids.size() * sizeof( graphene::db::redo_state::next_id_change );
+      }
+   }
+   usage.total_bytes += usage.block_bytes + usage.scheduled_witness_bytes + usage.cached_change_bytes;
+   return usage;
+}
+
 void fork_database::set_head(shared_ptr<fork_item> h)
 {
    _head = h;
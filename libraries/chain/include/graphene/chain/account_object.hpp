@@ -377,6 +377,7 @@ namespace graphene { namespace chain {
       account_balance_object,
       indexed_by<
          ordered_unique< tag<by_id>, member< object, object_id_type, &object::id > >,
+         hashed_id_index,
          ordered_non_unique< tag<by_maintenance_flag>,
                              member< account_balance_object, bool, &account_balance_object::maintenance_flag > >,
          ordered_unique< tag<by_asset_balance>,
@@ -398,7 +399,7 @@ namespace graphene { namespace chain {
    /**
     * @ingroup object_index
     */
-   typedef generic_index<account_balance_object, account_balance_object_multi_index_type> account_balance_index;
+   typedef generic_index<account_balance_object, account_balance_object_multi_index_type, true> account_balance_index;
 
    struct by_name;
 
@@ -0,0 +1,117 @@
+/*
+ * Copyright (c) 2020-2023 Revolution Populi Limited, and contributors.
+ *
+ * The MIT License
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+#pragma once
+
+#include <graphene/chain/types.hpp>
+
+#include <fc/signals.hpp>
+#include <fc/time.hpp>
+
+namespace graphene { namespace chain {
+
+   /// Time spent in each phase of database::_apply_block() for one block, in microseconds
+   struct block_apply_timing
+   {
+      uint32_t block_num                  = 0;
+      uint32_t transactions               = 0;
+      uint64_t total_usec                 = 0;
+
+      uint64_t header_usec                = 0; ///< size, merkle root and header checks
+      uint64_t authority_checks_usec      = 0; ///< parallel authority checks, see parallel-authority-checks
+      uint64_t transactions_usec          = 0;
+      uint64_t witness_updates_usec       = 0; ///< missed blocks, dynamic global properties, signing witness, LIB
+      uint64_t tickets_usec               = 0;
+      uint64_t maintenance_usec           = 0;
+      uint64_t expired_transactions_usec  = 0; ///< including the block summary
+      uint64_t expired_proposals_usec     = 0;
+      uint64_t expired_orders_usec        = 0;
+      uint64_t expired_htlcs_usec         = 0;
+      uint64_t feeds_usec                 = 0; ///< expired feeds and core exchange rates
+      uint64_t withdraw_permissions_usec  = 0;
+      uint64_t witness_schedule_usec      = 0; ///< maintenance flag, witness schedule and debug updates
+      uint64_t state_hash_usec            = 0;
+      uint64_t applied_block_usec         = 0; ///< notify_applied_block(), including its observers
+      uint64_t changed_objects_usec       = 0; ///< notify_changed_objects(), including its observers
+      uint64_t state_checkpoint_usec      = 0;
+
+      /// Time spent in each observer of a signal, in the order the observers connected
+      /// @{
+      vector<uint64_t> applied_block_observers_usec;
+      vector<uint64_t> new_objects_observers_usec;
+      vector<uint64_t> changed_objects_observers_usec;
+      vector<uint64_t> removed_objects_observers_usec;
+      /// @}
+   };
+
+   /**
+    * Calls the slots of a signal one after the other, like the default combiner of boost::signals2 does for
+    * slots returning void, and adds the time spent in each slot to the vector it was given, if any.
+    */
+   class timed_slots_combiner
+   {
+   public:
+      typedef void result_type;
+
+      explicit timed_slots_combiner( vector<uint64_t>* slot_usec = nullptr ) : _slot_usec( slot_usec ) {}
+
+      template<typename InputIterator>
+      void operator()( InputIterator first, InputIterator last )const
+      {
+         for( size_t slot = 0; first != last; ++first, ++slot )
+         {
+            const fc::time_point start = fc::time_point::now();
+            try
+            {
+               *first;
+            }
+            catch( const boost::signals2::expired_slot& )
+            {
+            }
+            if( _slot_usec )
+            {
+               if( _slot_usec->size() <= slot )
+                  _slot_usec->resize( slot + 1 );
+               (*_slot_usec)[slot] += uint64_t( ( fc::time_point::now() - start ).count() );
+            }
+         }
+      }
+
+   private:
+      vector<uint64_t>* _slot_usec;
+   };
+
+   /// A signal whose observers are timed one by one, see timed_slots_combiner
+   template<typename Signature>
+   using timed_signal = boost::signals2::signal<Signature, timed_slots_combiner>;
+
+} } // graphene::chain
+
+FC_REFLECT( graphene::chain::block_apply_timing,
+            (block_num)(transactions)(total_usec)
+            (header_usec)(authority_checks_usec)(transactions_usec)(witness_updates_usec)(tickets_usec)
+            (maintenance_usec)(expired_transactions_usec)(expired_proposals_usec)(expired_orders_usec)
+            (expired_htlcs_usec)(feeds_usec)(withdraw_permissions_usec)(witness_schedule_usec)(state_hash_usec)
+            (applied_block_usec)(changed_objects_usec)(state_checkpoint_usec)
+            (applied_block_observers_usec)(new_objects_observers_usec)(changed_objects_observers_usec)
+            (removed_objects_observers_usec) )
@@ -22,7 +22,9 @@
  * THE SOFTWARE.
  */
 #pragma once
+#include <atomic>
 #include <fstream>
+#include <memory>
 #include <graphene/protocol/block.hpp>
 
 #include <fc/filesystem.hpp>
@@ -31,29 +33,95 @@ namespace graphene { namespace chain {
    struct index_entry;
    using namespace graphene::protocol;
 
+   namespace detail { class mapped_file; }
+
+   /**
+    *  @brief Append-only on-disk storage of irreversible (and recent) blocks
+    *
+    *  Blocks are packed into the "blocks" file, the "index" file holds one fixed-size
+    *  index_entry per block number pointing into it.
+    *
+    *  Writes go through buffered streams and are flushed before the in-memory bookkeeping
+    *  is updated. Reads never touch the streams: both files are memory mapped read-only,
+    *  so fetching a block is a bounds check, a memcpy of the index entry and unpacking
+    *  straight from the mapped bytes. Mappings are replaced by one twice as large when a
+    *  read goes beyond the currently mapped size, readers keep using the snapshot they
+    *  obtained, so concurrent readers do not need to lock.
+    *
+    *  Appended index entries only become visible once the index size is updated. Entries
+    *  rewritten in place (a block replaced by a fork, remove()) are published under a
+    *  sequence counter, readers retry until they copied an entry that was not torn.
+    *
+    *  Optionally blocks are stored zlib-compressed against a preset dictionary which is
+    *  built once from the first blocks written and kept in the "dictionary" file. Every
+    *  block remains an independent record, so random access by number stays O(1).
+    *  Compressed entries are marked in the index, uncompressed and compressed records may
+    *  be mixed in one log.
+    */
    class block_database 
    {
       public:
+         block_database();
+         ~block_database();
+
          void open( const fc::path& dbdir );
          bool is_open()const;
          void flush();
          void close();
 
+         /// Compress blocks stored from now on, blocks already in the log stay readable either way
+         void set_compression( bool enable ) { _compress = enable; }
+         bool compression_enabled()const { return _compress; }
+
          void store( const block_id_type& id, const signed_block& b );
+         /// Same as store(), the block is given in its packed form, e.g. as serialized by the producing node
+         void store( const block_id_type& id, const signed_block& b, const vector<char>& packed_block );
          void remove( const block_id_type& id );
 
          bool                   contains( const block_id_type& id )const;
          block_id_type          fetch_block_id( uint32_t block_num )const;
          optional<signed_block> fetch_optional( const block_id_type& id )const;
          optional<signed_block> fetch_by_number( uint32_t block_num )const;
+         /**
+          * Fetches a block in its packed form without deserializing it.
+          * @param block_num the number of the block to fetch
+          * @param id receives the id of the block as recorded in the index
+          * @return the packed block (decompressed if it was stored compressed), or nothing if not found
+          */
+         optional<std::vector<char>> fetch_packed_by_number( uint32_t block_num, block_id_type& id )const;
          optional<signed_block> last()const;
          optional<block_id_type> last_id()const;
          size_t                 blocks_current_position()const;
          size_t                 total_block_size()const;
       private:
-         optional<index_entry> last_index_entry()const;
+         optional<index_entry>  last_index_entry()const;
+         bool                   read_index_entry( uint32_t block_num, index_entry& e )const;
+         optional<signed_block> read_block( const index_entry& e )const;
+         void                   truncate_index( uint64_t new_size )const;
+         void                   write_index_entry( uint64_t index_pos, const index_entry& e );
+         void                   collect_dictionary_sample( const std::vector<char>& packed_block );
+
          fc::path _index_filename;
+         fc::path _blocks_filename;
          mutable std::fstream _blocks;
          mutable std::fstream _block_num_to_pos;
+
+         /// Sizes of the files as written by this instance, readers never look beyond them
+         mutable std::atomic<uint64_t> _index_size;
+         std::atomic<uint64_t>         _blocks_size;
+         /// End of the most recently read block, used for progress reporting while replaying
+         mutable std::atomic<uint64_t> _blocks_read_pos;
+         /// Odd while an index entry is being rewritten in place
+         std::atomic<uint64_t>         _index_version;
+
+         mutable std::shared_ptr<const detail::mapped_file> _index_map;
+         mutable std::shared_ptr<const detail::mapped_file> _blocks_map;
+
+         bool              _compress = false;
+         fc::path          _dictionary_filename;
+         /// Preset compression dictionary, null until enough blocks have been sampled.
+         /// Set once by the writer and read by concurrent readers, always accessed through atomic_load/atomic_store
+         std::shared_ptr<const std::string> _dictionary;
+         std::vector<char> _dictionary_samples;
    };
 } }
@@ -32,6 +32,9 @@
 #include <graphene/chain/asset_object.hpp>
 #include <graphene/chain/commit_reveal_object.hpp>
 #include <graphene/chain/fork_database.hpp>
+#include <graphene/chain/pending_transaction_pool.hpp>
+#include <graphene/chain/operation_profiler.hpp>
+#include <graphene/chain/block_apply_timing.hpp>
 #include <graphene/chain/block_database.hpp>
 #include <graphene/chain/genesis_state.hpp>
 #include <graphene/chain/evaluator.hpp>
@@ -43,6 +46,8 @@
 
 #include <fc/log/logger.hpp>
 
+#include <atomic>
+#include <deque>
 #include <map>
 
 namespace graphene { namespace protocol { struct predicate_result; } }
@@ -64,6 +69,8 @@ namespace graphene { namespace chain {
    struct budget_record;
    enum class vesting_balance_type;
 
+   namespace detail { struct precompute_work; }
+
    /**
     *   @class database
     *   @brief tracks the blockchain state in an extensible manner
@@ -138,6 +145,13 @@ namespace graphene { namespace chain {
          block_id_type              get_block_id_for_num( uint32_t block_num )const;
          optional<signed_block>     fetch_block_by_id( const block_id_type& id )const;
          optional<signed_block>     fetch_block_by_number( uint32_t num )const;
+         /**
+          *  Fetches up to block_count consecutive blocks of the current chain from first_block_num on,
+          *  packed as they are stored in the block database, without deserializing them.
+          *  Stops at the head block or at the first block that can't be read.
+          */
+         vector<vector<char>>       fetch_packed_blocks_by_number( uint32_t first_block_num,
+                                                                   uint32_t block_count )const;
          const signed_transaction&  get_recent_transaction( const transaction_id_type& trx_id )const;
          std::vector<block_id_type> get_block_ids_on_fork(block_id_type head_of_fork) const;
 
@@ -151,9 +165,14 @@ namespace graphene { namespace chain {
          const flat_map<uint32_t,block_id_type> get_checkpoints()const { return _checkpoints; }
          bool before_last_checkpoint()const;
 
-         bool push_block( const signed_block& b, uint32_t skip = skip_nothing );
+         /**
+          * @param packed_block fc::raw::pack() of the block if it is known already, e.g. for a block produced
+          *                     by this node, the block database stores it as is
+          */
+         bool push_block( const signed_block& b, uint32_t skip = skip_nothing,
+                          const vector<char>* packed_block = nullptr );
          processed_transaction push_transaction( const precomputable_transaction& trx, uint32_t skip = skip_nothing );
-         bool _push_block( const signed_block& b );
+         bool _push_block( const signed_block& b, const vector<char>* packed_block = nullptr );
          processed_transaction _push_transaction( const precomputable_transaction& trx );
 
          ///@throws fc::exception if the proposed transaction fails to apply.
@@ -197,7 +216,7 @@ namespace graphene { namespace chain {
           *  the write lock and may be in an "inconstant state" until after it is
           *  released.
           */
-         fc::signal<void(const signed_block&)>           applied_block;
+         timed_signal<void(const signed_block&)>         applied_block;
 
          /**
           * This signal is emitted any time a new transaction is added to the pending
@@ -209,18 +228,18 @@ namespace graphene { namespace chain {
           *  Emitted After a block has been applied and committed.  The callback
           *  should not yield and should execute quickly.
           */
-         fc::signal<void(const vector<object_id_type>&, const flat_set<account_id_type>&)> new_objects;
+         timed_signal<void(const vector<object_id_type>&, const flat_set<account_id_type>&)> new_objects;
 
          /**
           *  Emitted After a block has been applied and committed.  The callback
           *  should not yield and should execute quickly.
           */
-         fc::signal<void(const vector<object_id_type>&, const flat_set<account_id_type>&)> changed_objects;
+         timed_signal<void(const vector<object_id_type>&, const flat_set<account_id_type>&)> changed_objects;
 
          /** this signal is emitted any time an object is removed and contains a
           * pointer to the last value of every object that was removed.
           */
-         fc::signal<void(const vector<object_id_type>&, const vector<const object*>&, const flat_set<account_id_type>&)>  removed_objects;
+         timed_signal<void(const vector<object_id_type>&, const vector<const object*>&, const flat_set<account_id_type>&)>  removed_objects;
 
          //////////////////// db_witness_schedule.cpp ////////////////////
 
@@ -284,6 +303,8 @@ namespace graphene { namespace chain {
          uint32_t         head_block_num()const;
          block_id_type    head_block_id()const;
          witness_id_type  head_block_witness()const;
+         /// @return the hash of all objects after the head block, or nothing if the state hash is not tracked
+         const optional<fc::sha256>& head_state_hash()const { return _head_state_hash; }
 
          decltype( chain_parameters::block_interval ) block_interval( )const;
 
@@ -518,6 +539,36 @@ namespace graphene { namespace chain {
           * can be reapplied at the proper time */
          std::deque< precomputable_transaction > _popped_tx;
 
+         /// What happened to the pending transactions when the head block changed
+         struct pending_reapply_stats
+         {
+            uint32_t reapplied = 0; ///< applied again
+            uint32_t included  = 0; ///< dropped, because the new blocks contain them
+            uint32_t expired   = 0; ///< dropped, because they expired
+            uint32_t failed    = 0; ///< dropped, because they failed to apply again
+         };
+         /// @return the pending_reapply_stats of the current head block
+         const pending_reapply_stats& get_pending_reapply_stats()const { return _pending_reapply_stats; }
+
+         /// @return all pending transactions, whether they are part of the pending state or not
+         const pending_transaction_pool& get_pending_transaction_pool()const { return _pending_pool; }
+
+         /**
+          * Resets the pending state to the head block, the pending transactions stay in the pool.
+          * Used by push_block() before the block is applied.
+          */
+         void unapply_pending_transactions();
+         /**
+          * Rebuilds the pending state from the popped transactions and the pending transaction pool after the
+          * head block changed, used by push_block() once the block has been applied or rejected.
+          *
+          * Transactions contained in the new blocks or expired are dropped without being applied. All others
+          * are applied again, because the new blocks may have changed any object they read.
+          *
+          * @param old_head_id the head block before push_block()
+          */
+         void restore_pending_transactions( const block_id_type& old_head_id );
+
          /**
           * @}
           */
@@ -525,6 +576,24 @@ namespace graphene { namespace chain {
          /// Enable or disable tracking of votes of standby witnesses and committee members
          inline void enable_standby_votes_tracking(bool enable)  { _track_standby_votes = enable; }
 
+         /// @return how long the phases of applying the head block took, see slow-block-threshold-ms
+         const block_apply_timing& get_block_apply_timing()const { return _block_apply_timing; }
+
+         /// @return how many blocks were applied again from their cached changes when switching forks,
+         ///         see node_property_object::cache_block_changes
+         uint64_t get_redone_fork_block_count()const { return _redone_fork_blocks; }
+
+         /// @return the estimated memory held by the fork database, see node_property_object::fork_db_full_blocks
+         fork_database_memory_usage get_fork_database_memory_usage()const { return _fork_db.get_memory_usage(); }
+
+         /// Starts or stops collecting per operation type statistics, stopping discards them
+         void enable_operation_profiling( bool enable );
+         /// @return the operation_profiler, or nullptr if operation profiling is disabled
+         operation_profiler* get_operation_profiler()const { return _operation_profiler.get(); }
+
+         /// Enable or disable compression of blocks written to the block log from now on
+         inline void enable_block_log_compression(bool enable)  { _block_id_to_block.set_compression( enable ); }
+
          /** Precomputes digests, signatures and operation validations depending
           *  on skip flags. "Expensive" computations may be done in a parallel
           *  thread.
@@ -544,9 +613,45 @@ namespace graphene { namespace chain {
           *         precomputations applied
           */
          fc::future<void> precompute_parallel( const precomputable_transaction& trx )const;
+
+         /// Wall time of precomputing the transactions of blocks, by precompute_parallel() from the call until its
+         /// last worker finished, and by the replay
+         struct precompute_stats
+         {
+            uint64_t blocks          = 0; ///< number of blocks precomputed
+            uint64_t transactions    = 0; ///< number of transactions in these blocks
+            uint64_t last_block_usec = 0; ///< wall time of the latest block
+            uint64_t max_block_usec  = 0; ///< highest wall time of a block
+            uint64_t total_usec      = 0; ///< sum of the wall times
+         };
+         /// @return the precompute_stats since the database was opened
+         precompute_stats get_precompute_stats()const;
    private:
+         /// @param skip_signatures if given, whether the signature keys of each transaction are not needed here,
+         ///                        because its authorities were verified before or its signatures are recovered
+         ///                        separately
          template<typename Trx>
-         void _precompute_parallel( const Trx* trx, const size_t count, const uint32_t skip )const;
+         void _precompute_parallel( const Trx* trx, const size_t count, const uint32_t skip,
+                                    const bool* skip_signatures = nullptr )const;
+         /**
+          * Splits the precomputation of a block into tasks of one transaction each and tasks recovering one
+          * signature of a transaction with several signatures each.
+          * Leaves out the signatures of transactions whose authorities were verified before, so it may only be
+          * called by the thread applying blocks, which modifies the verified authorities.
+          */
+         std::shared_ptr<detail::precompute_work> _make_precompute_work( const signed_block& block,
+                                                                         const uint32_t skip )const;
+         /// Runs tasks of @p work until none is left; any number of threads may run it at the same time
+         void _run_precompute_tasks( detail::precompute_work& work )const;
+         /// Does all the work of precompute_parallel() for one block in the calling thread
+         void _precompute_block( const signed_block& block, const uint32_t skip )const;
+
+         mutable std::atomic<uint64_t>          _precompute_blocks{0};
+         mutable std::atomic<uint64_t>          _precompute_transactions{0};
+         mutable std::atomic<uint64_t>          _precompute_last_usec{0};
+         mutable std::atomic<uint64_t>          _precompute_max_usec{0};
+         mutable std::atomic<uint64_t>          _precompute_total_usec{0};
+         void record_precompute_time( const fc::time_point& start, const size_t transactions )const;
 
    protected:
          //Mark pop_undo() as protected -- we do not want outside calling pop_undo(); it should call pop_block() instead
@@ -566,13 +671,49 @@ namespace graphene { namespace chain {
 
       public:
          // these were formerly private, but they have a fairly well-defined API, so let's make them public
-         void                  apply_block( const signed_block& next_block, uint32_t skip = skip_nothing );
+         /// @param packed_block fc::raw::pack() of the block if it is known already, spares computing its size
+         void                  apply_block( const signed_block& next_block, uint32_t skip = skip_nothing,
+                                            const vector<char>* packed_block = nullptr );
          processed_transaction apply_transaction( const signed_transaction& trx, uint32_t skip = skip_nothing );
          operation_result      apply_operation( transaction_evaluation_state& eval_state, const operation& op );
 
       private:
-         void                  _apply_block( const signed_block& next_block );
+         void                  _apply_block( const signed_block& next_block, const vector<char>* packed_block );
          processed_transaction _apply_transaction( const signed_transaction& trx );
+
+         /// Result of checking the authorities of a transaction ahead of applying its block
+         struct authority_check
+         {
+            bool                       passed = false;
+            flat_set<account_id_type>  accounts; ///< accounts whose authorities the check read
+         };
+         /**
+          * Checks the authorities of all transactions of a block in parallel, against the current state.
+          * This is the only part of applying a block that runs in parallel: evaluators write to the object
+          * database, which is not safe for concurrent writers, so there is no speculative execution of
+          * operations with read/write-set conflict detection. Transactions whose check is cached, see
+          * is_authority_verified(), are not checked again.
+          */
+         vector<authority_check> check_authorities_parallel( const signed_block& block )const;
+
+         /// An authority check that passed, kept by transaction id so that it is not repeated
+         struct verified_authority
+         {
+            vector<signature_type>     signatures; ///< the check only holds for the same signatures
+            flat_set<account_id_type>  accounts;   ///< accounts whose authorities the check read
+            uint64_t                   generation; ///< _authority_generation when checked
+            uint32_t                   max_depth;  ///< max_authority_depth when checked
+            uint64_t                   sequence;   ///< position in _verified_authority_order
+         };
+         /// Called whenever an account or one of its custom authorities is added, modified or removed
+         void on_authority_change( account_id_type account );
+         /// @return whether none of the accounts changed after the given generation
+         bool authorities_unchanged_since( const flat_set<account_id_type>& accounts, uint64_t generation )const;
+         /// @return whether the authorities of trx were verified before and still hold
+         bool is_authority_verified( const signed_transaction& trx )const;
+         void remember_verified_authority( const signed_transaction& trx, flat_set<account_id_type>&& accounts );
+         /// Forgets the changes that none of the kept authority checks depends on
+         void prune_authority_changes();
          void                  _cancel_bids_and_revive_mpa( const asset_object& bitasset, const asset_bitasset_data_object& bad );
 
          ///Steps involved in applying a new block
@@ -582,6 +723,12 @@ namespace graphene { namespace chain {
          const witness_object& _validate_block_header( const signed_block& next_block )const;
          void verify_signing_witness( const signed_block& new_block, const fork_item& fork_entry )const;
          void update_witnesses( fork_item& fork_entry )const;
+         /// Keeps the changes of the block just applied in the current undo session with its fork_item
+         void record_block_changes( fork_item& fork_entry )const;
+         /// Applies a block when switching forks, from its cached changes if there are any
+         void apply_fork_block( fork_item& fork_entry, uint32_t skip );
+         /// @return whether the cached changes of the block could be made again, otherwise nothing is changed
+         bool redo_block_changes( const fork_item& fork_entry );
          void create_block_summary(const signed_block& next_block);
 
          //////////////////// db_witness_schedule.cpp ////////////////////
@@ -595,6 +742,7 @@ namespace graphene { namespace chain {
          void update_global_dynamic_data( const signed_block& b, const uint32_t missed_blocks );
          void update_signing_witness(const witness_object& signing_witness, const signed_block& new_block);
          void update_last_irreversible_block();
+         void update_state_checkpoint();
          void clear_expired_transactions();
          void clear_expired_proposals();
          void clear_expired_orders();
@@ -627,7 +775,19 @@ namespace graphene { namespace chain {
          ///@}
          ///@}
 
-         vector< processed_transaction >        _pending_tx;
+         /// All pending transactions, those marked as applied make up the pending state
+         pending_transaction_pool               _pending_pool;
+         pending_reapply_stats                  _pending_reapply_stats;
+
+         /**
+          * Applies a transaction of the pool on top of the pending state, unless it is applied already.
+          * It is removed from the pool if it fails.
+          * @return whether it is part of the pending state
+          */
+         bool apply_pending_transaction( const transaction_id_type& id );
+         /// Applies all transactions of the pool that are not part of the pending state, oldest first
+         void apply_unapplied_pending_transactions();
+
          fork_database                          _fork_db;
 
          /**
@@ -670,6 +830,12 @@ namespace graphene { namespace chain {
          /// Set it to true to provide accurate data to API clients, set to false to have better performance.
          bool                              _track_standby_votes = true;
 
+         std::unique_ptr<operation_profiler> _operation_profiler;
+
+         /// Filled by _apply_block(), the signals add the time of their observers to it
+         block_apply_timing                _block_apply_timing;
+         uint64_t                          _redone_fork_blocks = 0;
+
          /**
           * Whether database is successfully opened or not.
           *
@@ -679,6 +845,23 @@ namespace graphene { namespace chain {
           */
          bool                              _opened = false;
 
+         /// Last irreversible block number when the latest state checkpoint was started
+         uint32_t                          _last_state_checkpoint = 0;
+
+         /// Hash of all objects after the head block, if node_property_object::track_state_hash is set
+         optional<fc::sha256>              _head_state_hash;
+
+         /// Incremented whenever an account or a custom authority changes
+         uint64_t                                          _authority_generation = 0;
+         /// Generation of the latest change of an account or of one of its custom authorities
+         std::map<account_id_type, uint64_t>               _authority_changes;
+         /// Generation the parallel authority checks of the block being applied were done at
+         optional<uint64_t>                                _block_authority_generation;
+         std::map<transaction_id_type, verified_authority> _verified_authorities;
+         /// Transaction ids and sequence numbers of _verified_authorities, oldest first
+         std::deque<std::pair<transaction_id_type, uint64_t>> _verified_authority_order;
+         uint64_t                                          _verified_authority_sequence = 0;
+
          // Counts nested proposal updates
          uint32_t                           _push_proposal_nesting_depth = 0;
 
@@ -734,3 +917,6 @@ namespace graphene { namespace chain {
    }
 
 } }
+
+FC_REFLECT( graphene::chain::database::precompute_stats,
+            (blocks)(transactions)(last_block_usec)(max_block_usec)(total_usec) )
@@ -68,40 +68,19 @@ struct skip_flags_restorer
  */
 struct pending_transactions_restorer
 {
-   pending_transactions_restorer( database& db, std::vector<processed_transaction>&& pending_transactions )
-      : _db(db), _pending_transactions( std::move(pending_transactions) )
+   pending_transactions_restorer( database& db )
+      : _db(db), _head_block_id( db.head_block_id() )
    {
-      _db.clear_pending();
+      _db.unapply_pending_transactions();
    }
 
    ~pending_transactions_restorer()
    {
-      for( const auto& tx : _db._popped_tx )
-      {
-         try {
-            if( !_db.is_known_transaction( tx.id() ) ) {
-               _db._push_transaction( tx );
-            }
-         } catch ( const fc::exception& ) { // ignore invalid transactions
-         }
-      }
-      _db._popped_tx.clear();
-      for( const processed_transaction& tx : _pending_transactions )
-      {
-         try
-         {
-            if( !_db.is_known_transaction( tx.id() ) ) {
-               _db._push_transaction( tx );
-            }
-         }
-         catch( const fc::exception& )
-         { // ignore invalid transactions
-         }
-      }
+      _db.restore_pending_transactions( _head_block_id );
    }
 
    database& _db;
-   std::vector< processed_transaction > _pending_transactions;
+   block_id_type _head_block_id;
 };
 
 /**
@@ -123,18 +102,17 @@ void with_skip_flags(
 }
 
 /**
- * Empty pending_transactions, call callback,
- * then reset pending_transactions after callback is done.
+ * Empty the pending state, call callback,
+ * then restore the pending state after callback is done.
  *
  * Pending transactions which no longer validate will be culled.
  */
 template< typename Lambda >
 void without_pending_transactions(
    database& db,
-   std::vector<processed_transaction>&& pending_transactions,
    Lambda callback )
 {
-    pending_transactions_restorer restorer( db, std::move(pending_transactions) );
+    pending_transactions_restorer restorer( db );
     callback();
     return;
 }
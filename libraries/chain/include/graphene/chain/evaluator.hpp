@@ -35,6 +35,7 @@ namespace graphene { namespace chain {
    class account_statistics_object;
    class asset_object;
    class asset_dynamic_data_object;
+   class operation_profiler;
 
    class generic_evaluator
    {
@@ -118,6 +119,10 @@ namespace graphene { namespace chain {
       const asset_object*              fee_asset          = nullptr;
       const asset_dynamic_data_object* fee_asset_dyn_data = nullptr;
       transaction_evaluation_state*    trx_state;
+
+   private:
+      /// start_evaluate() while operation profiling is enabled
+      operation_result profiled_evaluate( operation_profiler& profiler, const operation& op, bool apply );
    };
 
    class op_evaluator
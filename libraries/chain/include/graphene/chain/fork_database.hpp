@@ -27,6 +27,10 @@
 
 #include <graphene/chain/types.hpp>
 
+#include <graphene/db/undo_database.hpp>
+
+#include <functional>
+
 #include <boost/multi_index_container.hpp>
 #include <boost/multi_index/member.hpp>
 #include <boost/multi_index/ordered_index.hpp>
@@ -48,14 +52,31 @@ namespace graphene { namespace chain {
       uint32_t              num;    // initialized in ctor
       block_id_type         id;
       signed_block          data;
+      // whether the transactions of data were released, see fork_database::release_transactions
+      bool                  compact = false;
 
       // contains witness block signing keys scheduled *after* the block has been applied
       shared_ptr< vector< pair< witness_id_type, public_key_type > > > scheduled_witnesses;
       uint64_t                                                         next_block_aslot = 0;
       fc::time_point_sec                                               next_block_time;
+
+      // the changes made by applying the block on top of its previous block, to switch back to it cheaply
+      shared_ptr< const graphene::db::redo_state > changes;
    };
    typedef shared_ptr<fork_item> item_ptr;
 
+   /// Estimated memory held by the fork database, see fork_database::get_memory_usage
+   struct fork_database_memory_usage
+   {
+      uint32_t blocks                  = 0; ///< number of blocks in the fork database
+      uint32_t compact_blocks          = 0; ///< number of them held without their transactions
+      uint64_t block_bytes             = 0; ///< serialized size of the blocks held with their transactions
+      uint64_t scheduled_witness_bytes = 0; ///< witness schedules kept to verify the signers of next blocks
+      uint64_t cached_change_objects   = 0; ///< number of object copies kept to switch back to blocks
+      uint64_t cached_change_bytes     = 0; ///< size of these copies, not counting memory they point to
+      uint64_t total_bytes             = 0; ///< all of the above plus the fork_item of every block
+   };
+
 
    /**
     *  As long as blocks are pushed in order the fork
@@ -110,14 +131,36 @@ namespace graphene { namespace chain {
 
          void set_max_size( uint32_t s );
 
+         /// Loads a block from where it is stored permanently, returns nothing if it is not there
+         typedef std::function< optional<signed_block>( const block_id_type& ) > block_loader;
+         void set_block_loader( block_loader loader ) { _block_loader = std::move( loader ); }
+
+         /**
+          *  Releases the transactions of the blocks more than depth blocks before the given block on its branch,
+          *  keeping their headers. The block loader must be able to load these blocks as long as they are
+          *  compact.
+          */
+         void release_transactions( const block_id_type& head_id, uint32_t depth );
+         /// Loads the transactions of the block back if they were released
+         void load_transactions( fork_item& item )const;
+         /// @return the block with its transactions, without loading them into the fork database
+         signed_block fetch_full_block( const fork_item& item )const;
+
+         fork_database_memory_usage get_memory_usage()const;
+
       private:
          /** @return a pointer to the newly pushed item */
          void _push_block(const item_ptr& b );
          void _push_next(const item_ptr& newly_inserted);
 
          uint32_t                 _max_size = 1024;
+         block_loader             _block_loader;
 
          fork_multi_index_type    _index;
          shared_ptr<fork_item>    _head;
    };
 } } // graphene::chain
+
+FC_REFLECT( graphene::chain::fork_database_memory_usage,
+            (blocks)(compact_blocks)(block_bytes)(scheduled_witness_bytes)
+            (cached_change_objects)(cached_change_bytes)(total_bytes) )
@@ -75,6 +75,7 @@ typedef multi_index_container<
    limit_order_object,
    indexed_by<
       ordered_unique< tag<by_id>, member< object, object_id_type, &object::id > >,
+      hashed_id_index,
       ordered_unique< tag<by_expiration>,
          composite_key< limit_order_object,
             member< limit_order_object, time_point_sec, &limit_order_object::expiration>,
@@ -107,7 +108,7 @@ typedef multi_index_container<
    >
 > limit_order_multi_index_type;
 
-typedef generic_index<limit_order_object, limit_order_multi_index_type> limit_order_index;
+typedef generic_index<limit_order_object, limit_order_multi_index_type, true> limit_order_index;
 
 /**
  * @class call_order_object
@@ -46,5 +46,44 @@ namespace graphene { namespace chain {
          std::set<std::string> active_plugins;
          uint32_t skip_flags = 0;
          std::map< block_id_type, std::vector< fc::variant_object > > debug_updates;
+
+         /// Limits of the replay pipeline, in blocks and in packed bytes read ahead of the block being applied
+         uint32_t replay_queue_blocks = 1000;
+         uint64_t replay_queue_bytes  = 64 * 1024 * 1024;
+
+         /// Write a state checkpoint whenever the last irreversible block advanced by this many blocks, 0 to disable
+         uint32_t state_checkpoint_interval = 0;
+
+         /// Check transaction authorities of a block in parallel before applying it, see database::_apply_block.
+         /// Operations are not executed in parallel.
+         bool parallel_authority_checks = false;
+
+         /// Number of passed transaction authority checks kept to avoid repeating them, 0 to disable
+         uint32_t authority_cache_size = 10000;
+
+         /// Limit of the total packed size of pending transactions, 0 for no limit, see pending_transaction_pool
+         uint64_t pending_pool_bytes = 64 * 1024 * 1024;
+         /// Evict the oldest pending transactions when the limit is reached, instead of those paying the
+         /// lowest fee per byte
+         bool pending_pool_evict_oldest = false;
+
+         /// Maintain a hash of all objects and record it after every block, see database::head_state_hash()
+         bool track_state_hash = false;
+
+         /// Log the phase timing of blocks that take at least this long to apply, 0 to disable,
+         /// see database::get_block_apply_timing()
+         uint32_t slow_block_threshold_ms = 1000;
+
+         /// Keep the object changes of reversible blocks to apply them again without their transactions when
+         /// switching back to a fork, see database::apply_fork_block.
+         /// Blocks applied again this way do not notify database::applied_block, so observers of that signal
+         /// outside of the database miss them: transaction confirmations of network_broadcast_api, block
+         /// subscriptions of database_api, the witness and debug_witness plugins, and the data that the
+         /// elasticsearch, es_objects and snapshot plugins write out.
+         bool cache_block_changes = false;
+
+         /// Number of blocks before the head block that the fork database holds with their transactions, older
+         /// ones are loaded from the block log when needed, 0 to hold all
+         uint32_t fork_db_full_blocks = 64;
    };
 } } // graphene::chain
@@ -0,0 +1,118 @@
+/*
+ * Copyright (c) 2020-2023 Revolution Populi Limited, and contributors.
+ *
+ * The MIT License
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+#pragma once
+
+#include <graphene/chain/types.hpp>
+
+#include <array>
+#include <chrono>
+
+namespace graphene { namespace chain {
+
+   /**
+    *  Histogram of latencies in nanoseconds. Each power of two is split into 8 buckets, so recorded values
+    *  keep about 3 significant bits, like an HDR histogram of 1 significant digit, at a fixed size.
+    */
+   class latency_histogram
+   {
+   public:
+      void     record( uint64_t nsec );
+
+      uint64_t count()const { return _count; }
+      uint64_t max()const   { return _max; }
+      /// @return the upper bound of the bucket that holds the given percentile, e.g. 99 for the 99th
+      uint64_t percentile( double p )const;
+
+   private:
+      static constexpr uint32_t sub_bucket_bits = 3;
+      static constexpr uint32_t sub_buckets     = 1 << sub_bucket_bits;
+
+      static uint32_t bucket_of( uint64_t nsec );
+      static uint64_t upper_bound_of( uint32_t bucket );
+
+      std::array<uint64_t, 64 * sub_buckets> _buckets{};
+      uint64_t                               _count = 0;
+      uint64_t                               _max   = 0;
+   };
+
+   /// What operation_profiler reports for one operation type
+   struct operation_profile
+   {
+      string   operation;
+      uint64_t count                = 0; ///< operations evaluated
+      uint64_t failed               = 0; ///< operations that threw while being evaluated or applied
+      uint64_t evaluate_nsec        = 0; ///< time spent in do_evaluate(), including fee checks
+      uint64_t apply_nsec           = 0; ///< time spent in do_apply(), including fee payment
+      uint64_t evaluate_p50_nsec    = 0;
+      uint64_t evaluate_p99_nsec    = 0;
+      uint64_t evaluate_max_nsec    = 0;
+      uint64_t apply_p50_nsec       = 0;
+      uint64_t apply_p99_nsec       = 0;
+      uint64_t apply_max_nsec       = 0;
+   };
+
+   /**
+    *  Collects per operation type counts, cumulative times and latency histograms of the evaluation and
+    *  application of operations. The database only feeds it while operation profiling is enabled.
+    *
+    *  Times of operations that execute other operations, like proposal_update_operation, include the
+    *  times of those.
+    */
+   class operation_profiler
+   {
+   public:
+      using clock = std::chrono::steady_clock;
+
+      operation_profiler();
+
+      void record_evaluate( int which, clock::duration elapsed );
+      void record_apply( int which, clock::duration elapsed );
+      void record_failure( int which );
+
+      /// @return the profiles of all operation types evaluated so far, the most time consuming first
+      vector<operation_profile> get_profiles()const;
+      /// Logs get_profiles()
+      void log()const;
+      void reset();
+
+   private:
+      struct operation_stats
+      {
+         uint64_t          count         = 0;
+         uint64_t          failed        = 0;
+         uint64_t          evaluate_nsec = 0;
+         uint64_t          apply_nsec    = 0;
+         latency_histogram evaluate;
+         latency_histogram apply;
+      };
+
+      vector<operation_stats> _stats;
+   };
+
+} } // graphene::chain
+
+FC_REFLECT( graphene::chain::operation_profile,
+            (operation)(count)(failed)(evaluate_nsec)(apply_nsec)
+            (evaluate_p50_nsec)(evaluate_p99_nsec)(evaluate_max_nsec)
+            (apply_p50_nsec)(apply_p99_nsec)(apply_max_nsec) )
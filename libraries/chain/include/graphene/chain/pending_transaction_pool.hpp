@@ -0,0 +1,173 @@
+/*
+ * Copyright (c) 2020-2023 Revolution Populi Limited, and contributors.
+ *
+ * The MIT License
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+#pragma once
+
+#include <graphene/protocol/transaction.hpp>
+
+#include <graphene/chain/types.hpp>
+
+#include <boost/multi_index_container.hpp>
+#include <boost/multi_index/member.hpp>
+#include <boost/multi_index/ordered_index.hpp>
+#include <boost/multi_index/hashed_index.hpp>
+#include <boost/multi_index/composite_key.hpp>
+
+#include <unordered_set>
+
+namespace graphene { namespace chain {
+   using boost::multi_index_container;
+   using namespace boost::multi_index;
+
+   /// A transaction waiting in the pending_transaction_pool
+   struct pending_transaction
+   {
+      processed_transaction     trx;
+      transaction_id_type       id;
+      uint64_t                  sequence = 0;     ///< order of arrival in the pool, assigned by the pool
+      uint32_t                  packed_size = 0;  ///< pack_size of trx
+      uint32_t                  results_size = 0; ///< pack_size of trx.operation_results, part of packed_size
+      share_type                fee;              ///< fees of all operations, in core asset
+      uint64_t                  fee_rate = 0;     ///< fee per kilobyte of packed_size
+      account_id_type           fee_payer;        ///< fee payer of the first operation
+      fc::time_point_sec        expiration;
+      bool                      applied = false;  ///< whether it is part of the pending state
+   };
+
+   /**
+    *  Holds the pending transactions of a node, whether they are part of the pending state or not.
+    *
+    *  Transactions are indexed by id, by order of arrival, by fee rate, by expiration and by fee payer.
+    *  The total packed size of the transactions can be limited. When a transaction is added beyond the limit,
+    *  others are evicted, either those paying the lowest fee rate or the oldest ones. Evicting a transaction that
+    *  is part of the pending state does not rebuild it: the transaction leaves the pool at once, but its effects
+    *  stay in the pending state and contains() keeps reporting it until the pending state is next rebuilt, see
+    *  set_none_applied().
+    */
+   class pending_transaction_pool
+   {
+      public:
+         enum eviction_policy
+         {
+            evict_lowest_fee_rate,
+            evict_oldest
+         };
+
+         struct by_trx_id;
+         struct by_sequence;
+         struct by_fee_rate;
+         struct by_expiration;
+         struct by_fee_payer;
+         typedef multi_index_container<
+            pending_transaction,
+            indexed_by<
+               hashed_unique< tag<by_trx_id>,
+                  member< pending_transaction, transaction_id_type, &pending_transaction::id >,
+                  std::hash<transaction_id_type> >,
+               ordered_unique< tag<by_sequence>,
+                  member< pending_transaction, uint64_t, &pending_transaction::sequence > >,
+               ordered_unique< tag<by_fee_rate>,
+                  composite_key< pending_transaction,
+                     member< pending_transaction, uint64_t, &pending_transaction::fee_rate >,
+                     member< pending_transaction, uint64_t, &pending_transaction::sequence >
+                  >,
+                  composite_key_compare< std::greater<uint64_t>, std::less<uint64_t> >
+               >,
+               ordered_non_unique< tag<by_expiration>,
+                  member< pending_transaction, fc::time_point_sec, &pending_transaction::expiration > >,
+               ordered_unique< tag<by_fee_payer>,
+                  composite_key< pending_transaction,
+                     member< pending_transaction, account_id_type, &pending_transaction::fee_payer >,
+                     member< pending_transaction, uint64_t, &pending_transaction::sequence >
+                  >
+               >
+            >
+         > pending_transaction_index;
+
+         /** @return the fee rate of a transaction paying fee with the given packed size */
+         static uint64_t fee_rate( share_type fee, uint32_t packed_size );
+
+         /** Sets the limit of the total packed size of all transactions, 0 for no limit */
+         void set_max_bytes( uint64_t max_bytes ) { _max_bytes = max_bytes; }
+         uint64_t max_bytes()const { return _max_bytes; }
+         void set_eviction_policy( eviction_policy policy ) { _policy = policy; }
+         eviction_policy get_eviction_policy()const { return _policy; }
+
+         /**
+          * @return whether a transaction of the given packed size and fee rate fits, possibly after evicting
+          *         others according to the eviction policy
+          */
+         bool can_accept( uint32_t packed_size, uint64_t fee_rate )const;
+
+         /**
+          *  Adds a transaction, it must not be in the pool. Others are evicted as long as the limit is exceeded,
+          *  but never the new one.
+          *
+          *  @return the evicted transactions, in the order of eviction
+          */
+         vector<pending_transaction> add( pending_transaction&& trx );
+
+         const pending_transaction* find( const transaction_id_type& id )const;
+         /** @return whether the transaction is in the pool, or evicted but still part of the pending state */
+         bool contains( const transaction_id_type& id )const;
+
+         /** Removes a transaction if it is in the pool, @return the removed transaction */
+         optional<pending_transaction> remove( const transaction_id_type& id );
+         /** Removes all transactions that expire before now, @return the number of them */
+         size_t remove_expired( fc::time_point_sec now );
+         void clear();
+
+         /** Marks a transaction as part of the pending state, with the result of applying it again */
+         void set_applied( const transaction_id_type& id, processed_transaction&& trx, uint32_t results_size );
+         /**
+          * Marks all transactions as not being part of the pending state, to be called when the pending state is
+          * discarded. Transactions evicted from the pending state are forgotten.
+          */
+         void set_none_applied();
+
+         size_t   size()const            { return _index.size(); }
+         bool     empty()const           { return _index.empty(); }
+         uint64_t total_bytes()const     { return _total_bytes; }
+         /** @return the number of transactions that are not part of the pending state */
+         size_t   unapplied_count()const { return _unapplied_count; }
+         /** @return the number of transactions evicted since the pending state was last discarded, whose effects
+          *          it still contains */
+         size_t   evicted_applied_count()const { return _evicted_applied.size(); }
+
+         const pending_transaction_index& indices()const { return _index; }
+
+      private:
+         void on_unapplied( bool added );
+         /** @return the transaction to evict next according to the policy, end() if none can be evicted */
+         pending_transaction_index::iterator next_victim();
+         pending_transaction remove( pending_transaction_index::iterator itr );
+
+         pending_transaction_index           _index;
+         std::unordered_set<transaction_id_type> _evicted_applied;
+         uint64_t                            _next_sequence = 0;
+         uint64_t                            _total_bytes = 0;
+         size_t                              _unapplied_count = 0;
+         uint64_t                            _max_bytes = 0;
+         eviction_policy                     _policy = evict_lowest_fee_rate;
+   };
+} } // graphene::chain
@@ -0,0 +1,174 @@
+/*
+ * Copyright (c) 2020-2023 Revolution Populi Limited, and contributors.
+ *
+ * The MIT License
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+#include <graphene/chain/operation_profiler.hpp>
+
+#include <graphene/protocol/operations.hpp>
+
+#include <fc/log/logger.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+namespace graphene { namespace chain {
+
+namespace {
+
+   struct operation_name_visitor
+   {
+      typedef string result_type;
+
+      template<typename Op>
+      string operator()( const Op& )const
+      {
+         string name = fc::get_typename<Op>::name();
+         auto pos = name.rfind( ':' );
+         return pos == string::npos ? name : name.substr( pos + 1 );
+      }
+   };
+
+   uint64_t to_nsec( operation_profiler::clock::duration elapsed )
+   {
+      return uint64_t( std::chrono::duration_cast<std::chrono::nanoseconds>( elapsed ).count() );
+   }
+
+} // anonymous namespace
+
+uint32_t latency_histogram::bucket_of( uint64_t nsec )
+{
+   if( nsec < sub_buckets )
+      return uint32_t( nsec );
+   uint32_t msb = 63;
+   while( !( nsec >> msb ) )
+      --msb;
+   const uint32_t shift = msb - sub_bucket_bits;
+   return ( shift + 1 ) * sub_buckets + uint32_t( ( nsec >> shift ) & ( sub_buckets - 1 ) );
+}
+
+uint64_t latency_histogram::upper_bound_of( uint32_t bucket )
+{
+   if( bucket < sub_buckets )
+      return bucket;
+   const uint32_t shift = bucket / sub_buckets - 1;
+   const uint64_t sub = bucket % sub_buckets;
+   if( shift + sub_bucket_bits + 1 >= 64 )
+      return std::numeric_limits<uint64_t>::max();
+   return ( ( sub_buckets + sub + 1 ) << shift ) - 1;
+}
+
+void latency_histogram::record( uint64_t nsec )
+{
+   ++_buckets[ bucket_of( nsec ) ];
+   ++_count;
+   _max = std::max( _max, nsec );
+}
+
+uint64_t latency_histogram::percentile( double p )const
+{
+   if( _count == 0 )
+      return 0;
+   const uint64_t target = std::max<uint64_t>( 1, uint64_t( std::ceil( double(_count) * p / 100 ) ) );
+   uint64_t seen = 0;
+   for( uint32_t bucket = 0; bucket < _buckets.size(); ++bucket )
+   {
+      seen += _buckets[bucket];
+      if( seen >= target )
+         return std::min( upper_bound_of( bucket ), _max );
+   }
+   return _max;
+}
+
+operation_profiler::operation_profiler()
+   : _stats( operation::count() )
+{
+}
+
+void operation_profiler::record_evaluate( int which, clock::duration elapsed )
+{
+   operation_stats& stats = _stats[which];
+   const uint64_t nsec = to_nsec( elapsed );
+   ++stats.count;
+   stats.evaluate_nsec += nsec;
+   stats.evaluate.record( nsec );
+}
+
+void operation_profiler::record_apply( int which, clock::duration elapsed )
+{
+   operation_stats& stats = _stats[which];
+   const uint64_t nsec = to_nsec( elapsed );
+   stats.apply_nsec += nsec;
+   stats.apply.record( nsec );
+}
+
+void operation_profiler::record_failure( int which )
+{
+   ++_stats[which].failed;
+}
+
+vector<operation_profile> operation_profiler::get_profiles()const
+{
+   vector<operation_profile> result;
+   for( int which = 0; which < int( _stats.size() ); ++which )
+   {
+      const operation_stats& stats = _stats[which];
+      if( stats.count == 0 && stats.failed == 0 )
+         continue;
+      operation op;
+      op.set_which( which );
+      operation_profile profile;
+      profile.operation         = op.visit( operation_name_visitor() );
+      profile.count             = stats.count;
+      profile.failed            = stats.failed;
+      profile.evaluate_nsec     = stats.evaluate_nsec;
+      profile.apply_nsec        = stats.apply_nsec;
+      profile.evaluate_p50_nsec = stats.evaluate.percentile( 50 );
+      profile.evaluate_p99_nsec = stats.evaluate.percentile( 99 );
+      profile.evaluate_max_nsec = stats.evaluate.max();
+      profile.apply_p50_nsec    = stats.apply.percentile( 50 );
+      profile.apply_p99_nsec    = stats.apply.percentile( 99 );
+      profile.apply_max_nsec    = stats.apply.max();
+      result.push_back( std::move( profile ) );
+   }
+   std::sort( result.begin(), result.end(), []( const operation_profile& a, const operation_profile& b ) {
+      return a.evaluate_nsec + a.apply_nsec > b.evaluate_nsec + b.apply_nsec;
+   });
+   return result;
+}
+
+void operation_profiler::log()const
+{
+   for( const operation_profile& p : get_profiles() )
+      ilog( "${op}: ${n} evaluated, ${f} failed; evaluate ${e} us, p50 ${e50} ns, p99 ${e99} ns, max ${emax} ns; "
+            "apply ${a} us, p50 ${a50} ns, p99 ${a99} ns, max ${amax} ns",
+            ("op",p.operation)("n",p.count)("f",p.failed)
+            ("e",p.evaluate_nsec/1000)("e50",p.evaluate_p50_nsec)("e99",p.evaluate_p99_nsec)("emax",p.evaluate_max_nsec)
+            ("a",p.apply_nsec/1000)("a50",p.apply_p50_nsec)("a99",p.apply_p99_nsec)("amax",p.apply_max_nsec) );
+}
+
+void operation_profiler::reset()
+{
+   _stats.assign( operation::count(), operation_stats() );
+}
+
+} } // graphene::chain
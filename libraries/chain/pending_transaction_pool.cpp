@@ -0,0 +1,183 @@
+/*
+ * Copyright (c) 2020-2023 Revolution Populi Limited, and contributors.
+ *
+ * The MIT License
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+#include <graphene/chain/pending_transaction_pool.hpp>
+
+namespace graphene { namespace chain {
+
+uint64_t pending_transaction_pool::fee_rate( share_type fee, uint32_t packed_size )
+{
+   if( fee.value <= 0 )
+      return 0;
+   // fees are far below 2^53, so this does not overflow
+   return uint64_t( fee.value ) * 1024 / std::max<uint32_t>( packed_size, 1 );
+}
+
+bool pending_transaction_pool::can_accept( uint32_t packed_size, uint64_t fee_rate )const
+{
+   if( _max_bytes == 0 || _total_bytes + packed_size <= _max_bytes )
+      return true;
+   if( packed_size > _max_bytes )
+      return false;
+   // any of the transactions, or those paying less, have to make enough room
+   uint64_t remaining = _total_bytes;
+   const auto make_room = [&]( const pending_transaction& trx ) {
+      remaining -= trx.packed_size;
+      return remaining + packed_size <= _max_bytes;
+   };
+   if( _policy == evict_oldest )
+   {
+      for( const auto& trx : _index.get<by_sequence>() )
+         if( make_room( trx ) )
+            return true;
+      return false;
+   }
+   const auto& by_rate = _index.get<by_fee_rate>();
+   for( auto itr = by_rate.rbegin(); itr != by_rate.rend() && itr->fee_rate < fee_rate; ++itr )
+      if( make_room( *itr ) )
+         return true;
+   return false;
+}
+
+pending_transaction_pool::pending_transaction_index::iterator pending_transaction_pool::next_victim()
+{
+   if( _index.empty() )
+      return _index.end();
+   if( _policy == evict_oldest )
+      return _index.project<0>( _index.get<by_sequence>().begin() );
+   return _index.project<0>( std::prev( _index.get<by_fee_rate>().end() ) );
+}
+
+vector<pending_transaction> pending_transaction_pool::add( pending_transaction&& trx )
+{
+   trx.sequence = _next_sequence++;
+   const transaction_id_type id = trx.id;
+   auto result = _index.insert( std::move(trx) );
+   FC_ASSERT( result.second, "Transaction ${id} is in the pool already", ("id",id) );
+   _total_bytes += result.first->packed_size;
+   if( !result.first->applied )
+      on_unapplied( true );
+
+   vector<pending_transaction> evicted;
+   while( _max_bytes > 0 && _total_bytes > _max_bytes )
+   {
+      const pending_transaction_index::iterator victim = next_victim();
+      if( victim == _index.end() || victim->id == id )
+         break;
+      // rebuilding the pending state right away would cost more than keeping the effects until the next block
+      if( victim->applied )
+         _evicted_applied.insert( victim->id );
+      evicted.push_back( remove( victim ) );
+   }
+   return evicted;
+}
+
+const pending_transaction* pending_transaction_pool::find( const transaction_id_type& id )const
+{
+   auto itr = _index.find( id );
+   return itr == _index.end() ? nullptr : &*itr;
+}
+
+bool pending_transaction_pool::contains( const transaction_id_type& id )const
+{
+   return find( id ) != nullptr || _evicted_applied.find( id ) != _evicted_applied.end();
+}
+
+optional<pending_transaction> pending_transaction_pool::remove( const transaction_id_type& id )
+{
+   auto itr = _index.find( id );
+   if( itr == _index.end() )
+      return {};
+   return remove( itr );
+}
+
+pending_transaction pending_transaction_pool::remove( pending_transaction_index::iterator itr )
+{
+   _total_bytes -= itr->packed_size;
+   if( !itr->applied )
+      on_unapplied( false );
+   // elements of a multi_index_container are const, the element is erased right after being moved from
+   pending_transaction result = std::move( const_cast<pending_transaction&>( *itr ) );
+   _index.erase( itr );
+   return result;
+}
+
+size_t pending_transaction_pool::remove_expired( fc::time_point_sec now )
+{
+   auto& by_exp = _index.get<by_expiration>();
+   size_t count = 0;
+   while( !by_exp.empty() && by_exp.begin()->expiration < now )
+   {
+      remove( _index.project<0>( by_exp.begin() ) );
+      ++count;
+   }
+   return count;
+}
+
+void pending_transaction_pool::clear()
+{
+   _index.clear();
+   _evicted_applied.clear();
+   _total_bytes = 0;
+   _unapplied_count = 0;
+}
+
+void pending_transaction_pool::set_applied( const transaction_id_type& id, processed_transaction&& trx,
+                                            uint32_t results_size )
+{
+   auto itr = _index.find( id );
+   FC_ASSERT( itr != _index.end(), "Transaction ${id} is not in the pool", ("id",id) );
+   if( !itr->applied )
+      on_unapplied( false );
+   _total_bytes -= itr->packed_size;
+   _index.modify( itr, [&trx,results_size]( pending_transaction& entry ) {
+      entry.packed_size = entry.packed_size - entry.results_size + results_size;
+      entry.results_size = results_size;
+      entry.fee_rate = fee_rate( entry.fee, entry.packed_size );
+      entry.trx = std::move( trx );
+      entry.applied = true;
+   } );
+   _total_bytes += itr->packed_size;
+}
+
+void pending_transaction_pool::set_none_applied()
+{
+   _evicted_applied.clear();
+   for( auto itr = _index.begin(); itr != _index.end(); ++itr )
+   {
+      if( !itr->applied )
+         continue;
+      on_unapplied( true );
+      _index.modify( itr, []( pending_transaction& trx ) { trx.applied = false; } );
+   }
+}
+
+void pending_transaction_pool::on_unapplied( bool added )
+{
+   if( added )
+      ++_unapplied_count;
+   else
+      --_unapplied_count;
+}
+
+} } // graphene::chain
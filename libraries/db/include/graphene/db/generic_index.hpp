@@ -26,6 +26,7 @@
 #include <boost/multi_index_container.hpp>
 #include <boost/multi_index/member.hpp>
 #include <boost/multi_index/ordered_index.hpp>
+#include <boost/multi_index/hashed_index.hpp>
 #include <boost/multi_index/mem_fun.hpp>
 
 namespace graphene { namespace db {
@@ -34,12 +35,24 @@ namespace graphene { namespace db {
    using namespace boost::multi_index;
 
    struct by_id;
+   struct by_hashed_id;
+
+   /**
+    *  Hashed index on the object ID. Frequently searched indexes can add it to their MultiIndexType
+    *  behind the ordered index on the ID, and set HashedIdLookup in generic_index, to make find()
+    *  constant time instead of a tree walk. The ordered index keeps iteration in ID order.
+    */
+   typedef hashed_unique< tag<by_hashed_id>, member< object, object_id_type, &object::id >,
+                          std::hash<object_id_type> > hashed_id_index;
+
    /**
     *  Almost all objects can be tracked and managed via a boost::multi_index container that uses
     *  an unordered_unique key on the object ID.  This template class adapts the generic index interface
     *  to work with arbitrary boost multi_index containers on the same type.
+    *
+    *  If HashedIdLookup is set, MultiIndexType must contain a hashed_id_index which find() will use.
     */
-   template<typename ObjectType, typename MultiIndexType>
+   template<typename ObjectType, typename MultiIndexType, bool HashedIdLookup = false>
    class generic_index : public index
    {
       public:
@@ -97,9 +110,7 @@ namespace graphene { namespace db {
          {
             static_assert(std::is_same<typename MultiIndexType::key_type, object_id_type>::value,
                           "First index of MultiIndexType MUST be object_id_type!");
-            auto itr = _indices.find( id );
-            if( itr == _indices.end() ) return nullptr;
-            return &*itr;
+            return find_by_id( id, std::integral_constant<bool, HashedIdLookup>() );
          }
 
          virtual void inspect_all_objects(std::function<void (const object&)> inspector)const override
@@ -110,9 +121,34 @@ namespace graphene { namespace db {
             } FC_CAPTURE_AND_RETHROW()
          }
 
+         virtual void inspect_objects_from( object_id_type first,
+                                            std::function<bool (const object&)> inspector )const override
+         {
+            try {
+               for( auto itr = _indices.lower_bound( first ); itr != _indices.end(); ++itr )
+                  if( !inspector(*itr) )
+                     break;
+            } FC_CAPTURE_AND_RETHROW( (first) )
+         }
+
          const index_type& indices()const { return _indices; }
 
       private:
+         const object* find_by_id( object_id_type id, std::false_type )const
+         {
+            auto itr = _indices.find( id );
+            if( itr == _indices.end() ) return nullptr;
+            return &*itr;
+         }
+
+         const object* find_by_id( object_id_type id, std::true_type )const
+         {
+            const auto& by_hash = _indices.template get<by_hashed_id>();
+            auto itr = by_hash.find( id );
+            if( itr == by_hash.end() ) return nullptr;
+            return &*itr;
+         }
+
          index_type  _indices;
    };
 
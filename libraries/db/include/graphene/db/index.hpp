@@ -23,6 +23,7 @@
  */
 #pragma once
 #include <graphene/db/object.hpp>
+#include <graphene/db/undo_database.hpp>
 
 #include <fc/interprocess/file_mapping.hpp>
 #include <fc/io/raw.hpp>
@@ -30,6 +31,7 @@
 #include <fc/crypto/sha256.hpp>
 
 #include <fstream>
+#include <memory>
 #include <stack>
 
 namespace graphene { namespace db {
@@ -52,6 +54,40 @@ namespace graphene { namespace db {
          virtual void on_modify( const object& obj ){}
    };
 
+   /**
+    *  An order independent commitment to a set of objects: the sum of the sha256 digests of the packed
+    *  objects, taken as four 64 bit lanes. Objects can be added and removed in any order.
+    */
+   struct state_hash_accumulator
+   {
+      uint64_t lanes[4] = { 0, 0, 0, 0 };
+
+      void add( const fc::sha256& h )
+      {
+         for( size_t i = 0; i < 4; ++i )
+            lanes[i] += h._hash[i];
+      }
+      void subtract( const fc::sha256& h )
+      {
+         for( size_t i = 0; i < 4; ++i )
+            lanes[i] -= h._hash[i];
+      }
+      void add( const state_hash_accumulator& other )
+      {
+         for( size_t i = 0; i < 4; ++i )
+            lanes[i] += other.lanes[i];
+      }
+
+      /** @return a digest of the sum */
+      fc::sha256 digest()const
+      {
+         fc::sha256::encoder enc;
+         for( size_t i = 0; i < 4; ++i )
+            fc::raw::pack( enc, lanes[i] );
+         return enc.result();
+      }
+   };
+
    /**
     *  @class index
     *  @brief abstract base class for accessing objects indexed in various ways.
@@ -98,7 +134,41 @@ namespace graphene { namespace db {
           */
          virtual void open( const fc::path& db ) = 0;
          virtual void save( const fc::path& db ) = 0;
+         /**
+          *  Writes part of the index in the format of save( path ), but with the objects and next id it had in
+          *  the given base state, so that a file can be written in several steps with changes in between.
+          *  The file header is written if next is object_id_type( space, type, 0 ), then one chunk with the
+          *  objects from next on. next is advanced past the objects written.
+          *  @return false if the file is complete
+          */
+         virtual bool save_chunk( std::ostream& out, const undo_base_state& base, object_id_type& next )const = 0;
 
+         /**
+          *  Staged variant of open() that lets the caller unpack the chunks of an index file in parallel.
+          *  begin_load() maps the file and returns the number of chunks found in it, load_chunk() unpacks
+          *  one of them (calls for distinct chunks may run concurrently), insert_chunk() inserts the objects
+          *  of an unpacked chunk and frees them, chunks must be inserted in file order. end_load() inserts
+          *  the chunks not inserted yet and releases the file. Files in the legacy format are loaded
+          *  entirely by begin_load().
+          */
+         virtual size_t begin_load( const fc::path& db ) = 0;
+         virtual void   load_chunk( size_t chunk ) = 0;
+         virtual void   insert_chunk( size_t chunk ) = 0;
+         virtual void   end_load() = 0;
+
+         /**
+          *  @return a counter that changes whenever the index content or its next id changes, except
+          *  when objects are loaded from a file
+          */
+         virtual uint64_t get_generation()const = 0;
+
+         /**
+          *  Starts or stops maintaining get_state_hash(). Enabling it hashes all objects currently in the index,
+          *  afterwards every change updates the hash.
+          */
+         virtual void set_state_hash_enabled( bool enabled ) = 0;
+         /** @return the sum of the hashes of all objects in the index, empty if not enabled */
+         virtual const state_hash_accumulator& get_state_hash()const = 0;
 
 
          /** @return the object with id or nullptr if not found */
@@ -130,6 +200,9 @@ namespace graphene { namespace db {
          }
 
          virtual void               inspect_all_objects(std::function<void(const object&)> inspector)const = 0;
+         /** Calls inspector for the objects with ids from first on in id order, until it returns false */
+         virtual void               inspect_objects_from( object_id_type first,
+                                                          std::function<bool(const object&)> inspector )const = 0;
          virtual void               add_observer( const shared_ptr<index_observer>& ) = 0;
 
          virtual void               object_from_variant( const fc::variant& var, object& obj, uint32_t max_depth )const = 0;
@@ -187,6 +260,9 @@ namespace graphene { namespace db {
       protected:
          vector< shared_ptr<index_observer> >   _observers;
          vector< unique_ptr<secondary_index> >  _sindex;
+         uint64_t                               _generation = 0;
+         bool                                   _hash_objects = false;
+         state_hash_accumulator                 _state_hash;
 
       private:
          object_database& _db;
@@ -298,6 +374,120 @@ namespace graphene { namespace db {
          };
    };
 
+   /** Passed as DirectBits to primary_index to track objects in an auto_direct_index */
+   const uint8_t direct_auto = 0xff;
+
+   /** @class auto_direct_index
+    *  @brief A secondary index that tracks objects in chunked arrays indexed by object id, like
+    *  direct_index, but without a fixed chunk size and without a limit on holes.
+    *
+    *  Chunks double in size with the id range, from 64 up to 64Ki slots, so that small indexes stay
+    *  small and large ones need few chunks. Removed ids are kept as null slots, and a chunk whose
+    *  objects have all been removed is freed. This suits indexes whose ids are allocated sequentially
+    *  and that are mostly populated, or only populated within a moving window.
+    */
+   template<typename Object>
+   class auto_direct_index : public secondary_index
+   {
+         static const uint8_t first_bits = 6;
+         static const uint8_t max_bits   = 16;
+         /** number of ids covered by the chunks growing in size */
+         static const uint64_t growing_range = ( uint64_t(1) << max_bits ) - ( uint64_t(1) << first_bits );
+
+         struct chunk
+         {
+            std::unique_ptr< const Object*[] > slots;
+            uint32_t                           live = 0;
+         };
+
+         vector< chunk >                content;
+         std::stack< object_id_type >   ids_being_modified;
+
+         static uint8_t chunk_bits( size_t c )
+         {
+            return uint8_t( std::min<size_t>( first_bits + c, max_bits ) );
+         }
+
+         /** @return chunk number and slot within that chunk */
+         static std::pair<size_t, size_t> locate( uint64_t instance )
+         {
+            if( instance < growing_range )
+            {
+               const uint64_t shifted = instance + ( uint64_t(1) << first_bits );
+               uint8_t bits = first_bits;
+               while( ( shifted >> ( bits + 1 ) ) != 0 )
+                  ++bits;
+               return std::make_pair( size_t( bits - first_bits ), size_t( shifted - ( uint64_t(1) << bits ) ) );
+            }
+            const uint64_t rest = instance - growing_range;
+            return std::make_pair( size_t( max_bits - first_bits + ( rest >> max_bits ) ),
+                                   size_t( rest & ( ( uint64_t(1) << max_bits ) - 1 ) ) );
+         }
+
+      public:
+         virtual ~auto_direct_index(){}
+
+         virtual void object_inserted( const object& obj )
+         {
+            FC_ASSERT( nullptr != dynamic_cast<const Object*>(&obj), "Wrong object type!" );
+            const auto pos = locate( obj.id.instance() );
+            if( content.size() <= pos.first )
+               content.resize( pos.first + 1 );
+            chunk& c = content[pos.first];
+            if( !c.slots )
+            {
+               const size_t size = size_t(1) << chunk_bits( pos.first );
+               c.slots.reset( new const Object*[size] );
+               std::fill( c.slots.get(), c.slots.get() + size, nullptr );
+            }
+            FC_ASSERT( !c.slots[pos.second], "Overwriting insert at {id}!", ("id",obj.id) );
+            c.slots[pos.second] = static_cast<const Object*>( &obj );
+            ++c.live;
+         }
+
+         virtual void object_removed( const object& obj )
+         {
+            FC_ASSERT( nullptr != dynamic_cast<const Object*>(&obj), "Wrong object type!" );
+            const auto pos = locate( obj.id.instance() );
+            FC_ASSERT( pos.first < content.size() && content[pos.first].slots && content[pos.first].slots[pos.second],
+                       "Removing non-existent object {id}!", ("id",obj.id) );
+            chunk& c = content[pos.first];
+            c.slots[pos.second] = nullptr;
+            if( --c.live == 0 )
+               c.slots.reset();
+         }
+
+         virtual void about_to_modify( const object& before )
+         {
+            ids_being_modified.emplace( before.id );
+         }
+
+         virtual void object_modified( const object& after  )
+         {
+            FC_ASSERT( ids_being_modified.top() == after.id, "Modification of ID is not supported!");
+            ids_being_modified.pop();
+         }
+
+         const Object* find( const object_id_type& id )const
+         {
+            FC_ASSERT( id.space() == Object::space_id, "Space ID mismatch!" );
+            FC_ASSERT( id.type() == Object::type_id, "Type_ID mismatch!" );
+            const auto pos = locate( id.instance() );
+            if( pos.first >= content.size() || !content[pos.first].slots ) return nullptr;
+            return content[pos.first].slots[pos.second];
+         }
+
+         /** @return bytes allocated for the lookup arrays */
+         size_t memory_usage()const
+         {
+            size_t result = content.capacity() * sizeof(chunk);
+            for( size_t c = 0; c < content.size(); ++c )
+               if( content[c].slots )
+                  result += ( size_t(1) << chunk_bits( c ) ) * sizeof(const Object*);
+            return result;
+         }
+   };
+
    /**
     * @class primary_index
     * @brief  Wraps a derived index to intercept calls to create, modify, and remove so that
@@ -311,11 +501,15 @@ namespace graphene { namespace db {
       public:
          typedef typename DerivedIndex::object_type object_type;
 
+         /** the secondary index used for id lookups if DirectBits > 0 */
+         typedef typename std::conditional< DirectBits == direct_auto, auto_direct_index< object_type >,
+                                            direct_index< object_type, DirectBits > >::type direct_index_type;
+
          primary_index( object_database& db )
          :base_primary_index(db),_next_id(object_type::space_id,object_type::type_id,0)
          {
             if( DirectBits > 0 )
-               _direct_by_id = add_secondary_index< direct_index< object_type, DirectBits > >();
+               _direct_by_id = add_secondary_index< direct_index_type >();
          }
 
          virtual uint8_t object_space_id()const override
@@ -325,8 +519,19 @@ namespace graphene { namespace db {
          { return object_type::type_id; }
 
          virtual object_id_type get_next_id()const override              { return _next_id;    }
-         virtual void           use_next_id()override                    { ++_next_id.number;  }
-         virtual void           set_next_id( object_id_type id )override { _next_id = id;      }
+         virtual void           use_next_id()override                    { ++_next_id.number; ++_generation; }
+         virtual void           set_next_id( object_id_type id )override { _next_id = id;      ++_generation; }
+
+         virtual uint64_t       get_generation()const override           { return _generation; }
+
+         virtual void set_state_hash_enabled( bool enabled )override
+         {
+            _state_hash = state_hash_accumulator();
+            _hash_objects = enabled;
+            if( enabled )
+               this->inspect_all_objects( [this]( const object& o ) { _state_hash.add( object_hash( o ) ); } );
+         }
+         virtual const state_hash_accumulator& get_state_hash()const override { return _state_hash; }
 
          /** @return the object with id or nullptr if not found */
          virtual const object*  find( object_id_type id )const override
@@ -336,44 +541,174 @@ namespace graphene { namespace db {
             return DerivedIndex::find( id );
          }
 
+         /** Written by save(): objects are packed back to back in chunks of about chunk_size bytes */
          fc::sha256 get_object_version()const
          {
-            std::string desc = "1.0";//get_type_description<object_type>();
+            std::string desc = "2.0";//get_type_description<object_type>();
+            return fc::sha256::hash(desc);
+         }
+
+         /** Older files wrap every object into its own packed vector<char>, still accepted by open() */
+         fc::sha256 get_legacy_object_version()const
+         {
+            std::string desc = "1.0";
             return fc::sha256::hash(desc);
          }
 
          virtual void open( const path& db )override
-         { 
-            if( !fc::exists( db ) ) return;
-            fc::file_mapping fm( db.generic_string().c_str(), fc::read_only );
-            fc::mapped_region mr( fm, fc::read_only, 0, fc::file_size(db) );
-            fc::datastream<const char*> ds( (const char*)mr.get_address(), mr.get_size() );
+         {
+            const size_t chunks = begin_load( db );
+            for( size_t chunk = 0; chunk < chunks; ++chunk )
+               load_chunk( chunk );
+            end_load();
+         }
+
+         virtual size_t begin_load( const path& db )override
+         {
+            _load_state.reset();
+            if( !fc::exists( db ) ) return 0;
+            auto state = std::make_unique<load_state>( db );
+            const char* start = (const char*)state->region.get_address();
+            fc::datastream<const char*> ds( start, state->region.get_size() );
             fc::sha256 open_ver;
 
             fc::raw::unpack(ds, _next_id);
             fc::raw::unpack(ds, open_ver);
+            if( open_ver == get_legacy_object_version() )
+            {
+               vector<char> tmp;
+               while( ds.remaining() > 0 )
+               {
+                  fc::raw::unpack( ds, tmp );
+                  load( tmp );
+               }
+               return 0;
+            }
             FC_ASSERT( open_ver == get_object_version(), "Incompatible Version, the serialization of objects in this index has changed" );
-            vector<char> tmp;
             while( ds.remaining() > 0 )
             {
-               fc::raw::unpack( ds, tmp );
-               load( tmp );
+               load_chunk_data chunk;
+               fc::raw::unpack( ds, chunk.count );
+               fc::raw::unpack( ds, chunk.size );
+               FC_ASSERT( chunk.size <= ds.remaining(), "Truncated object database file ${f}", ("f",db) );
+               chunk.data = start + ds.tellp();
+               ds.skip( chunk.size );
+               state->chunks.emplace_back( std::move( chunk ) );
+            }
+            _load_state = std::move( state );
+            return _load_state->chunks.size();
+         }
+
+         virtual void load_chunk( size_t chunk )override
+         {
+            FC_ASSERT( _load_state && chunk < _load_state->chunks.size(), "Invalid chunk ${c}", ("c",chunk) );
+            auto& data = _load_state->chunks[chunk];
+            fc::datastream<const char*> ds( data.data, data.size );
+            data.objects.resize( data.count );
+            for( auto& obj : data.objects )
+               fc::raw::unpack( ds, obj );
+            FC_ASSERT( ds.remaining() == 0, "Unexpected trailing data in chunk ${c}", ("c",chunk) );
+         }
+
+         virtual void insert_chunk( size_t chunk )override
+         {
+            FC_ASSERT( _load_state && chunk == _load_state->next_insert && chunk < _load_state->chunks.size(),
+                       "Chunk ${c} inserted out of order", ("c",chunk) );
+            auto& data = _load_state->chunks[chunk];
+            for( auto& obj : data.objects )
+            {
+               const auto& result = DerivedIndex::insert( std::move( obj ) );
+               for( const auto& item : _sindex )
+                  item->object_inserted( result );
+               if( _hash_objects )
+                  _state_hash.add( object_hash( result ) );
             }
+            vector<object_type>().swap( data.objects );
+            ++_load_state->next_insert;
+         }
+
+         virtual void end_load()override
+         {
+            if( !_load_state ) return;
+            while( _load_state->next_insert < _load_state->chunks.size() )
+               insert_chunk( _load_state->next_insert );
+            _load_state.reset();
          }
 
-         virtual void save( const path& db ) override 
+         virtual void save( const path& db ) override
          {
-            std::ofstream out( db.generic_string(), 
+            std::ofstream out( db.generic_string(),
                                std::ofstream::binary | std::ofstream::out | std::ofstream::trunc );
             FC_ASSERT( out );
-            auto ver  = get_object_version();
-            fc::raw::pack( out, _next_id );
-            fc::raw::pack( out, ver );
-            this->inspect_all_objects( [&]( const object& o ) {
-                auto vec = fc::raw::pack( static_cast<const object_type&>(o) );
-                auto packed_vec = fc::raw::pack( vec );
-                out.write( packed_vec.data(), packed_vec.size() );
+            object_id_type next( object_type::space_id, object_type::type_id, 0 );
+            while( save_chunk( out, undo_base_state(), next ) ) {}
+            FC_ASSERT( out, "Failed to write ${f}", ("f",db) );
+         }
+
+         virtual bool save_chunk( std::ostream& out, const undo_base_state& base, object_id_type& next )const override
+         {
+            const object_id_type index_id( object_type::space_id, object_type::type_id, 0 );
+            if( next == index_id )
+            {
+               const auto next_itr = base.next_ids.find( index_id );
+               const object_id_type next_id = ( next_itr != base.next_ids.end() ? next_itr->second : _next_id );
+               auto ver  = get_object_version();
+               fc::raw::pack( out, next_id );
+               fc::raw::pack( out, ver );
+            }
+
+            vector<char> buffer;
+            buffer.reserve( chunk_size );
+            uint64_t count = 0;
+            bool full = false;
+            const auto add_object = [&]( const object& o ) {
+               const auto& obj = static_cast<const object_type&>(o);
+               const size_t pos = buffer.size();
+               buffer.resize( pos + fc::raw::pack_size( obj ) );
+               fc::datastream<char*> ds( buffer.data() + pos, buffer.size() - pos );
+               fc::raw::pack( ds, obj );
+               ++count;
+               full = ( buffer.size() >= chunk_size );
+            };
+
+            // objects that differ in the base state are taken from there, merging both in id order
+            const auto in_index = [&index_id]( const object_id_type& id ) {
+               return id.space() == index_id.space() && id.type() == index_id.type();
+            };
+            auto base_itr = base.objects.lower_bound( next );
+            const auto add_base_objects_before = [&]( const object_id_type* id ) {
+               for( ; !full && base_itr != base.objects.end() && in_index( base_itr->first )
+                      && ( id == nullptr || base_itr->first < *id ); ++base_itr )
+               {
+                  if( base_itr->second != nullptr )
+                     add_object( *base_itr->second );
+                  next = base_itr->first + 1;
+               }
+            };
+            this->inspect_objects_from( next, [&]( const object& o ) {
+               add_base_objects_before( &o.id );
+               if( full )
+                  return false;
+               if( base_itr != base.objects.end() && base_itr->first == o.id )
+               {
+                  if( base_itr->second != nullptr )
+                     add_object( *base_itr->second );
+                  ++base_itr;
+               }
+               else
+                  add_object( o );
+               next = o.id + 1;
+               return !full;
             });
+            add_base_objects_before( nullptr );
+            if( count > 0 )
+            {
+               const uint64_t size = buffer.size();
+               fc::raw::pack( out, count );
+               fc::raw::pack( out, size );
+               out.write( buffer.data(), buffer.size() );
+            }
+            return full;
          }
 
          virtual const object&  load( const std::vector<char>& data )override
@@ -381,6 +716,8 @@ namespace graphene { namespace db {
             const auto& result = DerivedIndex::insert( fc::raw::unpack<object_type>( data ) );
             for( const auto& item : _sindex )
                item->object_inserted( result );
+            if( _hash_objects )
+               _state_hash.add( object_hash( result ) );
             return result;
          }
 
@@ -390,6 +727,8 @@ namespace graphene { namespace db {
             const auto& result = DerivedIndex::create( constructor );
             for( const auto& item : _sindex )
                item->object_inserted( result );
+            if( _hash_objects )
+               _state_hash.add( object_hash( result ) );
             on_add( result );
             return result;
          }
@@ -399,6 +738,8 @@ namespace graphene { namespace db {
             const auto& result = DerivedIndex::insert( std::move( obj ) );
             for( const auto& item : _sindex )
                item->object_inserted( result );
+            if( _hash_objects )
+               _state_hash.add( object_hash( result ) );
             on_add( result );
             return result;
          }
@@ -407,6 +748,8 @@ namespace graphene { namespace db {
          {
             for( const auto& item : _sindex )
                item->object_removed( obj );
+            if( _hash_objects )
+               _state_hash.subtract( object_hash( obj ) );
             on_remove(obj);
             DerivedIndex::remove(obj);
          }
@@ -416,7 +759,13 @@ namespace graphene { namespace db {
             save_undo( obj );
             for( const auto& item : _sindex )
                item->about_to_modify( obj );
+            const fc::sha256 before = ( _hash_objects ? object_hash( obj ) : fc::sha256() );
             DerivedIndex::modify( obj, m );
+            if( _hash_objects )
+            {
+               _state_hash.subtract( before );
+               _state_hash.add( object_hash( obj ) );
+            }
             for( const auto& item : _sindex )
                item->object_modified( obj );
             on_modify( obj );
@@ -446,8 +795,41 @@ namespace graphene { namespace db {
          }
 
       private:
+         static fc::sha256 object_hash( const object& o )
+         {
+            fc::sha256::encoder enc;
+            fc::raw::pack( enc, static_cast<const object_type&>( o ) );
+            return enc.result();
+         }
+
+         /** Target size of a chunk in the files written by save() */
+         static const size_t chunk_size = 1024 * 1024;
+
+         struct load_chunk_data
+         {
+            const char*          data = nullptr;
+            uint64_t             size = 0;
+            uint64_t             count = 0;
+            vector<object_type>  objects;
+         };
+
+         /** Keeps the index file mapped between begin_load() and end_load() */
+         struct load_state
+         {
+            load_state( const path& db )
+            : mapping( db.generic_string().c_str(), fc::read_only ),
+              region( mapping, fc::read_only, 0, fc::file_size(db) ) {}
+
+            fc::file_mapping         mapping;
+            fc::mapped_region        region;
+            vector<load_chunk_data>  chunks;
+            /** The next chunk to be inserted */
+            size_t                   next_insert = 0;
+         };
+
          object_id_type                                 _next_id;
-         const direct_index< object_type, DirectBits >* _direct_by_id = nullptr;
+         const direct_index_type*                       _direct_by_id = nullptr;
+         unique_ptr<load_state>                         _load_state;
    };
 
 } } // graphene::db
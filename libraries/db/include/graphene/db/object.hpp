@@ -27,6 +27,8 @@
 #include <fc/io/raw.hpp>
 #include <fc/crypto/city.hpp>
 
+#include <new>
+
 #define MAX_NESTING (200)
 
 namespace graphene { namespace db {
@@ -70,6 +72,10 @@ namespace graphene { namespace db {
 
          /// these methods are implemented for derived classes by inheriting abstract_object<DerivedClass>
          virtual unique_ptr<object> clone()const = 0;
+         /// copy-constructs the most derived object at memory, which must fit object_size() and object_alignment()
+         virtual object*            clone_at( void* memory )const = 0;
+         virtual size_t             object_size()const = 0;
+         virtual size_t             object_alignment()const = 0;
          virtual void               move_from( object& obj ) = 0;
          virtual variant            to_variant()const  = 0;
          virtual vector<char>       pack()const = 0;
@@ -90,6 +96,12 @@ namespace graphene { namespace db {
          {
             return unique_ptr<object>( std::make_unique<DerivedClass>( *static_cast<const DerivedClass*>(this) ) );
          }
+         virtual object* clone_at( void* memory )const
+         {
+            return new (memory) DerivedClass( *static_cast<const DerivedClass*>(this) );
+         }
+         virtual size_t  object_size()const      { return sizeof(DerivedClass);  }
+         virtual size_t  object_alignment()const { return alignof(DerivedClass); }
 
          virtual void    move_from( object& obj )
          {
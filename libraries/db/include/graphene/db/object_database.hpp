@@ -27,8 +27,12 @@
 #include <graphene/db/undo_database.hpp>
 
 #include <fc/log/logger.hpp>
+#include <fc/thread/future.hpp>
 
 #include <map>
+#include <sstream>
+
+namespace fc { class thread; }
 
 namespace graphene { namespace db {
 
@@ -42,17 +46,46 @@ namespace graphene { namespace db {
          object_database();
          ~object_database();
 
-         void reset_indexes() { _index.clear(); _index.resize(255); }
+         void reset_indexes() { wait_for_checkpoint(); _index.clear(); _index.resize(255); _flushed_generations.clear(); }
 
          void open(const fc::path& data_dir );
 
          /**
-          * Saves the complete state of the object_database to disk, this could take a while
+          * Saves the complete state of the object_database to disk. Only indexes modified since the
+          * last open or flush are rewritten, the files of the others are hard-linked into the new copy.
           */
          void flush();
+
+         /**
+          * Starts saving the state as it was before the oldest undo session, i.e. at a block boundary at or
+          * below the last irreversible block, without blocking further changes. A task on the calling thread
+          * serializes the indexes to memory one chunk at a time and yields in between, so that blocks can be
+          * applied meanwhile; the undo stack keeps its oldest sessions until then, at most
+          * undo_database::max_held_sessions() beyond its usual size. The files are written by a background
+          * thread using the same protocol as flush(). The checkpoint is discarded if undo tracking is
+          * disabled or the undo history is cut short before serialization is complete.
+          *
+          * @return false if the previous checkpoint is still being written
+          */
+         bool start_checkpoint();
+         /** Waits until the last checkpoint started by start_checkpoint() has been written */
+         void wait_for_checkpoint();
+
          void wipe(const fc::path& data_dir); // remove from disk
          void close();
 
+         /**
+          * Hashes all objects now and keeps the hash up to date with every later change, see get_state_hash().
+          * Indexes added later are included as well.
+          */
+         void enable_state_hash();
+         bool state_hash_enabled()const { return _state_hash_enabled; }
+         /**
+          * @return a digest of all objects in the database, which only depends on the objects and not on the
+          * order of the changes that led to them, or an empty hash if enable_state_hash() was not called
+          */
+         fc::sha256 get_state_hash()const;
+
          template<typename T, typename F>
          const T& create( F&& constructor )
          {
@@ -139,6 +172,8 @@ namespace graphene { namespace db {
                 _index[ObjectType::space_id].resize( 255 );
             assert(!_index[ObjectType::space_id][ObjectType::type_id]);
             unique_ptr<index> indexptr( std::make_unique<IndexType>(*this) );
+            if( _state_hash_enabled )
+               indexptr->set_state_hash_enabled( true );
             _index[ObjectType::space_id][ObjectType::type_id] = std::move(indexptr);
             return static_cast<IndexType*>(_index[ObjectType::space_id][ObjectType::type_id].get());
          }
@@ -174,8 +209,36 @@ namespace graphene { namespace db {
          void save_undo_add( const object& obj );
          void save_undo_remove( const object& obj );
 
+         /** Prepares an empty object_database.tmp directory next to the current copy */
+         void begin_save();
+         /**
+          * Hard-links the file of an index into object_database.tmp if the current copy holds that generation
+          * @return false if the file has to be saved
+          */
+         bool link_unchanged( uint8_t space, uint8_t type, uint64_t generation )const;
+         /** Replaces the current copy with object_database.tmp */
+         void end_save();
+
+         struct checkpoint_file
+         {
+            uint8_t                            space;
+            uint8_t                            type;
+            uint64_t                           generation;
+            bool                               as_of_base; ///< differs from the current content of the index
+            std::unique_ptr<std::stringstream> data;       ///< null if the file of the current copy can be reused
+         };
+         /** Serializes all indexes as of the base state of the undo stack, yielding after each chunk */
+         std::shared_ptr< std::vector<checkpoint_file> > serialize_checkpoint( uint64_t base_revision );
+         /** Writes the serialized indexes like flush() does, runs on the checkpoint thread */
+         void write_checkpoint( std::vector<checkpoint_file>& files );
+
          fc::path                                                  _data_dir;
          vector< vector< unique_ptr<index> > >                     _index;
+         /** index generation matching the file in _data_dir/object_database, by (space,type) */
+         std::map< std::pair<uint8_t,uint8_t>, uint64_t >          _flushed_generations;
+         std::unique_ptr<fc::thread>                               _checkpoint_thread;
+         fc::future<void>                                          _checkpoint_done;
+         bool                                                      _state_hash_enabled = false;
    };
 
 } } // graphene::db
@@ -99,6 +99,16 @@ namespace graphene { namespace db {
             } FC_CAPTURE_AND_RETHROW()
          }
 
+         virtual void inspect_objects_from( object_id_type first,
+                                            std::function<bool (const object&)> inspector )const override
+         {
+            try {
+               for( auto instance = first.instance(); instance < _objects.size(); ++instance )
+                  if( _objects[instance] && !inspector(*_objects[instance]) )
+                     break;
+            } FC_CAPTURE_AND_RETHROW( (first) )
+         }
+
          class const_iterator
          {
             public:
@@ -24,23 +24,321 @@
 #pragma once
 #include <graphene/db/object.hpp>
 #include <deque>
+#include <map>
 #include <fc/exception/exception.hpp>
 
 namespace graphene { namespace db {
 
-   using std::unordered_map;
    using fc::flat_set;
    class object_database;
 
+   /**
+    * Bump allocator for the object copies kept by an undo_state. Memory is handed out from a few growing
+    * blocks, and the copies are destroyed together with the blocks when the arena goes away.
+    *
+    * Copies are never freed individually: a copy the state stops referring to, e.g. the old value of an object
+    * removed again in the same session or the value of a child dropped by merge(), stays alive until the arena
+    * goes away. A session therefore holds memory proportional to the changes recorded in it rather than to the
+    * changes it still describes, which is bounded by the lifetime of a block.
+    */
+   class undo_arena
+   {
+      public:
+         undo_arena() = default;
+         undo_arena( const undo_arena& ) = delete;
+         undo_arena& operator=( const undo_arena& ) = delete;
+         undo_arena( undo_arena&& other );
+         undo_arena& operator=( undo_arena&& other );
+         ~undo_arena();
+
+         /** @return a copy of obj that lives as long as the arena */
+         object* copy( const object& obj );
+
+         /** Takes over the blocks and copies of other in constant time, so that they live as long as this arena */
+         void splice( undo_arena& other );
+
+         /** Number of blocks allocated so far */
+         size_t block_count()const;
+
+      private:
+         struct block;
+         struct copy_node;
+
+         void* allocate( size_t size, size_t alignment );
+         void  release();
+
+         block*     _blocks     = nullptr; ///< most recent first
+         block*     _last_block = nullptr; ///< oldest, so that splice() need not walk the list
+         copy_node* _copies     = nullptr; ///< most recent first
+         copy_node* _last_copy  = nullptr; ///< oldest
+         char*      _pos        = nullptr;
+         char*      _end        = nullptr;
+   };
+
+   /**
+    * Open-addressing hash table with linear probing, mapping object ids to small values. It replaces the
+    * node-based containers in undo_state: all entries live in a single array, which is not allocated until
+    * the first insertion. Iteration order is unspecified, erasing does not invalidate other keys.
+    */
+   template<typename Value>
+   class undo_id_map
+   {
+      public:
+         struct entry
+         {
+            object_id_type first;
+            Value          second = Value();
+         };
+
+      private:
+         struct slot
+         {
+            bool  used = false;
+            entry item;
+         };
+
+         template<typename Slot, typename Entry>
+         class basic_iterator
+         {
+            public:
+               basic_iterator( Slot* pos, Slot* end ) : _pos(pos), _end(end) { skip_unused(); }
+               Entry& operator*()const  { return _pos->item; }
+               Entry* operator->()const { return &_pos->item; }
+               basic_iterator& operator++() { ++_pos; skip_unused(); return *this; }
+               bool operator==( const basic_iterator& other )const { return _pos == other._pos; }
+               bool operator!=( const basic_iterator& other )const { return _pos != other._pos; }
+            private:
+               void skip_unused() { while( _pos != _end && !_pos->used ) ++_pos; }
+               Slot* _pos;
+               Slot* _end;
+         };
+
+      public:
+         typedef basic_iterator<slot, entry>             iterator;
+         typedef basic_iterator<const slot, const entry> const_iterator;
+
+         iterator       begin()       { return iterator( _slots.data(), _slots.data() + _slots.size() ); }
+         iterator       end()         { return iterator( _slots.data() + _slots.size(), _slots.data() + _slots.size() ); }
+         const_iterator begin()const  { return const_iterator( _slots.data(), _slots.data() + _slots.size() ); }
+         const_iterator end()const    { return const_iterator( _slots.data() + _slots.size(), _slots.data() + _slots.size() ); }
+
+         size_t size()const  { return _size; }
+         bool   empty()const { return _size == 0; }
+         size_t count( const object_id_type& id )const { return find_slot( id ) != npos ? 1 : 0; }
+
+         iterator find( const object_id_type& id )
+         {
+            const size_t pos = find_slot( id );
+            if( pos == npos ) return end();
+            return iterator( _slots.data() + pos, _slots.data() + _slots.size() );
+         }
+         const_iterator find( const object_id_type& id )const
+         {
+            const size_t pos = find_slot( id );
+            if( pos == npos ) return end();
+            return const_iterator( _slots.data() + pos, _slots.data() + _slots.size() );
+         }
+
+         /** Inserts value under id unless id is present already, @return whether it was inserted */
+         bool emplace( const object_id_type& id, const Value& value )
+         {
+            bool inserted;
+            slot& s = find_or_insert( id, inserted );
+            if( inserted )
+               s.item.second = value;
+            return inserted;
+         }
+
+         Value& operator[]( const object_id_type& id )
+         {
+            bool inserted;
+            return find_or_insert( id, inserted ).item.second;
+         }
+
+         size_t erase( const object_id_type& id )
+         {
+            size_t hole = find_slot( id );
+            if( hole == npos ) return 0;
+            // backward shift deletion keeps every probe sequence free of gaps
+            const size_t mask = _slots.size() - 1;
+            _slots[hole].used = false;
+            for( size_t next = ( hole + 1 ) & mask; _slots[next].used; next = ( next + 1 ) & mask )
+            {
+               const size_t home = home_slot( _slots[next].item.first );
+               const bool movable = ( next > hole ) ? ( home <= hole || home > next )
+                                                    : ( home <= hole && home > next );
+               if( movable )
+               {
+                  _slots[hole] = std::move( _slots[next] );
+                  _slots[next].used = false;
+                  hole = next;
+               }
+            }
+            --_size;
+            return 1;
+         }
+
+         void clear() { _slots.clear(); _size = 0; _shift = 64; }
+
+         /** Makes room for n entries, so that inserting up to n does not rehash */
+         void reserve( size_t n )
+         {
+            if( n * 2 <= _slots.size() )
+               return;
+            size_t capacity = _slots.empty() ? initial_capacity : _slots.size();
+            while( n * 2 > capacity )
+               capacity *= 2;
+            rehash( capacity );
+         }
+
+      private:
+         static constexpr size_t npos = size_t(-1);
+         static constexpr size_t initial_capacity = 16;
+
+         size_t home_slot( const object_id_type& id )const
+         {
+            // Fibonacci hashing, ids of one type are sequential and only differ in their low bits
+            return size_t( ( id.number * 0x9E3779B97F4A7C15ULL ) >> _shift );
+         }
+
+         size_t find_slot( const object_id_type& id )const
+         {
+            if( _size == 0 ) return npos;
+            const size_t mask = _slots.size() - 1;
+            for( size_t pos = home_slot( id ); _slots[pos].used; pos = ( pos + 1 ) & mask )
+               if( _slots[pos].item.first == id )
+                  return pos;
+            return npos;
+         }
+
+         slot& find_or_insert( const object_id_type& id, bool& inserted )
+         {
+            if( ( _size + 1 ) * 2 > _slots.size() )
+               grow();
+            const size_t mask = _slots.size() - 1;
+            size_t pos = home_slot( id );
+            for( ; _slots[pos].used; pos = ( pos + 1 ) & mask )
+               if( _slots[pos].item.first == id )
+               {
+                  inserted = false;
+                  return _slots[pos];
+               }
+            _slots[pos].used = true;
+            _slots[pos].item.first = id;
+            _slots[pos].item.second = Value();
+            ++_size;
+            inserted = true;
+            return _slots[pos];
+         }
+
+         void grow()
+         {
+            rehash( _slots.empty() ? initial_capacity : _slots.size() * 2 );
+         }
+
+         /** Moves all entries into a table of the given capacity, which must be a power of two */
+         void rehash( size_t capacity )
+         {
+            std::vector<slot> old_slots( capacity );
+            old_slots.swap( _slots );
+            unsigned bits = 0;
+            while( ( size_t(1) << bits ) < _slots.size() )
+               ++bits;
+            _shift = 64 - bits;
+            const size_t mask = _slots.size() - 1;
+            for( auto& old : old_slots )
+               if( old.used )
+               {
+                  size_t pos = home_slot( old.item.first );
+                  while( _slots[pos].used )
+                     pos = ( pos + 1 ) & mask;
+                  _slots[pos] = std::move( old );
+               }
+         }
+
+         std::vector<slot> _slots;
+         size_t            _size  = 0;
+         unsigned          _shift = 64;
+   };
+
+   /** Set of object ids on top of undo_id_map */
+   class undo_id_set
+   {
+      struct no_value {};
+      typedef undo_id_map<no_value> map_type;
+
+      public:
+         class const_iterator
+         {
+            public:
+               const_iterator( map_type::const_iterator itr ) : _itr(itr) {}
+               const object_id_type& operator*()const  { return _itr->first; }
+               const object_id_type* operator->()const { return &_itr->first; }
+               const_iterator& operator++() { ++_itr; return *this; }
+               bool operator==( const const_iterator& other )const { return _itr == other._itr; }
+               bool operator!=( const const_iterator& other )const { return _itr != other._itr; }
+            private:
+               map_type::const_iterator _itr;
+         };
+
+         const_iterator begin()const { return const_iterator( _ids.begin() ); }
+         const_iterator end()const   { return const_iterator( _ids.end() ); }
+         size_t size()const  { return _ids.size(); }
+         bool   empty()const { return _ids.empty(); }
+         size_t count( const object_id_type& id )const { return _ids.count( id ); }
+         bool   insert( const object_id_type& id ) { return _ids.emplace( id, no_value() ); }
+         size_t erase( const object_id_type& id )  { return _ids.erase( id ); }
+         void   reserve( size_t n )                 { _ids.reserve( n ); }
+
+      private:
+         map_type _ids;
+   };
+
+   /**
+    * The changes made in one undo session. Copies of old objects are placed in the session's arena
+    * and all of them are released at once when the session is gone.
+    */
    struct undo_state
    {
-      unordered_map<object_id_type, unique_ptr<object> > old_values;
-      unordered_map<object_id_type, object_id_type>      old_index_next_ids;
-      std::unordered_set<object_id_type>                 new_ids;
-      unordered_map<object_id_type, unique_ptr<object> > removed;
+      undo_id_map<object*>          old_values;
+      undo_id_map<object_id_type>   old_index_next_ids;
+      undo_id_set                   new_ids;
+      undo_id_map<object*>          removed;
+      undo_arena                    arena;
+   };
+
+   /**
+    * The state before the oldest session on the undo stack, expressed as the difference to the current state.
+    * Pointers refer to objects owned by the undo stack and are valid until it is modified.
+    */
+   struct undo_base_state
+   {
+      /** every object touched since, with its value at that point or nullptr if it did not exist yet */
+      std::map<object_id_type, const object*>   objects;
+      /** next ids of the indexes that changed since, keyed by object_id_type( space, type, 0 ) */
+      std::map<object_id_type, object_id_type>  next_ids;
    };
 
 
+   /**
+    * The changes made in one undo session, expressed as the values after the session, so that they can be made
+    * again on top of the state the session started from without repeating the work that led to them.
+    */
+   struct redo_state
+   {
+      struct next_id_change
+      {
+         object_id_type index; ///< object_id_type( space, type, 0 )
+         object_id_type before;
+         object_id_type after;
+      };
+
+      /** objects modified in the session, then objects created in it in the order of their ids */
+      std::vector<std::shared_ptr<const object>>  objects;
+      std::vector<object_id_type>                 removed;
+      std::vector<next_id_change>                 next_ids;
+   };
+
    /**
     * @class undo_database
     * @brief tracks changes to the state and allows changes to be undone
@@ -123,16 +421,66 @@ namespace graphene { namespace db {
 
          const undo_state& head()const;
 
+         /**
+          * Collects the state as it was before the oldest session on the stack. It is only meaningful
+          * if undo tracking was enabled for all changes made since then.
+          */
+         undo_base_state get_base_state()const;
+         /**
+          * Like get_base_state(), restricted to the objects and the next id of one index, while the base is held.
+          * The stack is walked by the first call for an index only, the result is kept up to date by recording
+          * the objects first touched since. Objects are copies owned by the cache, the returned reference is valid
+          * until the base is released or changes.
+          */
+         const undo_base_state& get_held_base_state( uint8_t space, uint8_t type );
+
+         /**
+          * While the base is held, start_undo_session() keeps up to max_held_sessions() sessions beyond max_size()
+          * on the stack, so that get_base_state() goes on describing the same state. Past that the oldest sessions
+          * are dropped as usual and base_revision() changes. Calls nest.
+          */
+         void hold_base() { ++_base_holds; }
+         void release_base();
+         void set_max_held_sessions( size_t new_max ) { _max_held_sessions = new_max; }
+         size_t max_held_sessions()const { return _max_held_sessions; }
+         /** @return a counter that changes whenever the state before the oldest session changes */
+         uint64_t base_revision()const { return _base_revision; }
+
+         /** @return the changes of the newest session on the stack, see redo() */
+         redo_state get_redo_state()const;
+
+         /**
+          * Makes the given changes again in the newest session, which must be active. The state must be the one
+          * the changes were recorded on, as a redo_state holds values rather than operations on them.
+          */
+         void redo( const redo_state& changes );
+
       private:
          void undo();
          void merge();
          void commit();
 
+         /** The base state of an index as collected by get_held_base_state(), with the copies it refers to */
+         struct held_base_state
+         {
+            undo_base_state                       state;
+            std::vector<std::unique_ptr<object>>  copies;
+
+            void add_old_value( const object& obj );
+         };
+         held_base_state* find_held_base( const object_id_type& id );
+
          uint32_t                _active_sessions = 0;
          bool                    _disabled = true;
          std::deque<undo_state>  _stack;
          object_database&        _db;
          size_t                  _max_size = 256;
+         uint32_t                _base_holds = 0;
+         uint64_t                _base_revision = 0;
+         size_t                  _max_held_sessions = 1000;
+         /** Keyed by object_id_type( space, type, 0 ), valid for _held_base_revision only */
+         std::map<object_id_type, held_base_state>  _held_bases;
+         uint64_t                _held_base_revision = 0;
    };
 
 } } // graphene::db
@@ -26,6 +26,11 @@
 #include <fc/io/raw.hpp>
 #include <fc/container/flat.hpp>
 #include <fc/thread/parallel.hpp>
+#include <fc/thread/thread.hpp>
+
+#include <deque>
+#include <sstream>
+#include <thread>
 
 namespace graphene { namespace db {
 
@@ -36,7 +41,10 @@ object_database::object_database()
    _undo_db.enable();
 }
 
-object_database::~object_database(){}
+object_database::~object_database()
+{
+   wait_for_checkpoint();
+}
 
 void object_database::close()
 {
@@ -68,36 +76,208 @@ index& object_database::get_mutable_index(uint8_t space_id, uint8_t type_id)
    return *idx;
 }
 
+void object_database::begin_save()
+{
+   // leftovers of an interrupted flush may be hard links into the current copy, never write through them
+   fc::remove_all( _data_dir / "object_database.tmp" );
+   fc::create_directories( _data_dir / "object_database.tmp" / "lock" );
+   for( uint32_t space = 0; space < _index.size(); ++space )
+      fc::create_directories( _data_dir / "object_database.tmp" / fc::to_string(space) );
+}
+
+bool object_database::link_unchanged( uint8_t space, uint8_t type, uint64_t generation )const
+{
+   const auto flushed = _flushed_generations.find( std::make_pair( space, type ) );
+   if( flushed == _flushed_generations.end() || flushed->second != generation )
+      return false;
+   const fc::path file = fc::path( fc::to_string(space) ) / fc::to_string(type);
+   if( !fc::exists( _data_dir / "object_database" / file ) )
+      return false;
+   try {
+      fc::create_hard_link( _data_dir / "object_database" / file, _data_dir / "object_database.tmp" / file );
+      return true;
+   } catch( const fc::exception& e ) {
+      wlog( "Failed to link ${f}, saving it instead: ${e}", ("f",file)("e",e.to_detail_string()) );
+   }
+   return false;
+}
+
+void object_database::end_save()
+{
+   fc::remove_all( _data_dir / "object_database.tmp" / "lock" );
+   if( fc::exists( _data_dir / "object_database" ) )
+      fc::rename( _data_dir / "object_database", _data_dir / "object_database.old" );
+   fc::rename( _data_dir / "object_database.tmp", _data_dir / "object_database" );
+   fc::remove_all( _data_dir / "object_database.old" );
+}
+
 void object_database::flush()
 {
 //   ilog("Save object_database in ${d}", ("d", _data_dir));
-   fc::create_directories( _data_dir / "object_database.tmp" / "lock" );
+   wait_for_checkpoint();
+   begin_save();
    std::vector<fc::future<void>> tasks;
    tasks.reserve(200);
+   std::map< std::pair<uint8_t,uint8_t>, uint64_t > generations;
+   uint32_t linked = 0;
    for( uint32_t space = 0; space < _index.size(); ++space )
    {
-      fc::create_directories( _data_dir / "object_database.tmp" / fc::to_string(space) );
       const auto types = _index[space].size();
       for( uint32_t type = 0; type  <  types; ++type )
          if( _index[space][type] )
+         {
+            const uint64_t generation = _index[space][type]->get_generation();
+            generations[ std::make_pair( uint8_t(space), uint8_t(type) ) ] = generation;
+            if( link_unchanged( space, type, generation ) )
+            {
+               ++linked;
+               continue;
+            }
             tasks.push_back( fc::do_parallel( [this,space,type] () {
                _index[space][type]->save( _data_dir / "object_database.tmp" / fc::to_string(space)/fc::to_string(type) );
             } ) );
+         }
    }
    for( auto& task : tasks )
       task.wait();
-   fc::remove_all( _data_dir / "object_database.tmp" / "lock" );
-   if( fc::exists( _data_dir / "object_database" ) )
-      fc::rename( _data_dir / "object_database", _data_dir / "object_database.old" );
-   fc::rename( _data_dir / "object_database.tmp", _data_dir / "object_database" );
-   fc::remove_all( _data_dir / "object_database.old" );
+   end_save();
+   _flushed_generations = std::move( generations );
+   dlog( "Flushed object database: ${s} indexes saved, ${l} unchanged", ("s",tasks.size())("l",linked) );
+}
+
+bool object_database::start_checkpoint()
+{
+   if( _checkpoint_done.valid() && !_checkpoint_done.ready() )
+      return false;
+   wait_for_checkpoint();
+   if( !_checkpoint_thread )
+      _checkpoint_thread = std::make_unique<fc::thread>( "checkpoint" );
+
+   // sessions are not dropped from the undo stack until every index is serialized, so that its base stays put
+   _undo_db.hold_base();
+   const uint64_t base_revision = _undo_db.base_revision();
+   _checkpoint_done = fc::async( [this,base_revision] () {
+      std::shared_ptr< std::vector<checkpoint_file> > files;
+      try {
+         files = serialize_checkpoint( base_revision );
+      } catch( ... ) {
+         _undo_db.release_base();
+         throw;
+      }
+      _undo_db.release_base();
+      _checkpoint_thread->async( [this,files] () {
+         write_checkpoint( *files );
+      }, "object_database checkpoint" ).wait();
+   }, "object_database checkpoint serialization" );
+   return true;
+}
+
+std::shared_ptr< std::vector<object_database::checkpoint_file> >
+object_database::serialize_checkpoint( uint64_t base_revision )
+{
+   auto files = std::make_shared< std::vector<checkpoint_file> >();
+   for( uint32_t space = 0; space < _index.size(); ++space )
+      for( uint32_t type = 0; type < _index[space].size(); ++type )
+      {
+         if( !_index[space][type] )
+            continue;
+         const index& idx = *_index[space][type];
+         checkpoint_file file{ uint8_t(space), uint8_t(type), 0, false, nullptr };
+         object_id_type next( space, type, 0 );
+         bool more = true;
+         while( more )
+         {
+            // blocks may have been applied since the last chunk, the held base state keeps track of them
+            FC_ASSERT( _undo_db.enabled() && _undo_db.base_revision() == base_revision,
+                       "The undo history was cut short before the checkpoint was serialized" );
+            const undo_base_state& base = _undo_db.get_held_base_state( file.space, file.type );
+            if( !file.data )
+            {
+               // an index without changes on the undo stack has the same content as in the base state
+               file.generation = idx.get_generation();
+               file.as_of_base = !base.objects.empty() || !base.next_ids.empty();
+               const auto flushed = _flushed_generations.find( std::make_pair( file.space, file.type ) );
+               if( !file.as_of_base && flushed != _flushed_generations.end() && flushed->second == file.generation
+                   && fc::exists( _data_dir / "object_database" / fc::to_string(space) / fc::to_string(type) ) )
+                  break;
+               file.data = std::make_unique<std::stringstream>( std::ios::in | std::ios::out | std::ios::binary );
+            }
+            more = idx.save_chunk( *file.data, base, next );
+            fc::yield();
+         }
+         files->push_back( std::move( file ) );
+      }
+   return files;
+}
+
+void object_database::write_checkpoint( std::vector<checkpoint_file>& files )
+{
+   begin_save();
+   std::map< std::pair<uint8_t,uint8_t>, uint64_t > generations;
+   for( auto& file : files )
+   {
+      const fc::path name = _data_dir / "object_database.tmp" / fc::to_string(file.space) / fc::to_string(file.type);
+      if( !file.data && !link_unchanged( file.space, file.type, file.generation ) )
+         FC_THROW( "Unable to reuse ${f} for the checkpoint", ("f",name) );
+      if( file.data )
+      {
+         std::ofstream out( name.generic_string(), std::ofstream::binary | std::ofstream::out | std::ofstream::trunc );
+         out << file.data->rdbuf();
+         FC_ASSERT( out, "Failed to write ${f}", ("f",name) );
+      }
+      // files written as of the base state must be rewritten by the next flush
+      if( !file.as_of_base )
+         generations[ std::make_pair( file.space, file.type ) ] = file.generation;
+   }
+   end_save();
+   _flushed_generations = std::move( generations );
+}
+
+void object_database::wait_for_checkpoint()
+{
+   if( !_checkpoint_done.valid() )
+      return;
+   try {
+      _checkpoint_done.wait();
+   } catch( const fc::exception& e ) {
+      elog( "Failed to write object database checkpoint: ${e}", ("e",e.to_detail_string()) );
+   }
+   _checkpoint_done = fc::future<void>();
+}
+
+void object_database::enable_state_hash()
+{
+   if( _state_hash_enabled )
+      return;
+   _state_hash_enabled = true;
+   std::vector<fc::future<void>> tasks;
+   for( auto& space : _index )
+      for( auto& idx : space )
+         if( idx )
+            tasks.push_back( fc::do_parallel( [&idx] () { idx->set_state_hash_enabled( true ); } ) );
+   for( auto& task : tasks )
+      task.wait();
+}
+
+fc::sha256 object_database::get_state_hash()const
+{
+   if( !_state_hash_enabled )
+      return fc::sha256();
+   state_hash_accumulator sum;
+   for( const auto& space : _index )
+      for( const auto& idx : space )
+         if( idx )
+            sum.add( idx->get_state_hash() );
+   return sum.digest();
 }
 
 void object_database::wipe(const fc::path& data_dir)
 {
    close();
+   wait_for_checkpoint();
    ilog("Wiping object database...");
    fc::remove_all(data_dir / "object_database");
+   _flushed_generations.clear();
    ilog("Done wiping object database.");
 }
 
@@ -109,17 +289,69 @@ void object_database::open(const fc::path& data_dir)
        wlog("Ignoring locked object_database");
        return;
    }
-   std::vector<fc::future<void>> tasks;
-   tasks.reserve(200);
    ilog("Opening object database from ${d} ...", ("d", data_dir));
+
+   // Loading happens in three phases so that large indexes are unpacked by several threads:
+   // map every index file, unpack chunks in parallel, and insert them in file order as they become
+   // ready. Only a bounded number of chunks is unpacked ahead of the insertion, so the temporary copies
+   // never add more than a few MiB per thread to the memory used by the loaded state.
+   std::vector<index*> indexes;
    for( uint32_t space = 0; space < _index.size(); ++space )
       for( uint32_t type = 0; type  < _index[space].size(); ++type )
          if( _index[space][type] )
-            tasks.push_back( fc::do_parallel( [this,space,type] () {
-               _index[space][type]->open( _data_dir / "object_database" / fc::to_string(space)/fc::to_string(type) );
-            } ) );
-   for( auto& task : tasks )
-      task.wait();
+            indexes.push_back( _index[space][type].get() );
+
+   std::vector<fc::future<size_t>> counts;
+   counts.reserve( indexes.size() );
+   for( index* idx : indexes )
+      counts.push_back( fc::do_parallel( [this,idx] () {
+         return idx->begin_load( _data_dir / "object_database" / fc::to_string(idx->object_space_id())
+                                           / fc::to_string(idx->object_type_id()) );
+      } ) );
+   std::vector<size_t> chunks;
+   chunks.reserve( indexes.size() );
+   for( auto& count : counts )
+      chunks.push_back( count.wait() );
+
+   struct unpacking_chunk
+   {
+      index*           idx;
+      size_t           chunk;
+      bool             last;
+      fc::future<void> unpacked;
+   };
+   const size_t max_chunks_in_flight = 2 * std::max( 1u, std::thread::hardware_concurrency() );
+   std::deque<unpacking_chunk> in_flight;
+   const auto insert_oldest = [&in_flight] () {
+      unpacking_chunk& oldest = in_flight.front();
+      oldest.unpacked.wait();
+      oldest.idx->insert_chunk( oldest.chunk );
+      if( oldest.last )
+         oldest.idx->end_load();
+      in_flight.pop_front();
+   };
+   for( size_t i = 0; i < indexes.size(); ++i )
+   {
+      if( chunks[i] == 0 )
+      {
+         indexes[i]->end_load();
+         continue;
+      }
+      for( size_t chunk = 0; chunk < chunks[i]; ++chunk )
+      {
+         if( in_flight.size() >= max_chunks_in_flight )
+            insert_oldest();
+         in_flight.push_back( { indexes[i], chunk, chunk + 1 == chunks[i],
+                                fc::do_parallel( [idx=indexes[i],chunk] () { idx->load_chunk( chunk ); } ) } );
+      }
+   }
+   while( !in_flight.empty() )
+      insert_oldest();
+
+   // the files just loaded can be reused by the next flush as long as their index does not change
+   _flushed_generations.clear();
+   for( index* idx : indexes )
+      _flushed_generations[ std::make_pair( idx->object_space_id(), idx->object_type_id() ) ] = idx->get_generation();
    ilog( "Done opening object database." );
 
 } FC_CAPTURE_AND_RETHROW( (data_dir) ) }
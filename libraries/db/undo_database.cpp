@@ -26,8 +26,171 @@
 #include <graphene/db/undo_database.hpp>
 #include <fc/reflect/variant.hpp>
 
+#include <algorithm>
+
 namespace graphene { namespace db {
 
+struct undo_arena::block
+{
+   block* next;
+   size_t size;
+};
+
+struct undo_arena::copy_node
+{
+   copy_node* next;
+   object*    obj;
+};
+
+namespace {
+   const size_t min_arena_block_size = 4 * 1024;
+   const size_t max_arena_block_size = 256 * 1024;
+
+   size_t change_count( const undo_state& state )
+   {
+      return state.old_values.size() + state.new_ids.size() + state.removed.size() + state.old_index_next_ids.size();
+   }
+
+   /// Composes two consecutive states into the later one, only walking the entries of the earlier one
+   void merge_into_later( undo_state& earlier, undo_state& later )
+   {
+      for( const auto& id : earlier.new_ids )
+      {
+         // new+upd -> new, new+del -> nop, new+nop -> new
+         if( later.old_values.erase( id ) > 0 )
+            later.new_ids.insert( id );
+         else if( later.removed.erase( id ) == 0 )
+            later.new_ids.insert( id );
+      }
+      for( const auto& item : earlier.old_values )
+      {
+         // upd(was=X)+del(was=Y) -> del(was=X), upd(was=X)+upd(was=Y) -> upd(was=X), upd(was=X)+nop -> upd(was=X)
+         auto itr = later.removed.find( item.first );
+         if( itr != later.removed.end() )
+            itr->second = item.second;
+         else
+            later.old_values[item.first] = item.second;
+      }
+      // del(was=X)+nop -> del(was=X), everything else would violate causality
+      for( const auto& item : earlier.removed )
+         later.removed[item.first] = item.second;
+      // upd(was=X)+upd(was=Y) -> upd(was=X)
+      for( const auto& item : earlier.old_index_next_ids )
+         later.old_index_next_ids[item.first] = item.second;
+      later.arena.splice( earlier.arena );
+   }
+}
+
+undo_arena::undo_arena( undo_arena&& other )
+:_blocks(other._blocks),_last_block(other._last_block),_copies(other._copies),_last_copy(other._last_copy),
+ _pos(other._pos),_end(other._end)
+{
+   other._blocks = other._last_block = nullptr;
+   other._copies = other._last_copy = nullptr;
+   other._pos = other._end = nullptr;
+}
+
+undo_arena& undo_arena::operator=( undo_arena&& other )
+{
+   if( this == &other ) return *this;
+   release();
+   std::swap( _blocks, other._blocks );
+   std::swap( _last_block, other._last_block );
+   std::swap( _copies, other._copies );
+   std::swap( _last_copy, other._last_copy );
+   std::swap( _pos, other._pos );
+   std::swap( _end, other._end );
+   return *this;
+}
+
+undo_arena::~undo_arena()
+{
+   release();
+}
+
+void undo_arena::release()
+{
+   for( copy_node* node = _copies; node != nullptr; node = node->next )
+      node->obj->~object();
+   _copies = _last_copy = nullptr;
+   while( _blocks != nullptr )
+   {
+      block* next = _blocks->next;
+      ::operator delete( _blocks );
+      _blocks = next;
+   }
+   _last_block = nullptr;
+   _pos = _end = nullptr;
+}
+
+void* undo_arena::allocate( size_t size, size_t alignment )
+{
+   uintptr_t pos = ( reinterpret_cast<uintptr_t>(_pos) + alignment - 1 ) & ~uintptr_t( alignment - 1 );
+   if( _pos == nullptr || pos + size > reinterpret_cast<uintptr_t>(_end) )
+   {
+      // blocks grow with the session, so that large sessions need few of them
+      size_t block_size = ( _blocks == nullptr ? min_arena_block_size
+                                               : std::min( _blocks->size * 2, max_arena_block_size ) );
+      block_size = std::max( block_size, sizeof(block) + size + alignment );
+      block* b = static_cast<block*>( ::operator new( block_size ) );
+      b->next = _blocks;
+      b->size = block_size;
+      if( _blocks == nullptr )
+         _last_block = b;
+      _blocks = b;
+      _pos = reinterpret_cast<char*>( b ) + sizeof(block);
+      _end = reinterpret_cast<char*>( b ) + block_size;
+      pos = ( reinterpret_cast<uintptr_t>(_pos) + alignment - 1 ) & ~uintptr_t( alignment - 1 );
+   }
+   _pos = reinterpret_cast<char*>( pos + size );
+   return reinterpret_cast<void*>( pos );
+}
+
+object* undo_arena::copy( const object& obj )
+{
+   copy_node* node = static_cast<copy_node*>( allocate( sizeof(copy_node), alignof(copy_node) ) );
+   void* memory = allocate( obj.object_size(), obj.object_alignment() );
+   node->obj = obj.clone_at( memory );
+   node->next = _copies;
+   if( _copies == nullptr )
+      _last_copy = node;
+   _copies = node;
+   return node->obj;
+}
+
+void undo_arena::splice( undo_arena& other )
+{
+   if( other._blocks == nullptr ) return;
+   if( _blocks == nullptr )
+   {
+      *this = std::move( other );
+      return;
+   }
+   // other's blocks go right behind our current one, we keep allocating from it
+   other._last_block->next = _blocks->next;
+   if( _blocks->next == nullptr )
+      _last_block = other._last_block;
+   _blocks->next = other._blocks;
+   if( other._copies != nullptr )
+   {
+      other._last_copy->next = _copies;
+      if( _copies == nullptr )
+         _last_copy = other._last_copy;
+      _copies = other._copies;
+   }
+   other._blocks = other._last_block = nullptr;
+   other._copies = other._last_copy = nullptr;
+   other._pos = other._end = nullptr;
+}
+
+size_t undo_arena::block_count()const
+{
+   size_t count = 0;
+   for( const block* b = _blocks; b != nullptr; b = b->next )
+      ++count;
+   return count;
+}
+
 void undo_database::enable()  { _disabled = false; }
 void undo_database::disable() { _disabled = true; }
 
@@ -51,8 +214,11 @@ undo_database::session undo_database::start_undo_session( bool force_enable )
    if( force_enable ) 
       _disabled = false;
 
-   while( size() > max_size() )
+   while( size() > max_size() + ( _base_holds > 0 ? max_held_sessions() : 0 ) )
+   {
       _stack.pop_front();
+      ++_base_revision;
+   }
 
    _stack.emplace_back();
    ++_active_sessions;
@@ -70,6 +236,11 @@ void undo_database::on_create( const object& obj )
    if( itr == state.old_index_next_ids.end() )
       state.old_index_next_ids[index_id] = obj.id;
    state.new_ids.insert(obj.id);
+   if( held_base_state* held = find_held_base( obj.id ) )
+   {
+      held->state.objects.emplace( obj.id, nullptr );
+      held->state.next_ids.emplace( index_id, obj.id );
+   }
 }
 void undo_database::on_modify( const object& obj )
 {
@@ -77,12 +248,14 @@ void undo_database::on_modify( const object& obj )
 
    if( _stack.empty() )
       _stack.emplace_back();
+   if( held_base_state* held = find_held_base( obj.id ) )
+      held->add_old_value( obj );
    auto& state = _stack.back();
-   if( state.new_ids.find(obj.id) != state.new_ids.end() )
+   if( state.new_ids.count(obj.id) > 0 )
       return;
    auto itr =  state.old_values.find(obj.id);
    if( itr != state.old_values.end() ) return;
-   state.old_values[obj.id] = obj.clone();
+   state.old_values[obj.id] = state.arena.copy( obj );
 }
 void undo_database::on_remove( const object& obj )
 {
@@ -90,20 +263,23 @@ void undo_database::on_remove( const object& obj )
 
    if( _stack.empty() )
       _stack.emplace_back();
+   if( held_base_state* held = find_held_base( obj.id ) )
+      held->add_old_value( obj );
    undo_state& state = _stack.back();
    if( state.new_ids.count(obj.id) > 0 )
    {
       state.new_ids.erase(obj.id);
       return;
    }
-   if( state.old_values.count(obj.id) > 0 )
+   auto itr = state.old_values.find(obj.id);
+   if( itr != state.old_values.end() )
    {
-      state.removed[obj.id] = std::move(state.old_values[obj.id]);
+      state.removed[obj.id] = itr->second;
       state.old_values.erase(obj.id);
       return;
    }
    if( state.removed.count(obj.id) > 0 ) return;
-   state.removed[obj.id] = obj.clone();
+   state.removed[obj.id] = state.arena.copy( obj );
 }
 
 void undo_database::undo()
@@ -141,7 +317,9 @@ void undo_database::merge()
    FC_ASSERT( _active_sessions > 0 );
    if( _active_sessions == 1 && _stack.size() == 1 )
    {
+      // the changes of the only session are kept without a way back, they become part of the base
       _stack.pop_back();
+      ++_base_revision;
       --_active_sessions;
       return;
    }
@@ -149,6 +327,20 @@ void undo_database::merge()
    auto& state = _stack.back();
    auto& prev_state = _stack[_stack.size()-2];
 
+   if( change_count( prev_state ) < change_count( state ) )
+   {
+      // The composition does not depend on which side is walked. Walking the smaller one matters when a
+      // fresh session absorbs a large one, and makes this a plain move if the previous state is empty.
+      merge_into_later( prev_state, state );
+      prev_state = std::move( state );
+      _stack.pop_back();
+      --_active_sessions;
+      return;
+   }
+   prev_state.old_values.reserve( prev_state.old_values.size() + state.old_values.size() );
+   prev_state.new_ids.reserve( prev_state.new_ids.size() + state.new_ids.size() );
+   prev_state.removed.reserve( prev_state.removed.size() + state.removed.size() );
+
    // An object's relationship to a state can be:
    // in new_ids            : new
    // in old_values (was=X) : upd(was=X)
@@ -194,7 +386,7 @@ void undo_database::merge()
    // *+upd
    for( auto& obj : state.old_values )
    {
-      if( prev_state.new_ids.find(obj.second->id) != prev_state.new_ids.end() )
+      if( prev_state.new_ids.count(obj.second->id) > 0 )
       {
          // new+upd -> new, type A
          continue;
@@ -207,7 +399,7 @@ void undo_database::merge()
       // del+upd -> N/A
       assert( prev_state.removed.find(obj.second->id) == prev_state.removed.end() );
       // nop+upd(was=Y) -> upd(was=Y), type B
-      prev_state.old_values[obj.second->id] = std::move(obj.second);
+      prev_state.old_values[obj.second->id] = obj.second;
    }
 
    // *+new, but we assume the N/A cases don't happen, leaving type B nop+new -> new
@@ -234,7 +426,7 @@ void undo_database::merge()
    // *+del
    for( auto& obj : state.removed )
    {
-      if( prev_state.new_ids.find(obj.second->id) != prev_state.new_ids.end() )
+      if( prev_state.new_ids.count(obj.second->id) > 0 )
       {
          // new + del -> nop (type C)
          prev_state.new_ids.erase(obj.second->id);
@@ -244,15 +436,17 @@ void undo_database::merge()
       if( it != prev_state.old_values.end() )
       {
          // upd(was=X) + del(was=Y) -> del(was=X)
-         prev_state.removed[obj.second->id] = std::move(it->second);
+         prev_state.removed[obj.second->id] = it->second;
          prev_state.old_values.erase(obj.second->id);
          continue;
       }
       // del + del -> N/A
       assert( prev_state.removed.find( obj.second->id ) == prev_state.removed.end() );
       // nop + del(was=Y) -> del(was=Y)
-      prev_state.removed[obj.second->id] = std::move(obj.second);
+      prev_state.removed[obj.second->id] = obj.second;
    }
+   // the copies now referenced by prev_state stay where they are
+   prev_state.arena.splice( state.arena );
    _stack.pop_back();
    --_active_sessions;
 }
@@ -305,4 +499,134 @@ const undo_state& undo_database::head()const
    return _stack.back();
 }
 
+undo_base_state undo_database::get_base_state()const
+{
+   undo_base_state result;
+   // the oldest state mentioning an object holds its value from before the stack, emplace() keeps that one
+   for( const auto& state : _stack )
+   {
+      for( const auto& id : state.new_ids )
+         result.objects.emplace( id, nullptr );
+      for( const auto& item : state.old_values )
+         result.objects.emplace( item.first, item.second );
+      for( const auto& item : state.removed )
+         result.objects.emplace( item.first, item.second );
+      for( const auto& item : state.old_index_next_ids )
+         result.next_ids.emplace( item.first, item.second );
+   }
+   return result;
+}
+
+void undo_database::held_base_state::add_old_value( const object& obj )
+{
+   if( state.objects.find( obj.id ) != state.objects.end() )
+      return;
+   copies.push_back( obj.clone() );
+   state.objects.emplace( obj.id, copies.back().get() );
+}
+
+undo_database::held_base_state* undo_database::find_held_base( const object_id_type& id )
+{
+   if( _held_bases.empty() )
+      return nullptr;
+   auto itr = _held_bases.find( object_id_type( id.space(), id.type(), 0 ) );
+   return itr == _held_bases.end() ? nullptr : &itr->second;
+}
+
+const undo_base_state& undo_database::get_held_base_state( uint8_t space, uint8_t type )
+{
+   FC_ASSERT( _base_holds > 0, "The base state is not held" );
+   if( _held_base_revision != _base_revision )
+   {
+      _held_bases.clear();
+      _held_base_revision = _base_revision;
+   }
+   const object_id_type index_id( space, type, 0 );
+   auto itr = _held_bases.find( index_id );
+   if( itr != _held_bases.end() )
+      return itr->second.state;
+
+   // the values are copied, sessions holding them may be undone while the cache is in use
+   held_base_state& held = _held_bases[index_id];
+   const auto in_index = [space,type]( const object_id_type& id ) {
+      return id.space() == space && id.type() == type;
+   };
+   for( const auto& state : _stack )
+   {
+      for( const auto& id : state.new_ids )
+         if( in_index( id ) )
+            held.state.objects.emplace( id, nullptr );
+      for( const auto& item : state.old_values )
+         if( in_index( item.first ) )
+            held.add_old_value( *item.second );
+      for( const auto& item : state.removed )
+         if( in_index( item.first ) )
+            held.add_old_value( *item.second );
+      for( const auto& item : state.old_index_next_ids )
+         if( in_index( item.first ) )
+            held.state.next_ids.emplace( item.first, item.second );
+   }
+   return held.state;
+}
+
+void undo_database::release_base()
+{
+   FC_ASSERT( _base_holds > 0 );
+   if( --_base_holds == 0 )
+      _held_bases.clear();
+}
+
+redo_state undo_database::get_redo_state()const
+{
+   const undo_state& state = head();
+   redo_state result;
+   result.objects.reserve( state.old_values.size() + state.new_ids.size() );
+   for( const auto& item : state.old_values )
+      result.objects.emplace_back( _db.get_object( item.first ).clone() );
+   // new objects are inserted in the order they were created, which keeps direct indexes free of large holes
+   std::vector<object_id_type> created( state.new_ids.begin(), state.new_ids.end() );
+   std::sort( created.begin(), created.end() );
+   for( const auto& id : created )
+      result.objects.emplace_back( _db.get_object( id ).clone() );
+   result.removed.reserve( state.removed.size() );
+   for( const auto& item : state.removed )
+      result.removed.push_back( item.first );
+   result.next_ids.reserve( state.old_index_next_ids.size() );
+   for( const auto& item : state.old_index_next_ids )
+      result.next_ids.push_back( { item.first, item.second,
+                                   _db.get_index( item.first.space(), item.first.type() ).get_next_id() } );
+   return result;
+}
+
+void undo_database::redo( const redo_state& changes )
+{ try {
+   FC_ASSERT( !_disabled );
+   FC_ASSERT( _active_sessions > 0 );
+
+   // removed objects may have held unique keys that modified or created ones take over
+   for( const auto& id : changes.removed )
+      _db.remove( _db.get_object( id ) );
+
+   // the next ids are set before creating objects, the session keeps the old ones like on_create() does
+   auto& state = _stack.back();
+   for( const auto& change : changes.next_ids )
+   {
+      if( held_base_state* held = find_held_base( change.index ) )
+         held->state.next_ids.emplace( change.index, change.before );
+      if( state.old_index_next_ids.find( change.index ) == state.old_index_next_ids.end() )
+         state.old_index_next_ids[change.index] = change.before;
+      _db.get_mutable_index( change.index.space(), change.index.type() ).set_next_id( change.after );
+   }
+
+   for( const auto& value : changes.objects )
+   {
+      std::unique_ptr<object> copy = value->clone();
+      const object* current = _db.find_object( value->id );
+      if( current )
+         _db.modify( *current, [&copy]( object& obj ){ obj.move_from( *copy ); } );
+      else
+         _db.insert( std::move( *copy ) );
+   }
+} FC_CAPTURE_AND_RETHROW() }
+
 } } // graphene::db
@@ -25,6 +25,8 @@
 
 #include <fc/io/raw.hpp>
 
+#include <cstring>
+
 namespace graphene { namespace net {
 
   const core_message_type_enum trx_message::type                             = core_message_type_enum::trx_message_type;
@@ -46,11 +48,44 @@ namespace graphene { namespace net {
   const core_message_type_enum check_firewall_reply_message::type            = core_message_type_enum::check_firewall_reply_message_type;
   const core_message_type_enum get_current_connections_request_message::type = core_message_type_enum::get_current_connections_request_message_type;
   const core_message_type_enum get_current_connections_reply_message::type   = core_message_type_enum::get_current_connections_reply_message_type;
+  const core_message_type_enum compact_block_message::type                   = core_message_type_enum::compact_block_message_type;
+  const core_message_type_enum fetch_compact_block_transactions_message::type = core_message_type_enum::fetch_compact_block_transactions_message_type;
+  const core_message_type_enum compact_block_transactions_message::type      = core_message_type_enum::compact_block_transactions_message_type;
+  const core_message_type_enum fetch_block_range_message::type               = core_message_type_enum::fetch_block_range_message_type;
+  const core_message_type_enum block_range_message::type                     = core_message_type_enum::block_range_message_type;
+
+  short_transaction_id get_short_transaction_id( const transaction_id_type& id )
+  {
+     short_transaction_id result;
+     static_assert( sizeof(result) <= sizeof(id._hash), "transaction ids are too short" );
+     std::memcpy( &result, id._hash, sizeof(result) );
+     return result;
+  }
+
+  compact_block_message::compact_block_message( const block_message& full )
+  : header( full.block ), block_id( full.block_id )
+  {
+     transactions.reserve( full.block.transactions.size() );
+     for( const auto& trx : full.block.transactions )
+        transactions.push_back( { get_short_transaction_id( trx.id() ), trx.operation_results } );
+  }
 
 } } // graphene::net
 
 FC_REFLECT_DERIVED_NO_TYPENAME( graphene::net::trx_message, BOOST_PP_SEQ_NIL, (trx) )
 FC_REFLECT_DERIVED_NO_TYPENAME( graphene::net::block_message, BOOST_PP_SEQ_NIL, (block)(block_id) )
+FC_REFLECT_DERIVED_NO_TYPENAME( graphene::net::compact_block_transaction, BOOST_PP_SEQ_NIL,
+                                (short_id)(operation_results) )
+FC_REFLECT_DERIVED_NO_TYPENAME( graphene::net::compact_block_message, BOOST_PP_SEQ_NIL,
+                                (header)(block_id)(transactions) )
+FC_REFLECT_DERIVED_NO_TYPENAME( graphene::net::fetch_compact_block_transactions_message, BOOST_PP_SEQ_NIL,
+                                (block_id)(transaction_indexes) )
+FC_REFLECT_DERIVED_NO_TYPENAME( graphene::net::compact_block_transactions_message, BOOST_PP_SEQ_NIL,
+                                (block_id)(transactions) )
+FC_REFLECT_DERIVED_NO_TYPENAME( graphene::net::fetch_block_range_message, BOOST_PP_SEQ_NIL,
+                                (first_block_num)(block_count) )
+FC_REFLECT_DERIVED_NO_TYPENAME( graphene::net::block_range_message, BOOST_PP_SEQ_NIL,
+                                (first_block_num)(packed_blocks)(blocks_unavailable) )
 
 FC_REFLECT_DERIVED_NO_TYPENAME( graphene::net::item_id, BOOST_PP_SEQ_NIL,
                                (item_type)
@@ -131,6 +166,12 @@ FC_REFLECT_DERIVED_NO_TYPENAME(graphene::net::get_current_connections_reply_mess
 
 GRAPHENE_IMPLEMENT_EXTERNAL_SERIALIZATION( graphene::net::trx_message )
 GRAPHENE_IMPLEMENT_EXTERNAL_SERIALIZATION( graphene::net::block_message )
+GRAPHENE_IMPLEMENT_EXTERNAL_SERIALIZATION( graphene::net::compact_block_transaction )
+GRAPHENE_IMPLEMENT_EXTERNAL_SERIALIZATION( graphene::net::compact_block_message )
+GRAPHENE_IMPLEMENT_EXTERNAL_SERIALIZATION( graphene::net::fetch_compact_block_transactions_message )
+GRAPHENE_IMPLEMENT_EXTERNAL_SERIALIZATION( graphene::net::compact_block_transactions_message )
+GRAPHENE_IMPLEMENT_EXTERNAL_SERIALIZATION( graphene::net::fetch_block_range_message )
+GRAPHENE_IMPLEMENT_EXTERNAL_SERIALIZATION( graphene::net::block_range_message )
 GRAPHENE_IMPLEMENT_EXTERNAL_SERIALIZATION( graphene::net::item_id )
 GRAPHENE_IMPLEMENT_EXTERNAL_SERIALIZATION( graphene::net::item_ids_inventory_message )
 GRAPHENE_IMPLEMENT_EXTERNAL_SERIALIZATION( graphene::net::blockchain_item_ids_inventory_message )
@@ -25,7 +25,19 @@
 
 #include <stddef.h>
 
-#define GRAPHENE_NET_PROTOCOL_VERSION                        106
+#define GRAPHENE_NET_PROTOCOL_VERSION                        108
+
+/**
+ * Peers at this protocol version or later receive new blocks as compact_block_message,
+ * older peers receive the full block_message.
+ */
+#define GRAPHENE_NET_COMPACT_BLOCKS_PROTOCOL_VERSION         107
+
+/**
+ * During sync, peers at this protocol version or later are asked for runs of consecutive blocks
+ * with fetch_block_range_message instead of fetch_items_message.
+ */
+#define GRAPHENE_NET_BLOCK_RANGE_PROTOCOL_VERSION            108
 
 /**
  * Define this to enable debugging code in the p2p network interface.
@@ -86,6 +98,32 @@
 
 #define GRAPHENE_NET_MAX_BLOCKS_PER_PEER_DURING_SYNCING      200
 
+/**
+ * During sync, blocks are requested in batches of this many consecutive
+ * blocks, handed out to the peers we sync from in turn, so that the range
+ * of blocks we are about to push is downloaded from all of them at once.
+ * A peer may have several batches outstanding, up to
+ * GRAPHENE_NET_MAX_BLOCKS_PER_PEER_DURING_SYNCING blocks.
+ */
+#define GRAPHENE_NET_SYNC_BLOCKS_PER_REQUEST                 20
+
+/**
+ * During sync, a block we asked a peer for that hasn't arrived after this
+ * many milliseconds is requested again from another peer which has it,
+ * so that one slow peer doesn't hold up the blocks behind it.  This must be
+ * shorter than the time after which a peer that makes no progress on our
+ * sync requests is disconnected.
+ */
+#define GRAPHENE_NET_SYNC_STRAGGLER_TIMEOUT_MS               2000
+
+/**
+ * The blocks of a fetch_block_range_message are sent back in block_range_message
+ * of at most this many bytes of blocks (but at least one block each), so that a
+ * range doesn't have to fit into one message and the peer can start processing
+ * the first blocks while the rest are still being sent.
+ */
+#define GRAPHENE_NET_MAX_BLOCK_RANGE_MESSAGE_BYTES           (512*1024)
+
 /**
  * During normal operation, how many items will be fetched from each
  * peer at a time.  This will only come into play when the network
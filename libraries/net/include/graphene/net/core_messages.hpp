@@ -85,6 +85,11 @@ namespace graphene { namespace net {
     check_firewall_reply_message_type            = 5015,
     get_current_connections_request_message_type = 5016,
     get_current_connections_reply_message_type   = 5017,
+    compact_block_message_type                   = 5018,
+    fetch_compact_block_transactions_message_type = 5019,
+    compact_block_transactions_message_type      = 5020,
+    fetch_block_range_message_type               = 5021,
+    block_range_message_type                     = 5022,
     core_message_type_last                       = 5099
   };
 
@@ -114,6 +119,83 @@ namespace graphene { namespace net {
 
    };
 
+   /// Identifies a transaction of a compact block by the beginning of its id
+   typedef uint64_t short_transaction_id;
+   short_transaction_id get_short_transaction_id( const transaction_id_type& id );
+
+   struct compact_block_transaction
+   {
+      short_transaction_id                              short_id = 0;
+      /// the part of the transaction in the block that is not relayed with the transaction itself
+      std::vector<graphene::protocol::operation_result> operation_results;
+   };
+
+   /**
+    * A block_message without the transactions, which the receiver most likely has from trx_message already.
+    * The receiver looks them up by their short ids and requests those it does not find with a
+    * fetch_compact_block_transactions_message. The block assembled from them must result in the same
+    * block_message, which is then processed like a block_message that was received.
+    */
+   struct compact_block_message
+   {
+      static const core_message_type_enum type;
+
+      compact_block_message() {}
+      explicit compact_block_message( const block_message& full );
+
+      graphene::protocol::signed_block_header  header;
+      block_id_type                            block_id;
+      std::vector<compact_block_transaction>   transactions;
+   };
+
+   struct fetch_compact_block_transactions_message
+   {
+      static const core_message_type_enum type;
+
+      block_id_type          block_id;
+      /// positions of the requested transactions in the block
+      std::vector<uint32_t>  transaction_indexes;
+   };
+
+   struct compact_block_transactions_message
+   {
+      static const core_message_type_enum type;
+
+      block_id_type                                          block_id;
+      /// in the order of fetch_compact_block_transactions_message::transaction_indexes
+      std::vector<graphene::protocol::processed_transaction> transactions;
+   };
+
+   /**
+    * Requests the blocks of the sender's chain from first_block_num on, by number instead of by id.
+    * Used during sync for runs of consecutive blocks whose ids the peer sent us already, to save the
+    * round trip and the per message overhead of fetching them item by item.
+    */
+   struct fetch_block_range_message
+   {
+      static const core_message_type_enum type;
+
+      uint32_t first_block_num = 0;
+      uint32_t block_count     = 0;
+   };
+
+   /**
+    * A part of the reply to a fetch_block_range_message.  The blocks are sent as they are stored in
+    * the block database, without deserializing and serializing them again.
+    */
+   struct block_range_message
+   {
+      static const core_message_type_enum type;
+
+      /// the number of the first block in packed_blocks
+      uint32_t                        first_block_num = 0;
+      /// consecutive blocks in their packed form
+      std::vector<std::vector<char>>  packed_blocks;
+      /// set in the last message of the reply, the number of requested blocks after packed_blocks
+      /// the peer doesn't have
+      uint32_t                        blocks_unavailable = 0;
+   };
+
   struct item_ids_inventory_message
   {
     static const core_message_type_enum type;
@@ -422,6 +504,11 @@ FC_REFLECT_ENUM( graphene::net::core_message_type_enum,
                  (check_firewall_reply_message_type)
                  (get_current_connections_request_message_type)
                  (get_current_connections_reply_message_type)
+                 (compact_block_message_type)
+                 (fetch_compact_block_transactions_message_type)
+                 (compact_block_transactions_message_type)
+                 (fetch_block_range_message_type)
+                 (block_range_message_type)
                  (core_message_type_last) )
 FC_REFLECT_ENUM(graphene::net::rejection_reason_code, (unspecified)
                                                  (different_chain)
@@ -443,6 +530,12 @@ FC_REFLECT_ENUM(graphene::net::firewall_check_result, (unable_to_check)
 
 FC_REFLECT_TYPENAME( graphene::net::trx_message )
 FC_REFLECT_TYPENAME( graphene::net::block_message )
+FC_REFLECT_TYPENAME( graphene::net::compact_block_transaction )
+FC_REFLECT_TYPENAME( graphene::net::compact_block_message )
+FC_REFLECT_TYPENAME( graphene::net::fetch_compact_block_transactions_message )
+FC_REFLECT_TYPENAME( graphene::net::compact_block_transactions_message )
+FC_REFLECT_TYPENAME( graphene::net::fetch_block_range_message )
+FC_REFLECT_TYPENAME( graphene::net::block_range_message )
 FC_REFLECT_TYPENAME( graphene::net::item_id )
 FC_REFLECT_TYPENAME( graphene::net::item_ids_inventory_message )
 FC_REFLECT_TYPENAME( graphene::net::blockchain_item_ids_inventory_message )
@@ -466,6 +559,12 @@ FC_REFLECT_TYPENAME( graphene::net::get_current_connections_reply_message )
 
 GRAPHENE_DECLARE_EXTERNAL_SERIALIZATION( graphene::net::trx_message )
 GRAPHENE_DECLARE_EXTERNAL_SERIALIZATION( graphene::net::block_message )
+GRAPHENE_DECLARE_EXTERNAL_SERIALIZATION( graphene::net::compact_block_transaction )
+GRAPHENE_DECLARE_EXTERNAL_SERIALIZATION( graphene::net::compact_block_message )
+GRAPHENE_DECLARE_EXTERNAL_SERIALIZATION( graphene::net::fetch_compact_block_transactions_message )
+GRAPHENE_DECLARE_EXTERNAL_SERIALIZATION( graphene::net::compact_block_transactions_message )
+GRAPHENE_DECLARE_EXTERNAL_SERIALIZATION( graphene::net::fetch_block_range_message )
+GRAPHENE_DECLARE_EXTERNAL_SERIALIZATION( graphene::net::block_range_message )
 GRAPHENE_DECLARE_EXTERNAL_SERIALIZATION( graphene::net::item_id )
 GRAPHENE_DECLARE_EXTERNAL_SERIALIZATION( graphene::net::item_ids_inventory_message )
 GRAPHENE_DECLARE_EXTERNAL_SERIALIZATION( graphene::net::blockchain_item_ids_inventory_message )
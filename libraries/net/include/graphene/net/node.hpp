@@ -49,6 +49,35 @@ namespace graphene { namespace net {
     node_id_t originating_peer;
   };
 
+   /// Counters of the relay of blocks as compact_block_message, returned by node::network_get_usage_stats()
+   struct compact_block_stats
+   {
+      uint64_t blocks_sent          = 0; ///< blocks sent to peers as compact_block_message
+      uint64_t full_bytes_sent      = 0; ///< size these blocks would have had as block_message
+      uint64_t compact_bytes_sent   = 0; ///< size of the compact_block_message sent instead
+      uint64_t blocks_received      = 0; ///< compact_block_message received from peers
+      uint64_t blocks_complete      = 0; ///< received blocks of which all transactions were known
+      uint64_t transactions_fetched = 0; ///< transactions requested from peers because they were not known
+      uint64_t blocks_mismatched    = 0; ///< received blocks whose known transactions did not match the header
+   };
+
+   /// Counters of the download of blocks during sync, returned by node::network_get_usage_stats()
+   struct sync_download_stats
+   {
+      uint64_t blocks_requested          = 0; ///< sync blocks requested from peers, including requests made again
+      uint64_t blocks_received           = 0; ///< requested sync blocks received from peers
+      uint64_t stragglers_rerequested    = 0; ///< sync blocks requested again from another peer after a timeout
+      uint64_t duplicate_blocks_received = 0; ///< sync blocks received after another peer had already sent them
+      uint64_t block_ranges_requested    = 0; ///< fetch_block_range_message sent to peers
+   };
+
+   /// Counters of the blocks sent to syncing peers, returned by node::network_get_usage_stats()
+   struct sync_upload_stats
+   {
+      uint64_t block_ranges_served = 0; ///< fetch_block_range_message answered for peers
+      uint64_t range_bytes_sent    = 0; ///< size of the blocks sent in block_range_message
+   };
+
    /**
     *  @class node_delegate
     *  @brief used by node reports status to client or fetch data from client
@@ -111,6 +140,12 @@ namespace graphene { namespace net {
           */
          virtual message get_item( const item_id& id ) = 0;
 
+         /**
+          *  Returns up to block_count consecutive blocks of our current chain from first_block_num on,
+          *  packed as they are stored.  Stops early at the first block we don't have.
+          */
+         virtual std::vector<std::vector<char>> get_packed_blocks( uint32_t first_block_num, uint32_t block_count ) = 0;
+
          virtual chain_id_type get_chain_id()const = 0;
 
          /**
@@ -322,3 +357,10 @@ namespace graphene { namespace net {
 
 FC_REFLECT(graphene::net::message_propagation_data, (received_time)(validated_time)(originating_peer));
 FC_REFLECT( graphene::net::peer_status, (version)(host)(info) );
+FC_REFLECT( graphene::net::compact_block_stats,
+            (blocks_sent)(full_bytes_sent)(compact_bytes_sent)
+            (blocks_received)(blocks_complete)(transactions_fetched)(blocks_mismatched) );
+FC_REFLECT( graphene::net::sync_download_stats,
+            (blocks_requested)(blocks_received)(stragglers_rerequested)(duplicate_blocks_received)
+            (block_ranges_requested) );
+FC_REFLECT( graphene::net::sync_upload_stats, (block_ranges_served)(range_bytes_sent) );
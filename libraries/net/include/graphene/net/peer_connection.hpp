@@ -225,6 +225,9 @@ namespace graphene { namespace net
       fc::optional<boost::tuple<std::vector<item_hash_t>, fc::time_point> > item_ids_requested_from_peer; /// we check this to detect a timed-out request and in busy()
       fc::time_point last_sync_item_received_time; /// the time we received the last sync item or the time we sent the last batch of sync item requests to this peer
       std::set<item_hash_t> sync_items_requested_from_peer; /// ids of blocks we've requested from this peer during sync.  fetch from another peer if this peer disconnects
+      /// fetch_block_range_message sent to this peer and not fully answered yet: the number of the next block of
+      /// each range we expect and the number of blocks of the range still to come
+      std::map<uint32_t, uint32_t> block_ranges_requested_from_peer;
       item_hash_t last_block_delegate_has_seen; /// the hash of the last block  this peer has told us about that the peer knows
       fc::time_point_sec last_block_time_delegate_has_seen;
       bool inhibit_fetching_sync_blocks = false;
@@ -251,6 +254,20 @@ namespace graphene { namespace net
       timestamped_items_set_type inventory_advertised_to_peer;
 
       item_to_time_map_type items_requested_from_peer;  /// items we've requested from this peer during normal operation.  fetch from another peer if this peer disconnects
+
+      /// a block received from this peer as compact_block_message, waiting for the transactions we requested
+      struct pending_compact_block
+      {
+        /// the entry of items_requested_from_peer it is counted against, it is dropped when that one is gone
+        item_id                                                 request;
+        graphene::protocol::signed_block_header                 header;
+        std::vector<graphene::protocol::processed_transaction>  transactions;
+        std::vector<uint32_t>                                   missing_indexes;
+        bool                                                    fetched = false;       /// some transactions were requested
+        bool                                                    all_requested = false; /// all transactions were requested
+      };
+      /// at most one per block requested in items_requested_from_peer
+      std::map<block_id_type, pending_compact_block> pending_compact_blocks;
       /// @}
 
       // if they're flooding us with transactions, we set this to avoid fetching for a few seconds to let the
@@ -30,6 +30,9 @@
 #include <forward_list>
 #include <iostream>
 #include <algorithm>
+#include <cstring>
+#include <numeric>
+#include <limits>
 #include <tuple>
 #include <string>
 #include <boost/tuple/tuple.hpp>
@@ -123,6 +126,23 @@ namespace graphene { namespace net { namespace detail {
       FC_THROW_EXCEPTION(  fc::key_not_found_exception, "Requested message not in cache" );
    }
 
+   fc::optional<graphene::protocol::precomputable_transaction> blockchain_tied_message_cache::find_transaction(
+         short_transaction_id short_id ) const
+   {
+      // contents hashes are ordered by their bytes, those beginning with short_id follow it padded with zeros
+      message_hash_type lowest;
+      std::memcpy( lowest._hash, &short_id, sizeof(short_id) );
+      const auto& contents_index = _message_cache.get<message_contents_hash_index>();
+      for( auto iter = contents_index.lower_bound( lowest );
+           iter != contents_index.end() && get_short_transaction_id( iter->message_contents_hash ) == short_id;
+           ++iter )
+      {
+         if( iter->message_body.msg_type.value() == trx_message_type )
+            return iter->message_body.as<trx_message>().trx;
+      }
+      return fc::optional<graphene::protocol::precomputable_transaction>();
+   }
+
     message_propagation_data blockchain_tied_message_cache::get_message_propagation_data(
              const message_hash_type& hash_of_msg_contents_to_lookup ) const
     {
@@ -381,12 +401,25 @@ namespace graphene { namespace net { namespace detail {
                           [&item_hash]( const graphene::net::block_message& message ) { return message.block_id == item_hash; } ) != _new_received_sync_items.end();                          ;
     }
 
+    bool node_impl::is_sync_item_requested_from_other_peer( const item_hash_t& item_hash,
+                                                            const peer_connection* peer ) const
+    {
+      VERIFY_CORRECT_THREAD();
+      fc::scoped_lock<fc::mutex> lock(_active_connections.get_mutex());
+      for( const peer_connection_ptr& active_peer : _active_connections )
+        if( active_peer.get() != peer &&
+            active_peer->sync_items_requested_from_peer.find(item_hash) != active_peer->sync_items_requested_from_peer.end() )
+          return true;
+      return false;
+    }
+
     void node_impl::request_sync_item_from_peer( const peer_connection_ptr& peer, const item_hash_t& item_to_request )
     {
       VERIFY_CORRECT_THREAD();
       dlog( "requesting item ${item_hash} from peer ${endpoint}", ("item_hash", item_to_request )("endpoint", peer->get_remote_endpoint() ) );
       item_id item_id_to_request( graphene::net::block_message_type, item_to_request );
-      _active_sync_requests.insert( active_sync_requests_map::value_type(item_to_request, fc::time_point::now() ) );
+      _active_sync_requests[item_to_request] = fc::time_point::now();
+      ++_sync_download_stats.blocks_requested;
       peer->last_sync_item_received_time = fc::time_point::now();
       peer->sync_items_requested_from_peer.insert(item_to_request);
       peer->send_message( fetch_items_message(item_id_to_request.item_type, std::vector<item_hash_t>{item_id_to_request.item_hash} ) );
@@ -399,11 +432,46 @@ namespace graphene { namespace net { namespace detail {
             ("item_count", items_to_request.size())("items_to_request", items_to_request)("endpoint", peer->get_remote_endpoint()) );
       for (const item_hash_t& item_to_request : items_to_request)
       {
-        _active_sync_requests.insert( active_sync_requests_map::value_type(item_to_request, fc::time_point::now() ) );
+        // the time is reset when a straggler is requested again from another peer
+        _active_sync_requests[item_to_request] = fc::time_point::now();
         peer->last_sync_item_received_time = fc::time_point::now();
         peer->sync_items_requested_from_peer.insert(item_to_request);
       }
-      peer->send_message(fetch_items_message(graphene::net::block_message_type, items_to_request));
+      _sync_download_stats.blocks_requested += items_to_request.size();
+      if (peer->core_protocol_version < GRAPHENE_NET_BLOCK_RANGE_PROTOCOL_VERSION)
+      {
+        peer->send_message(fetch_items_message(graphene::net::block_message_type, items_to_request));
+        return;
+      }
+
+      // ask for runs of consecutive blocks by number, the peer sent us their ids already
+      std::vector<uint32_t> block_numbers;
+      block_numbers.reserve(items_to_request.size());
+      for (const item_hash_t& item_to_request : items_to_request)
+        block_numbers.push_back(graphene::protocol::block_header::num_from_id(item_to_request));
+      std::sort(block_numbers.begin(), block_numbers.end());
+      fetch_block_range_message range_request;
+      for (uint32_t block_num : block_numbers)
+      {
+        if (range_request.block_count > 0 &&
+            (block_num != range_request.first_block_num + range_request.block_count ||
+             range_request.block_count >= GRAPHENE_NET_MAX_BLOCKS_PER_PEER_DURING_SYNCING))
+        {
+          peer->send_message(range_request);
+          peer->block_ranges_requested_from_peer[range_request.first_block_num] = range_request.block_count;
+          ++_sync_download_stats.block_ranges_requested;
+          range_request.block_count = 0;
+        }
+        if (range_request.block_count == 0)
+          range_request.first_block_num = block_num;
+        ++range_request.block_count;
+      }
+      if (range_request.block_count > 0)
+      {
+        peer->send_message(range_request);
+        peer->block_ranges_requested_from_peer[range_request.first_block_num] = range_request.block_count;
+        ++_sync_download_stats.block_ranges_requested;
+      }
     }
 
     void node_impl::fetch_sync_items_loop()
@@ -419,39 +487,122 @@ namespace graphene { namespace net { namespace detail {
           std::map<peer_connection_ptr, std::vector<item_hash_t> > sync_item_requests_to_send;
 
           {
+            const fc::time_point straggler_threshold = fc::time_point::now() - _sync_straggler_timeout;
+            // blocks we already have on hand, so that we can skip them quickly in the peers' lists
+            std::unordered_set<item_hash_t> sync_items_received;
+            for( const graphene::net::block_message& received_block : _received_sync_items )
+              sync_items_received.insert( received_block.block_id );
+            for( const graphene::net::block_message& received_block : _new_received_sync_items )
+              sync_items_received.insert( received_block.block_id );
             std::set<item_hash_t> sync_items_to_request;
 
-            // for each idle peer that we're syncing with
             fc::scoped_lock<fc::mutex> lock(_active_connections.get_mutex());
+
+            // the peers that can take more sync requests, with the position in their list of items to get
+            // from which we still have to look for blocks to request.  Unlike during normal operation, we
+            // don't wait for a peer to answer all of our requests before we send it the next batch.
+            std::vector<std::pair<peer_connection_ptr, size_t> > sync_peers;
+            // the lowest block we haven't yet handed to the client, from which the window of blocks to fetch starts
+            uint32_t first_needed_block_num = std::numeric_limits<uint32_t>::max();
             for( const peer_connection_ptr& peer : _active_connections )
             {
-              if( peer->we_need_sync_items_from_peer &&
-                  // if we've already scheduled a request for this peer, don't consider scheduling another
-                  sync_item_requests_to_send.find(peer) == sync_item_requests_to_send.end() &&
-                  peer->idle() )
+              if( !peer->we_need_sync_items_from_peer || peer->inhibit_fetching_sync_blocks )
+                continue;
+              if( !peer->ids_of_items_to_get.empty() )
+                first_needed_block_num = std::min( first_needed_block_num,
+                      graphene::protocol::block_header::num_from_id( peer->ids_of_items_to_get.front() ) );
+              if( !peer->item_ids_requested_from_peer && peer->items_requested_from_peer.empty() &&
+                  peer->sync_items_requested_from_peer.size() < _max_sync_blocks_per_peer )
+                sync_peers.emplace_back( peer, 0 );
+            }
+            const uint32_t last_block_num_in_window =
+                  first_needed_block_num > std::numeric_limits<uint32_t>::max() - _max_sync_blocks_to_prefetch ?
+                  std::numeric_limits<uint32_t>::max() :
+                  first_needed_block_num + static_cast<uint32_t>(_max_sync_blocks_to_prefetch) - 1;
+
+            auto number_of_requests_to = [&]( const peer_connection_ptr& peer ) {
+              auto requests_iter = sync_item_requests_to_send.find( peer );
+              return peer->sync_items_requested_from_peer.size()
+                     + ( requests_iter == sync_item_requests_to_send.end() ? 0 : requests_iter->second.size() );
+            };
+
+            // a block that is late holds up all the blocks after it, so ask the least busy of the other
+            // peers which have it to send it too.  Whichever copy arrives first is pushed.
+            // The items each of the sync_peers has, filled once the first late block is found.
+            std::vector< std::unordered_set<item_hash_t> > items_of_sync_peers;
+            for( const active_sync_requests_map::value_type& request : _active_sync_requests )
+            {
+              if( request.second >= straggler_threshold )
+                continue;
+              if( items_of_sync_peers.size() != sync_peers.size() )
+              {
+                items_of_sync_peers.reserve( sync_peers.size() );
+                for( const auto& sync_peer : sync_peers )
+                  items_of_sync_peers.emplace_back( sync_peer.first->ids_of_items_to_get.begin(),
+                                                    sync_peer.first->ids_of_items_to_get.end() );
+              }
+              peer_connection_ptr least_busy_peer;
+              size_t least_busy_peer_requests = _max_sync_blocks_per_peer;
+              for( size_t i = 0; i < sync_peers.size(); ++i )
               {
-                if (!peer->inhibit_fetching_sync_blocks)
+                const peer_connection_ptr& peer = sync_peers[i].first;
+                const size_t peer_requests = number_of_requests_to( peer );
+                if( peer_requests < least_busy_peer_requests &&
+                    peer->sync_items_requested_from_peer.find( request.first ) == peer->sync_items_requested_from_peer.end() &&
+                    items_of_sync_peers[i].find( request.first ) != items_of_sync_peers[i].end() )
                 {
-                  // loop through the items it has that we don't yet have on our blockchain
-                  for( const auto& item_to_potentially_request : peer->ids_of_items_to_get )
+                  least_busy_peer = peer;
+                  least_busy_peer_requests = peer_requests;
+                }
+              }
+              if( least_busy_peer )
+              {
+                dlog( "requesting sync item ${item} again from peer ${endpoint}",
+                      ("item", request.first)("endpoint", least_busy_peer->get_remote_endpoint()) );
+                sync_item_requests_to_send[least_busy_peer].push_back( request.first );
+                sync_items_to_request.insert( request.first );
+                ++_sync_download_stats.stragglers_rerequested;
+              }
+            }
+
+            // hand out the blocks in the window in batches of consecutive blocks, one batch to each peer in turn,
+            // so that the blocks we need next are downloaded from all peers at once
+            bool batch_scheduled = true;
+            while( batch_scheduled )
+            {
+              batch_scheduled = false;
+              for( auto& sync_peer : sync_peers )
+              {
+                const peer_connection_ptr& peer = sync_peer.first;
+                size_t& position = sync_peer.second;
+                size_t peer_requests = number_of_requests_to( peer );
+                size_t batch_size = 0;
+                while( position < peer->ids_of_items_to_get.size() &&
+                       batch_size < _sync_blocks_per_request &&
+                       peer_requests < _max_sync_blocks_per_peer )
+                {
+                  const item_hash_t& item_to_potentially_request = peer->ids_of_items_to_get[position];
+                  if( graphene::protocol::block_header::num_from_id( item_to_potentially_request ) > last_block_num_in_window )
+                  {
+                    position = peer->ids_of_items_to_get.size();
+                    break;
+                  }
+                  ++position;
+                  if( // already got it, but for some reson it's still in our list of items to fetch
+                      sync_items_received.find(item_to_potentially_request) == sync_items_received.end() &&
+                      // we have already decided to request it from another peer during this iteration
+                      sync_items_to_request.find(item_to_potentially_request) == sync_items_to_request.end() &&
+                      // we've requested it in a previous iteration and we're still waiting for it to arrive
+                      _active_sync_requests.find(item_to_potentially_request) == _active_sync_requests.end() )
                   {
-                    // if we don't already have this item in our temporary storage
-                    // and we haven't requested from another syncing peer
-                    if( // already got it, but for some reson it's still in our list of items to fetch
-                        !have_already_received_sync_item(item_to_potentially_request) &&
-                        // we have already decided to request it from another peer during this iteration
-                        sync_items_to_request.find(item_to_potentially_request) == sync_items_to_request.end() &&
-                        // we've requested it in a previous iteration and we're still waiting for it to arrive
-                        _active_sync_requests.find(item_to_potentially_request) == _active_sync_requests.end() )
-                    {
-                      // then schedule a request from this peer
-                      sync_item_requests_to_send[peer].push_back(item_to_potentially_request);
-                      sync_items_to_request.insert( item_to_potentially_request );
-                      if (sync_item_requests_to_send[peer].size() >= _max_sync_blocks_per_peer)
-                        break;
-                    }
+                    sync_item_requests_to_send[peer].push_back(item_to_potentially_request);
+                    sync_items_to_request.insert( item_to_potentially_request );
+                    ++batch_size;
+                    ++peer_requests;
                   }
                 }
+                if( batch_size > 0 )
+                  batch_scheduled = true;
               }
             }
           } // end non-preemptable section
@@ -469,7 +620,18 @@ namespace graphene { namespace net { namespace detail {
           dlog( "no sync items to fetch right now, going to sleep" );
           _retrigger_fetch_sync_items_loop_promise
                 = fc::promise<void>::create("graphene::net::retrigger_fetch_sync_items_loop");
-          _retrigger_fetch_sync_items_loop_promise->wait();
+          try
+          {
+            // while requests are outstanding, wake up in time to request stragglers from other peers
+            if( _active_sync_requests.empty() || _suspend_fetching_sync_blocks )
+              _retrigger_fetch_sync_items_loop_promise->wait();
+            else
+              _retrigger_fetch_sync_items_loop_promise->wait(_sync_straggler_timeout);
+          }
+          catch (const fc::timeout_exception&)
+          {
+            dlog("Resuming fetch_sync_items_loop due to timeout -- checking for sync items to request again");
+          }
           _retrigger_fetch_sync_items_loop_promise.reset();
         }
       } // while( !canceled )
@@ -1298,6 +1460,23 @@ namespace graphene { namespace net { namespace detail {
       case core_message_type_enum::block_message_type:
         process_block_message(originating_peer, received_message, message_hash);
         break;
+      case core_message_type_enum::compact_block_message_type:
+        on_compact_block_message(originating_peer, received_message.as<compact_block_message>());
+        break;
+      case core_message_type_enum::fetch_compact_block_transactions_message_type:
+        on_fetch_compact_block_transactions_message(originating_peer,
+                                                    received_message.as<fetch_compact_block_transactions_message>());
+        break;
+      case core_message_type_enum::compact_block_transactions_message_type:
+        on_compact_block_transactions_message(originating_peer,
+                                              received_message.as<compact_block_transactions_message>());
+        break;
+      case core_message_type_enum::fetch_block_range_message_type:
+        on_fetch_block_range_message(originating_peer, received_message.as<fetch_block_range_message>());
+        break;
+      case core_message_type_enum::block_range_message_type:
+        on_block_range_message(originating_peer, received_message.as<block_range_message>());
+        break;
       case core_message_type_enum::current_time_request_message_type:
         on_current_time_request_message(originating_peer, received_message.as<current_time_request_message>());
         break;
@@ -2293,9 +2472,22 @@ namespace graphene { namespace net { namespace detail {
           dlog("received item request for item ${id} from peer ${endpoint}, returning the item from my message cache",
                ("endpoint", originating_peer->get_remote_endpoint())
                ("id", requested_message.id()));
-          reply_messages.push_back(requested_message);
           if (fetch_items_message_received.item_type == block_message_type)
+          {
             last_block_message_sent = requested_message;
+            // a new block, the peer most likely received its transactions already
+            if (_send_compact_blocks &&
+                originating_peer->core_protocol_version >= GRAPHENE_NET_COMPACT_BLOCKS_PROTOCOL_VERSION)
+            {
+              message compact_message(compact_block_message(requested_message.as<graphene::net::block_message>()));
+              ++_compact_block_stats.blocks_sent;
+              _compact_block_stats.full_bytes_sent += requested_message.size.value();
+              _compact_block_stats.compact_bytes_sent += compact_message.size.value();
+              reply_messages.push_back(compact_message);
+              continue;
+            }
+          }
+          reply_messages.push_back(requested_message);
           continue;
         }
         catch (fc::key_not_found_exception&)
@@ -2341,14 +2533,358 @@ namespace graphene { namespace net { namespace detail {
       }
     }
 
+    void node_impl::on_compact_block_message( peer_connection* originating_peer,
+                                              const compact_block_message& compact_block_message_received )
+    {
+      VERIFY_CORRECT_THREAD();
+      const block_id_type& block_id = compact_block_message_received.block_id;
+      dlog("received compact block ${id} with ${n} transactions from peer ${endpoint}",
+           ("id", block_id)("n", compact_block_message_received.transactions.size())
+           ("endpoint", originating_peer->get_remote_endpoint()));
+      // we only know the hash of the block_message we requested, which the block must result in, so each
+      // compact block is counted against one of the block requests no other pending compact block is
+      fc::optional<item_id> request;
+      if (originating_peer->pending_compact_blocks.find(block_id) == originating_peer->pending_compact_blocks.end())
+        request = find_unclaimed_block_request(originating_peer);
+      if (!request)
+      {
+        wlog("received a compact block ${block_id} I didn't ask for from peer ${endpoint}, disconnecting from peer",
+             ("endpoint", originating_peer->get_remote_endpoint())
+             ("block_id", block_id));
+        fc::exception detailed_error(FC_LOG_MESSAGE(error, "You sent me a block that I didn't ask for, block_id: ${block_id}",
+                                                    ("block_id", block_id)));
+        disconnect_from_peer(originating_peer, "You sent me a block that I didn't ask for", true, detailed_error);
+        return;
+      }
+
+      ++_compact_block_stats.blocks_received;
+      peer_connection::pending_compact_block pending;
+      pending.request = *request;
+      pending.header = compact_block_message_received.header;
+      pending.transactions.resize(compact_block_message_received.transactions.size());
+      for (uint32_t i = 0; i < compact_block_message_received.transactions.size(); ++i)
+      {
+        const compact_block_transaction& entry = compact_block_message_received.transactions[i];
+        fc::optional<graphene::protocol::precomputable_transaction> trx = _message_cache.find_transaction(entry.short_id);
+        if (!trx)
+        {
+          pending.missing_indexes.push_back(i);
+          continue;
+        }
+        pending.transactions[i] = graphene::protocol::processed_transaction(*trx);
+        pending.transactions[i].operation_results = entry.operation_results;
+      }
+      originating_peer->pending_compact_blocks[block_id] = std::move(pending);
+      continue_compact_block(originating_peer, block_id);
+    }
+
+    void node_impl::continue_compact_block( peer_connection* originating_peer, const block_id_type& block_id )
+    {
+      VERIFY_CORRECT_THREAD();
+      auto pending_iter = originating_peer->pending_compact_blocks.find(block_id);
+      if (pending_iter == originating_peer->pending_compact_blocks.end())
+        return;
+      peer_connection::pending_compact_block& pending = pending_iter->second;
+      if (!pending.missing_indexes.empty())
+      {
+        dlog("requesting ${n} transactions of compact block ${id} from peer ${endpoint}",
+             ("n", pending.missing_indexes.size())("id", block_id)
+             ("endpoint", originating_peer->get_remote_endpoint()));
+        _compact_block_stats.transactions_fetched += pending.missing_indexes.size();
+        pending.fetched = true;
+        fetch_compact_block_transactions_message request;
+        request.block_id = block_id;
+        request.transaction_indexes = pending.missing_indexes;
+        originating_peer->send_message(request);
+        return;
+      }
+
+      signed_block block;
+      static_cast<graphene::protocol::signed_block_header&>(block) = pending.header;
+      block.transactions = std::move(pending.transactions);
+      if (!pending.all_requested && block.calculate_merkle_root() != block.transaction_merkle_root)
+      {
+        // one of the transactions we know has the same short id as, or other signatures than, the one in the
+        // block, we don't know which one
+        dlog("transactions of compact block ${id} don't match its header, requesting all of them", ("id", block_id));
+        ++_compact_block_stats.blocks_mismatched;
+        pending.transactions = std::move(block.transactions);
+        pending.all_requested = true;
+        pending.missing_indexes.resize(pending.transactions.size());
+        std::iota(pending.missing_indexes.begin(), pending.missing_indexes.end(), 0u);
+        continue_compact_block(originating_peer, block_id);
+        return;
+      }
+      if (!pending.fetched)
+        ++_compact_block_stats.blocks_complete;
+      originating_peer->pending_compact_blocks.erase(pending_iter);
+
+      message block_message_to_process(graphene::net::block_message(std::move(block)));
+      process_block_message(originating_peer, block_message_to_process, block_message_to_process.id());
+    }
+
+    fc::optional<item_id> node_impl::find_unclaimed_block_request( peer_connection* peer ) const
+    {
+      VERIFY_CORRECT_THREAD();
+      for (const peer_connection::item_to_time_map_type::value_type& item : peer->items_requested_from_peer)
+      {
+        if (item.first.item_type != graphene::net::block_message_type)
+          continue;
+        bool claimed = false;
+        for (const auto& pending : peer->pending_compact_blocks)
+          claimed = claimed || pending.second.request == item.first;
+        if (!claimed)
+          return item.first;
+      }
+      return fc::optional<item_id>();
+    }
+
+    void node_impl::drop_unrequested_compact_blocks( peer_connection* peer )
+    {
+      VERIFY_CORRECT_THREAD();
+      for (auto iter = peer->pending_compact_blocks.begin(); iter != peer->pending_compact_blocks.end();)
+      {
+        if (peer->items_requested_from_peer.find(iter->second.request) != peer->items_requested_from_peer.end())
+        {
+          ++iter;
+          continue;
+        }
+        // the fulfilled request may have been another one than that of the compact block
+        fc::optional<item_id> request = find_unclaimed_block_request(peer);
+        if (request)
+        {
+          iter->second.request = *request;
+          ++iter;
+          continue;
+        }
+        dlog("dropping compact block ${id} from peer ${endpoint}, no block request is left for it",
+             ("id", iter->first)("endpoint", peer->get_remote_endpoint()));
+        iter = peer->pending_compact_blocks.erase(iter);
+      }
+    }
+
+    void node_impl::on_fetch_compact_block_transactions_message( peer_connection* originating_peer,
+                                                                 const fetch_compact_block_transactions_message& request )
+    {
+      VERIFY_CORRECT_THREAD();
+      try
+      {
+        graphene::net::block_message full =
+              _delegate->get_item(item_id(graphene::net::block_message_type, request.block_id))
+                       .as<graphene::net::block_message>();
+        compact_block_transactions_message reply;
+        reply.block_id = request.block_id;
+        reply.transactions.reserve(request.transaction_indexes.size());
+        for (uint32_t index : request.transaction_indexes)
+        {
+          FC_ASSERT(index < full.block.transactions.size(), "the block has no transaction ${index}", ("index", index));
+          reply.transactions.push_back(full.block.transactions[index]);
+        }
+        originating_peer->send_message(reply);
+      }
+      catch (const fc::canceled_exception&)
+      {
+        throw;
+      }
+      catch (const fc::exception& e)
+      {
+        // the peer requests the block from someone else
+        wlog("unable to send the transactions of compact block ${id} to peer ${endpoint}: ${e}",
+             ("id", request.block_id)("endpoint", originating_peer->get_remote_endpoint())("e", e));
+        originating_peer->send_message(item_not_available_message(item_id(graphene::net::block_message_type,
+                                                                          request.block_id)));
+      }
+    }
+
+    void node_impl::on_compact_block_transactions_message( peer_connection* originating_peer,
+                                                           const compact_block_transactions_message& reply )
+    {
+      VERIFY_CORRECT_THREAD();
+      auto pending_iter = originating_peer->pending_compact_blocks.find(reply.block_id);
+      if (pending_iter == originating_peer->pending_compact_blocks.end() ||
+          pending_iter->second.missing_indexes.size() != reply.transactions.size())
+      {
+        wlog("received transactions of compact block ${block_id} I didn't ask for from peer ${endpoint}, disconnecting from peer",
+             ("endpoint", originating_peer->get_remote_endpoint())
+             ("block_id", reply.block_id));
+        fc::exception detailed_error(FC_LOG_MESSAGE(error, "You sent me transactions I didn't ask for, block_id: ${block_id}",
+                                                    ("block_id", reply.block_id)));
+        disconnect_from_peer(originating_peer, "You sent me transactions I didn't ask for", true, detailed_error);
+        return;
+      }
+      peer_connection::pending_compact_block& pending = pending_iter->second;
+      for (size_t i = 0; i < reply.transactions.size(); ++i)
+        pending.transactions[pending.missing_indexes[i]] = reply.transactions[i];
+      pending.missing_indexes.clear();
+      continue_compact_block(originating_peer, reply.block_id);
+    }
+
+    void node_impl::on_fetch_block_range_message( peer_connection* originating_peer,
+                                                  const fetch_block_range_message& request )
+    {
+      VERIFY_CORRECT_THREAD();
+      dlog("received request for ${count} blocks from block ${num} from peer ${endpoint}",
+           ("count", request.block_count)("num", request.first_block_num)
+           ("endpoint", originating_peer->get_remote_endpoint()));
+      std::vector<std::vector<char>> packed_blocks;
+      try
+      {
+        // a peer never has more blocks requested from us at a time
+        packed_blocks = _delegate->get_packed_blocks(request.first_block_num,
+                                                     std::min<uint32_t>(request.block_count,
+                                                                        GRAPHENE_NET_MAX_BLOCKS_PER_PEER_DURING_SYNCING));
+      }
+      catch (const fc::exception& e)
+      {
+        wlog("unable to read blocks from block ${num} for peer ${endpoint}: ${e}",
+             ("num", request.first_block_num)("endpoint", originating_peer->get_remote_endpoint())("e", e));
+      }
+      ++_sync_upload_stats.block_ranges_served;
+
+      if (!packed_blocks.empty())
+      {
+        // the peer has seen the blocks once we send them, like in on_fetch_items_message
+        try
+        {
+          const auto last_header = fc::raw::unpack<graphene::protocol::signed_block_header>(
+                                         packed_blocks.back(), GRAPHENE_NET_MAX_NESTED_OBJECTS);
+          originating_peer->last_block_delegate_has_seen = last_header.id();
+          originating_peer->last_block_time_delegate_has_seen = last_header.timestamp;
+        }
+        catch (const fc::exception& e)
+        {
+          wlog("unable to read the header of block ${num}: ${e}",
+               ("num", request.first_block_num + packed_blocks.size() - 1)("e", e));
+        }
+      }
+
+      // send the blocks in parts of limited size, so that the peer can process the first of them
+      // while we are sending the rest
+      block_range_message reply;
+      reply.first_block_num = request.first_block_num;
+      size_t reply_bytes = 0;
+      for (std::vector<char>& packed_block : packed_blocks)
+      {
+        if (!reply.packed_blocks.empty() && reply_bytes + packed_block.size() > GRAPHENE_NET_MAX_BLOCK_RANGE_MESSAGE_BYTES)
+        {
+          originating_peer->send_message(reply);
+          reply.first_block_num += reply.packed_blocks.size();
+          reply.packed_blocks.clear();
+          reply_bytes = 0;
+        }
+        reply_bytes += packed_block.size();
+        _sync_upload_stats.range_bytes_sent += packed_block.size();
+        reply.packed_blocks.push_back(std::move(packed_block));
+      }
+      reply.blocks_unavailable = request.block_count - (reply.first_block_num - request.first_block_num)
+                                 - reply.packed_blocks.size();
+      originating_peer->send_message(reply);
+    }
+
+    void node_impl::on_block_range_message( peer_connection* originating_peer, const block_range_message& reply )
+    {
+      VERIFY_CORRECT_THREAD();
+      dlog("received ${count} blocks from block ${num} from peer ${endpoint}",
+           ("count", reply.packed_blocks.size())("num", reply.first_block_num)
+           ("endpoint", originating_peer->get_remote_endpoint()));
+      // the reply must continue one of our requests, the parts of a reply arrive in order and only the last one
+      // tells how many blocks the peer doesn't have
+      auto range_iter = originating_peer->block_ranges_requested_from_peer.find(reply.first_block_num);
+      const uint64_t blocks_answered = uint64_t(reply.packed_blocks.size()) + reply.blocks_unavailable;
+      if (range_iter == originating_peer->block_ranges_requested_from_peer.end() ||
+          blocks_answered == 0 || blocks_answered > range_iter->second ||
+          (reply.blocks_unavailable > 0 && blocks_answered != range_iter->second))
+      {
+        wlog("received a block range from block ${num} I didn't ask for from peer ${endpoint}, disconnecting from peer",
+             ("num", reply.first_block_num)("endpoint", originating_peer->get_remote_endpoint()));
+        fc::exception detailed_error(FC_LOG_MESSAGE(error, "You sent me blocks that I didn't ask for, from block ${num}",
+                                                    ("num", reply.first_block_num)));
+        disconnect_from_peer(originating_peer, "You sent me blocks that I didn't ask for", true, detailed_error);
+        return;
+      }
+      const uint32_t blocks_to_come = range_iter->second - static_cast<uint32_t>(blocks_answered);
+      originating_peer->block_ranges_requested_from_peer.erase(range_iter);
+      if (blocks_to_come > 0)
+        originating_peer->block_ranges_requested_from_peer[reply.first_block_num + reply.packed_blocks.size()] =
+              blocks_to_come;
+
+      // numbers of the blocks of the range we asked for but didn't get
+      std::set<uint32_t> missing_block_numbers;
+      uint32_t block_num = reply.first_block_num;
+      for (const std::vector<char>& packed_block : reply.packed_blocks)
+      {
+        graphene::net::block_message block_message_to_process;
+        try
+        {
+          block_message_to_process = graphene::net::block_message(
+                fc::raw::unpack<graphene::protocol::signed_block>(packed_block, GRAPHENE_NET_MAX_NESTED_OBJECTS));
+        }
+        catch (const fc::exception& e)
+        {
+          wlog("received a block that can't be deserialized from peer ${endpoint}, disconnecting from peer",
+               ("endpoint", originating_peer->get_remote_endpoint()));
+          disconnect_from_peer(originating_peer, "You sent me a block that I can't deserialize", true, e);
+          return;
+        }
+        auto sync_item_iter = originating_peer->sync_items_requested_from_peer.find(block_message_to_process.block_id);
+        if (block_message_to_process.block.block_num() != block_num ||
+            sync_item_iter == originating_peer->sync_items_requested_from_peer.end())
+        {
+          // not the block whose id the peer sent us, it has probably switched forks since then
+          dlog("received block ${id} I didn't ask for in a block range from peer ${endpoint}",
+               ("id", block_message_to_process.block_id)("endpoint", originating_peer->get_remote_endpoint()));
+          missing_block_numbers.insert(block_num++);
+          continue;
+        }
+        ++block_num;
+        originating_peer->sync_items_requested_from_peer.erase(sync_item_iter);
+        process_requested_sync_block(originating_peer, block_message_to_process, message_hash_type());
+      }
+      for (uint32_t i = 0; i < reply.blocks_unavailable; ++i)
+        missing_block_numbers.insert(block_num + i);
+      if (missing_block_numbers.empty())
+        return;
+
+      std::vector<item_hash_t> missing_items;
+      for (const item_hash_t& item : originating_peer->sync_items_requested_from_peer)
+        if (missing_block_numbers.find(graphene::protocol::block_header::num_from_id(item)) != missing_block_numbers.end())
+          missing_items.push_back(item);
+      if (missing_items.empty())
+        return;
+      // handle them like an item_not_available_message, once
+      for (size_t i = 1; i < missing_items.size(); ++i)
+      {
+        if (!is_sync_item_requested_from_other_peer(missing_items[i], originating_peer))
+          _active_sync_requests.erase(missing_items[i]);
+        originating_peer->sync_items_requested_from_peer.erase(missing_items[i]);
+      }
+      on_item_not_available_message(originating_peer,
+                                    item_not_available_message(item_id(graphene::net::block_message_type,
+                                                                       missing_items.front())));
+    }
+
     void node_impl::on_item_not_available_message( peer_connection* originating_peer, const item_not_available_message& item_not_available_message_received )
     {
       VERIFY_CORRECT_THREAD();
       const item_id& requested_item = item_not_available_message_received.requested_item;
+      if (requested_item.item_type == graphene::net::block_message_type)
+      {
+        // the peer can't send the transactions of a compact block it sent us, so it doesn't fulfill the block
+        // request the compact block was counted against
+        auto compact_iter = originating_peer->pending_compact_blocks.find(requested_item.item_hash);
+        if (compact_iter != originating_peer->pending_compact_blocks.end())
+        {
+          const item_id request = compact_iter->second.request;
+          originating_peer->pending_compact_blocks.erase(compact_iter);
+          on_item_not_available_message(originating_peer, item_not_available_message(request));
+          return;
+        }
+      }
       auto regular_item_iter = originating_peer->items_requested_from_peer.find(requested_item);
       if (regular_item_iter != originating_peer->items_requested_from_peer.end())
       {
         originating_peer->items_requested_from_peer.erase( regular_item_iter );
+        drop_unrequested_compact_blocks( originating_peer );
         originating_peer->inventory_peer_advertised_to_us.erase( requested_item );
         if (is_item_in_any_peers_inventory(requested_item))
         {
@@ -2363,7 +2899,8 @@ namespace graphene { namespace net { namespace detail {
       auto sync_item_iter = originating_peer->sync_items_requested_from_peer.find(requested_item.item_hash);
       if (sync_item_iter != originating_peer->sync_items_requested_from_peer.end())
       {
-        _active_sync_requests.erase(*sync_item_iter);
+        if (!is_sync_item_requested_from_other_peer(*sync_item_iter, originating_peer))
+          _active_sync_requests.erase(*sync_item_iter);
         originating_peer->sync_items_requested_from_peer.erase(sync_item_iter);
 
         if (originating_peer->peer_needs_sync_items_from_us)
@@ -2561,7 +3098,8 @@ namespace graphene { namespace net { namespace detail {
       if (!originating_peer->sync_items_requested_from_peer.empty())
       {
         for (auto sync_item : originating_peer->sync_items_requested_from_peer)
-          _active_sync_requests.erase(sync_item);
+          if (!is_sync_item_requested_from_other_peer(sync_item, originating_peer))
+            _active_sync_requests.erase(sync_item);
         trigger_fetch_sync_items_loop();
       }
 
@@ -3094,6 +3632,65 @@ namespace graphene { namespace net { namespace detail {
         disconnect_from_peer(peer.get(), disconnect_reason, true, *disconnect_exception);
       }
     }
+
+    void node_impl::process_requested_sync_block( peer_connection* originating_peer,
+                                                  const graphene::net::block_message& block_message_to_process,
+                                                  const message_hash_type& message_hash )
+    {
+      VERIFY_CORRECT_THREAD();
+      // if exceptions are throw here after the caller removed the sync item from the peer's list,
+      // it could leave our sync in a stalled state.  Wrap a try/catch around the rest
+      // of the function so we can log if this ever happens.
+      try
+      {
+        originating_peer->last_sync_item_received_time = fc::time_point::now();
+        // if we requested a late block from more than one peer, only the first copy to arrive is processed
+        if (_active_sync_requests.erase(block_message_to_process.block_id) > 0)
+        {
+          ++_sync_download_stats.blocks_received;
+          process_block_during_syncing(originating_peer, block_message_to_process, message_hash);
+        }
+        else
+        {
+          dlog("ignoring sync block ${id} from peer ${endpoint}, another peer already sent it",
+               ("id", block_message_to_process.block_id)("endpoint", originating_peer->get_remote_endpoint()));
+          ++_sync_download_stats.duplicate_blocks_received;
+        }
+        if (originating_peer->idle())
+        {
+          // we have finished fetching a batch of items, so we either need to grab another batch of items
+          // or we need to get another list of item ids.
+          if (originating_peer->number_of_unfetched_item_ids > 0 &&
+              originating_peer->ids_of_items_to_get.size() < GRAPHENE_NET_MIN_BLOCK_IDS_TO_PREFETCH)
+            fetch_next_batch_of_item_ids_from_peer(originating_peer);
+          else
+            trigger_fetch_sync_items_loop();
+        }
+        else if (originating_peer->sync_items_requested_from_peer.size() + _sync_blocks_per_request
+                 <= _max_sync_blocks_per_peer)
+          // the peer has room for another batch of requests
+          trigger_fetch_sync_items_loop();
+      }
+      catch (const fc::canceled_exception& e)
+      {
+        throw;
+      }
+      catch (const fc::exception& e)
+      {
+        elog("Caught unexpected exception: ${e}", ("e", e));
+        assert(false && "exceptions not expected here");
+      }
+      catch (const std::exception& e)
+      {
+        elog("Caught unexpected exception: ${e}", ("e", e.what()));
+        assert(false && "exceptions not expected here");
+      }
+      catch (...)
+      {
+        elog("Caught unexpected exception, could break sync operation");
+      }
+    }
+
     void node_impl::process_block_message(peer_connection* originating_peer,
                                           const message& message_to_process,
                                           const message_hash_type& message_hash)
@@ -3109,6 +3706,7 @@ namespace graphene { namespace net { namespace detail {
       if (item_iter != originating_peer->items_requested_from_peer.end())
       {
         originating_peer->items_requested_from_peer.erase(item_iter);
+        drop_unrequested_compact_blocks(originating_peer);
         process_block_when_in_sync(originating_peer, block_message_to_process, message_hash);
         if (originating_peer->idle())
           trigger_fetch_items_loop();
@@ -3121,44 +3719,8 @@ namespace graphene { namespace net { namespace detail {
         if (sync_item_iter != originating_peer->sync_items_requested_from_peer.end())
         {
           originating_peer->sync_items_requested_from_peer.erase(sync_item_iter);
-          // if exceptions are throw here after removing the sync item from the list (above),
-          // it could leave our sync in a stalled state.  Wrap a try/catch around the rest
-          // of the function so we can log if this ever happens.
-          try
-          {
-            originating_peer->last_sync_item_received_time = fc::time_point::now();
-            _active_sync_requests.erase(block_message_to_process.block_id);
-            process_block_during_syncing(originating_peer, block_message_to_process, message_hash);
-            if (originating_peer->idle())
-            {
-              // we have finished fetching a batch of items, so we either need to grab another batch of items
-              // or we need to get another list of item ids.
-              if (originating_peer->number_of_unfetched_item_ids > 0 &&
-                  originating_peer->ids_of_items_to_get.size() < GRAPHENE_NET_MIN_BLOCK_IDS_TO_PREFETCH)
-                fetch_next_batch_of_item_ids_from_peer(originating_peer);
-              else
-                trigger_fetch_sync_items_loop();
-            }
-            return;
-          }
-          catch (const fc::canceled_exception& e)
-          {
-            throw;
-          }
-          catch (const fc::exception& e)
-          {
-            elog("Caught unexpected exception: ${e}", ("e", e));
-            assert(false && "exceptions not expected here");
-          }
-          catch (const std::exception& e)
-          {
-            elog("Caught unexpected exception: ${e}", ("e", e.what()));
-            assert(false && "exceptions not expected here");
-          }
-          catch (...)
-          {
-            elog("Caught unexpected exception, could break sync operation");
-          }
+          process_requested_sync_block(originating_peer, block_message_to_process, message_hash);
+          return;
         }
       }
 
@@ -4630,6 +5192,12 @@ namespace graphene { namespace net { namespace detail {
         _max_sync_blocks_to_prefetch = params["max_sync_blocks_to_prefetch"].as<uint32_t>(1);
       if (params.contains("max_sync_blocks_per_peer"))
         _max_sync_blocks_per_peer = params["max_sync_blocks_per_peer"].as<uint32_t>(1);
+      if (params.contains("sync_blocks_per_request"))
+        _sync_blocks_per_request = std::max<uint32_t>(1, params["sync_blocks_per_request"].as<uint32_t>(1));
+      if (params.contains("sync_straggler_timeout_ms"))
+        _sync_straggler_timeout = fc::milliseconds(params["sync_straggler_timeout_ms"].as<uint32_t>(1));
+      if (params.contains("send_compact_blocks"))
+        _send_compact_blocks = params["send_compact_blocks"].as<bool>(1);
 
       _desired_number_of_connections = std::min(_desired_number_of_connections, _maximum_number_of_connections);
 
@@ -4649,6 +5217,9 @@ namespace graphene { namespace net { namespace detail {
       result["max_blocks_to_handle_at_once"] = _max_blocks_to_handle_at_once;
       result["max_sync_blocks_to_prefetch"] = _max_sync_blocks_to_prefetch;
       result["max_sync_blocks_per_peer"] = _max_sync_blocks_per_peer;
+      result["sync_blocks_per_request"] = _sync_blocks_per_request;
+      result["sync_straggler_timeout_ms"] = _sync_straggler_timeout.count() / 1000;
+      result["send_compact_blocks"] = _send_compact_blocks;
       return result;
     }
 
@@ -4750,6 +5321,9 @@ namespace graphene { namespace net { namespace detail {
       result["usage_by_second"] = fc::variant( network_usage_by_second, 2 );
       result["usage_by_minute"] = fc::variant( network_usage_by_minute, 2 );
       result["usage_by_hour"]   = fc::variant( network_usage_by_hour, 2 );
+      result["compact_blocks"]  = fc::variant( _compact_block_stats, 1 );
+      result["sync_downloads"]  = fc::variant( _sync_download_stats, 1 );
+      result["sync_uploads"]    = fc::variant( _sync_upload_stats, 1 );
       return result;
     }
 
@@ -5073,6 +5647,12 @@ namespace graphene { namespace net { namespace detail {
       INVOKE_AND_COLLECT_STATISTICS(get_item, id);
     }
 
+    std::vector<std::vector<char>> statistics_gathering_node_delegate_wrapper::get_packed_blocks( uint32_t first_block_num,
+                                                                                               uint32_t block_count )
+    {
+      INVOKE_AND_COLLECT_STATISTICS(get_packed_blocks, first_block_num, block_count);
+    }
+
     chain_id_type statistics_gathering_node_delegate_wrapper::get_chain_id() const
     {
       INVOKE_AND_COLLECT_STATISTICS(get_chain_id);
@@ -201,6 +201,8 @@ public:
                        const message_propagation_data& propagation_data,
                        const message_hash_type& message_content_hash );
    message get_message( const message_hash_type& hash_of_message_to_lookup ) const;
+   /// @return a cached transaction whose id begins with short_id, if there is one
+   fc::optional<graphene::protocol::precomputable_transaction> find_transaction( short_transaction_id short_id ) const;
    message_propagation_data get_message_propagation_data(
          const message_hash_type& hash_of_msg_contents_to_lookup ) const;
    size_t size() const { return _message_cache.size(); }
@@ -247,6 +249,7 @@ class statistics_gathering_node_delegate_wrapper : public node_delegate
                                (handle_transaction) \
                                (get_block_ids) \
                                (get_item) \
+                               (get_packed_blocks) \
                                (get_chain_id) \
                                (get_blockchain_synopsis) \
                                (sync_status) \
@@ -348,6 +351,7 @@ class statistics_gathering_node_delegate_wrapper : public node_delegate
                                              uint32_t& remaining_item_count,
                                              uint32_t limit = 2000) override;
       message get_item( const item_id& id ) override;
+      std::vector<std::vector<char>> get_packed_blocks( uint32_t first_block_num, uint32_t block_count ) override;
       graphene::protocol::chain_id_type get_chain_id() const override;
       std::vector<item_hash_t> get_blockchain_synopsis(const item_hash_t& reference_point,
                                                        uint32_t number_of_blocks_after_reference_point) override;
@@ -524,6 +528,10 @@ class node_impl : public peer_connection_delegate, public std::enable_shared_fro
       /// Cache message we have received and might be required to provide to other peers via inventory requests
       blockchain_tied_message_cache _message_cache;
 
+      mutable compact_block_stats _compact_block_stats;
+      sync_download_stats _sync_download_stats;
+      sync_upload_stats _sync_upload_stats;
+
       fc::rate_limiting_group _rate_limiter { 0, 0 };
 
       /// Number of connections last reported to the client (to avoid sending duplicate messages)
@@ -587,6 +595,12 @@ class node_impl : public peer_connection_delegate, public std::enable_shared_fro
       size_t _max_sync_blocks_to_prefetch = MAX_SYNC_BLOCKS_TO_PREFETCH;
       /// Maximum number of blocks per peer during syncing
       size_t _max_sync_blocks_per_peer = GRAPHENE_NET_MAX_BLOCKS_PER_PEER_DURING_SYNCING;
+      /// Number of consecutive blocks in each sync request sent to a peer
+      size_t _sync_blocks_per_request = GRAPHENE_NET_SYNC_BLOCKS_PER_REQUEST;
+      /// Time after which an outstanding sync request is sent again to another peer
+      fc::microseconds _sync_straggler_timeout = fc::milliseconds(GRAPHENE_NET_SYNC_STRAGGLER_TIMEOUT_MS);
+      /// Whether new blocks are sent as compact_block_message to peers supporting it
+      bool _send_compact_blocks = true;
 
       std::list<fc::future<void> > _handle_message_calls_in_progress;
 
@@ -607,6 +621,7 @@ class node_impl : public peer_connection_delegate, public std::enable_shared_fro
       void trigger_p2p_network_connect_loop();
 
       bool have_already_received_sync_item( const item_hash_t& item_hash );
+      bool is_sync_item_requested_from_other_peer( const item_hash_t& item_hash, const peer_connection* peer ) const;
       void request_sync_item_from_peer( const peer_connection_ptr& peer, const item_hash_t& item_to_request );
       void request_sync_items_from_peer( const peer_connection_ptr& peer, const std::vector<item_hash_t>& items_to_request );
       void fetch_sync_items_loop();
@@ -666,6 +681,27 @@ class node_impl : public peer_connection_delegate, public std::enable_shared_fro
       void on_fetch_items_message( peer_connection* originating_peer,
                                    const fetch_items_message& fetch_items_message_received ) const;
 
+      void on_compact_block_message( peer_connection* originating_peer,
+                                     const compact_block_message& compact_block_message_received );
+
+      void on_fetch_compact_block_transactions_message( peer_connection* originating_peer,
+                                                        const fetch_compact_block_transactions_message& request );
+
+      void on_compact_block_transactions_message( peer_connection* originating_peer,
+                                                  const compact_block_transactions_message& reply );
+
+      void on_fetch_block_range_message( peer_connection* originating_peer,
+                                         const fetch_block_range_message& request );
+
+      void on_block_range_message( peer_connection* originating_peer, const block_range_message& reply );
+
+      /// Requests the missing transactions of the block, or processes it if there are none
+      void continue_compact_block( peer_connection* originating_peer, const block_id_type& block_id );
+      /// @return a block requested from the peer that none of its pending compact blocks is counted against
+      fc::optional<item_id> find_unclaimed_block_request( peer_connection* peer ) const;
+      /// Drops compact blocks of the peer once there are more of them than blocks requested from it
+      void drop_unrequested_compact_blocks( peer_connection* peer );
+
       void on_item_not_available_message( peer_connection* originating_peer,
                                           const item_not_available_message& item_not_available_message_received );
 
@@ -702,6 +738,11 @@ class node_impl : public peer_connection_delegate, public std::enable_shared_fro
                   peer_connection* originating_peer,
                   const graphene::net::block_message& block_message,
                   const message_hash_type& message_hash);
+      /// Processes a block we requested during sync, the caller removed it from the peer's requested items
+      void process_requested_sync_block(
+                  peer_connection* originating_peer,
+                  const graphene::net::block_message& block_message,
+                  const message_hash_type& message_hash);
       void process_block_message(
                   peer_connection* originating_peer,
                   const message& message_to_process,
@@ -67,6 +67,25 @@ namespace graphene { namespace protocol {
       return signee() == expected_signee;
    }
 
+   static checksum_type merkle_root( vector<digest_type>& ids )
+   {
+      vector<digest_type>::size_type current_number_of_hashes = ids.size();
+      while( current_number_of_hashes > 1 )
+      {
+         // hash ID's in pairs
+         uint32_t i_max = current_number_of_hashes - (current_number_of_hashes&1);
+         uint32_t k = 0;
+
+         for( uint32_t i = 0; i < i_max; i += 2 )
+            ids[k++] = digest_type::hash( std::make_pair( ids[i], ids[i+1] ) );
+
+         if( current_number_of_hashes&1 )
+            ids[k++] = ids[i_max];
+         current_number_of_hashes = k;
+      }
+      return checksum_type::hash( ids[0] );
+   }
+
    const checksum_type& signed_block::calculate_merkle_root()const
    {
       static const checksum_type empty_checksum;
@@ -79,25 +98,48 @@ namespace graphene { namespace protocol {
          ids.resize( transactions.size() );
          for( uint32_t i = 0; i < transactions.size(); ++i )
             ids[i] = transactions[i].merkle_digest();
+         _calculated_merkle_root = merkle_root( ids );
+      }
+      return _calculated_merkle_root;
+   }
 
-         vector<digest_type>::size_type current_number_of_hashes = ids.size();
-         while( current_number_of_hashes > 1 )
-         {
-            // hash ID's in pairs
-            uint32_t i_max = current_number_of_hashes - (current_number_of_hashes&1);
-            uint32_t k = 0;
-
-            for( uint32_t i = 0; i < i_max; i += 2 )
-               ids[k++] = digest_type::hash( std::make_pair( ids[i], ids[i+1] ) );
-
-            if( current_number_of_hashes&1 )
-               ids[k++] = ids[i_max];
-            current_number_of_hashes = k;
-         }
-         _calculated_merkle_root = checksum_type::hash( ids[0] );
+   const checksum_type& signed_block::calculate_merkle_root( const vector<vector<char>>& packed_transactions )const
+   {
+      FC_ASSERT( packed_transactions.size() == transactions.size() );
+      static const checksum_type empty_checksum;
+      if( transactions.size() == 0 )
+         return empty_checksum;
+
+      if( !_calculated_merkle_root._hash[0].value() )
+      {
+         // merkle_digest() is the hash of the serialized transaction
+         vector<digest_type> ids;
+         ids.resize( transactions.size() );
+         for( uint32_t i = 0; i < transactions.size(); ++i )
+            ids[i] = digest_type::hash( packed_transactions[i].data(), packed_transactions[i].size() );
+         _calculated_merkle_root = merkle_root( ids );
       }
       return _calculated_merkle_root;
    }
+
+   vector<char> signed_block::pack_with_transactions( const vector<vector<char>>& packed_transactions )const
+   {
+      FC_ASSERT( packed_transactions.size() == transactions.size() );
+      // the fields of signed_block_header, then the transactions vector
+      const signed_block_header& header = *this;
+      const fc::unsigned_int count( transactions.size() );
+      size_t size = fc::raw::pack_size( header ) + fc::raw::pack_size( count );
+      for( const auto& trx : packed_transactions )
+         size += trx.size();
+
+      vector<char> packed( size );
+      fc::datastream<char*> ds( packed.data(), packed.size() );
+      fc::raw::pack( ds, header );
+      fc::raw::pack( ds, count );
+      for( const auto& trx : packed_transactions )
+         ds.write( trx.data(), trx.size() );
+      return packed;
+   }
 } }
 
 GRAPHENE_IMPLEMENT_EXTERNAL_SERIALIZATION( graphene::protocol::block_header)
@@ -60,6 +60,20 @@ namespace graphene { namespace protocol {
    {
    public:
       const checksum_type& calculate_merkle_root()const;
+      /**
+       * Same as calculate_merkle_root(), but hashes the given serialized transactions instead of serializing
+       * them again.
+       * @param packed_transactions fc::raw::pack() of each of transactions, in the same order
+       */
+      const checksum_type& calculate_merkle_root( const vector<vector<char>>& packed_transactions )const;
+
+      /**
+       * Same as fc::raw::pack() of the block, but assembles it from the given serialized transactions instead
+       * of serializing them again.
+       * @param packed_transactions fc::raw::pack() of each of transactions, in the same order
+       */
+      vector<char> pack_with_transactions( const vector<vector<char>>& packed_transactions )const;
+
       vector<processed_transaction> transactions;
    protected:
       mutable checksum_type   _calculated_merkle_root;
@@ -214,6 +214,14 @@ namespace graphene { namespace protocol {
        */
       virtual const flat_set<public_key_type>& get_signature_keys( const chain_id_type& chain_id )const;
 
+      /**
+       * @brief Stores public keys that were extracted from @ref signatures elsewhere, e.g. one per thread.
+       * @param keys The key of each signature, in the order of @ref signatures
+       * @return Public keys, as get_signature_keys() would return them
+       * @throws tx_duplicate_sig if a key signed more than once
+       */
+      const flat_set<public_key_type>& set_signature_keys( const vector<public_key_type>& keys )const;
+
       /** Signatures */
       vector<signature_type> signatures;
 
@@ -33,6 +33,8 @@
 #include <graphene/account_history/account_history_plugin.hpp>
 #include <graphene/witness/witness.hpp>
 
+#include <fc/io/fstream.hpp>
+#include <fc/io/json.hpp>
 #include <fc/thread/thread.hpp>
 #include <fc/log/appender.hpp>
 #include <fc/log/console_appender.hpp>
@@ -386,6 +388,258 @@ BOOST_AUTO_TEST_CASE( two_node_network )
    }
 }
 
+/////////////
+/// @brief relay blocks with many transactions between 2 nodes as a compact block and as a full block
+/////////////
+BOOST_AUTO_TEST_CASE( compact_block_relay )
+{
+   using namespace graphene::chain;
+   using namespace graphene::app;
+   try {
+      auto port = fc::network::get_available_port();
+      auto app1_p2p_endpoint_str = string("127.0.0.1:") + std::to_string(port);
+      auto app2_seed_nodes_str = string("[\"") + app1_p2p_endpoint_str + "\"]";
+
+      fc::temp_directory app_dir( graphene::utilities::temp_directory_path() );
+      auto genesis_file = create_genesis_file(app_dir);
+
+      graphene::app::application app1;
+      auto sharable_cfg = std::make_shared<boost::program_options::variables_map>();
+      auto& cfg = *sharable_cfg;
+      fc::set_option( cfg, "p2p-endpoint", app1_p2p_endpoint_str );
+      fc::set_option( cfg, "genesis-json", genesis_file );
+      fc::set_option( cfg, "seed-nodes", string("[]") );
+      app1.initialize(app_dir.path(), sharable_cfg);
+      app1.startup();
+
+      auto wait_time = fc::seconds(15);
+      fc::wait_for( wait_time, [&app1,port] () {
+         const auto status = app1.p2p_node()->network_get_info();
+         return status["listening_on"].as<fc::ip::endpoint>( 5 ).port() == port;
+      });
+
+      fc::temp_directory app2_dir( graphene::utilities::temp_directory_path() );
+      graphene::app::application app2;
+      auto sharable_cfg2 = std::make_shared<boost::program_options::variables_map>();
+      auto& cfg2 = *sharable_cfg2;
+      fc::set_option( cfg2, "genesis-json", genesis_file );
+      fc::set_option( cfg2, "seed-nodes", app2_seed_nodes_str );
+      app2.initialize(app2_dir.path(), sharable_cfg2);
+      app2.startup();
+
+      fc::wait_for( wait_time, [&app1] () {
+         if( app1.p2p_node()->get_connection_count() == 0 )
+            return false;
+         const auto& peer_info = app1.p2p_node()->get_connected_peers().front().info;
+         auto itr = peer_info.find( "peer_needs_sync_items_from_us" );
+         return itr != peer_info.end() && !itr->value().as<bool>(1);
+      });
+      BOOST_REQUIRE_EQUAL(app1.p2p_node()->get_connection_count(), 1u);
+
+      std::shared_ptr<chain::database> db1 = app1.chain_database();
+      std::shared_ptr<chain::database> db2 = app2.chain_database();
+
+      // the transactions reach app2 as trx_message before the block
+      account_id_type nathan_id = db1->get_index_type<account_index>().indices().get<by_name>().find( "nathan" )->id;
+      fc::ecc::private_key nathan_key = fc::ecc::private_key::regenerate(fc::sha256::hash(string("nathan")));
+      const uint32_t transfer_count = 20;
+      int64_t total_amount = 0;
+      auto broadcast_transfers = [&]( int64_t base_amount, bool claim ) {
+         for( uint32_t i = 0; i < transfer_count; ++i )
+         {
+            graphene::chain::precomputable_transaction trx;
+            if( claim && i == 0 )
+            {
+               balance_claim_operation claim_op;
+               balance_id_type bid = balance_id_type();
+               claim_op.deposit_to_account = nathan_id;
+               claim_op.balance_to_claim = bid;
+               claim_op.balance_owner_key = nathan_key.get_public_key();
+               claim_op.total_claimed = bid(*db1).balance;
+               trx.operations.push_back( claim_op );
+               db1->current_fee_schedule().set_fee( trx.operations.back() );
+            }
+            transfer_operation xfer_op;
+            xfer_op.from = nathan_id;
+            xfer_op.to = GRAPHENE_NULL_ACCOUNT;
+            xfer_op.amount = asset( base_amount + i );
+            trx.operations.push_back( xfer_op );
+            db1->current_fee_schedule().set_fee( trx.operations.back() );
+            trx.set_expiration( db1->get_slot_time( 10 ) );
+            trx.sign( nathan_key, db1->get_chain_id() );
+            db1->push_transaction( trx );
+            app1.p2p_node()->broadcast( graphene::net::trx_message( trx ) );
+            total_amount += base_amount + i;
+         }
+         fc::wait_for( wait_time, [db2,&total_amount] () {
+            return db2->get_balance( GRAPHENE_NULL_ACCOUNT, asset_id_type() ).amount.value == total_amount;
+         });
+         BOOST_REQUIRE_EQUAL( db2->get_balance( GRAPHENE_NULL_ACCOUNT, asset_id_type() ).amount.value, total_amount );
+      };
+
+      // app2 produces a block of the transfers and relays it to app1, returns how long that took
+      fc::ecc::private_key committee_key = fc::ecc::private_key::regenerate(fc::sha256::hash(string("nathan")));
+      auto relay_block = [&]( signed_block& block ) -> fc::microseconds {
+         fc::wait_for( wait_time, [db2] () {
+            return db2->get_slot_time(1) <= fc::time_point::now();
+         });
+         block = db2->generate_block( db2->get_slot_time(1), db2->get_scheduled_witness(1), committee_key,
+                                      database::skip_nothing );
+         BOOST_REQUIRE_EQUAL( block.transactions.size(), transfer_count );
+         const uint32_t block_num = block.block_num();
+         const fc::time_point broadcast_time = fc::time_point::now();
+         app2.p2p_node()->broadcast( graphene::net::block_message( block ) );
+         fc::wait_for( wait_time, [db1,block_num] () {
+            return db1->head_block_num() == block_num;
+         });
+         const fc::microseconds propagation_time = fc::time_point::now() - broadcast_time;
+         BOOST_REQUIRE_EQUAL( db1->head_block_num(), block_num );
+         BOOST_CHECK( db1->head_block_id() == block.id() );
+         BOOST_CHECK_EQUAL( app1.p2p_node()->get_connection_count(), 1u );
+         return propagation_time;
+      };
+
+      broadcast_transfers( 1000, true );
+      signed_block compact_block;
+      const fc::microseconds compact_time = relay_block( compact_block );
+
+      // the same number of transfers, relayed as a full block
+      app2.p2p_node()->set_advanced_node_parameters( fc::mutable_variant_object()( "send_compact_blocks", false ) );
+      broadcast_transfers( 2000, false );
+      signed_block full_block;
+      const fc::microseconds full_time = relay_block( full_block );
+
+      const auto sent = app2.p2p_node()->network_get_usage_stats()["compact_blocks"]
+                           .as<graphene::net::compact_block_stats>( 1 );
+      const auto received = app1.p2p_node()->network_get_usage_stats()["compact_blocks"]
+                               .as<graphene::net::compact_block_stats>( 1 );
+      BOOST_CHECK_EQUAL( sent.blocks_sent, 1u );
+      BOOST_CHECK_EQUAL( received.blocks_received, 1u );
+      BOOST_CHECK_EQUAL( received.blocks_complete, 1u );
+      BOOST_CHECK_EQUAL( received.transactions_fetched, 0u );
+      BOOST_CHECK_EQUAL( received.blocks_mismatched, 0u );
+      // both blocks are about the same size, the compact one is sent as a fraction of it
+      const uint64_t full_bytes = graphene::net::message( graphene::net::block_message( full_block ) ).size.value();
+      BOOST_CHECK_LT( sent.compact_bytes_sent * 2, sent.full_bytes_sent );
+      BOOST_CHECK_LT( sent.compact_bytes_sent * 2, full_bytes );
+      // wall-clock times on a shared test machine are too noisy to check, they are reported for comparison
+      BOOST_TEST_MESSAGE( "Relayed a block of " << compact_block.transactions.size() << " transactions as "
+                          << sent.compact_bytes_sent << " bytes in " << compact_time.count() << " us, "
+                          << "and a block of " << full_block.transactions.size() << " transactions as "
+                          << full_bytes << " bytes in " << full_time.count() << " us" );
+   } catch( fc::exception& e ) {
+      edump((e.to_detail_string()));
+      throw;
+   }
+}
+
+BOOST_AUTO_TEST_CASE( multi_peer_sync )
+{
+   using namespace graphene::chain;
+   using namespace graphene::app;
+   try {
+      const uint32_t block_count = 300;
+      fc::temp_directory app_dir( graphene::utilities::temp_directory_path() );
+      // start the chain far enough in the past to produce all blocks right away
+      auto genesis_file = create_genesis_file(app_dir);
+      {
+         std::string genesis_str;
+         fc::read_file_contents( genesis_file, genesis_str );
+         auto genesis = fc::json::from_string( genesis_str ).as<genesis_state_type>( 20 );
+         genesis.initial_timestamp -= 2 * block_count * genesis.initial_parameters.block_interval;
+         fc::json::save_to_file( genesis, fc::path( genesis_file ) );
+      }
+
+      // app1, app2 and the slow app both have the whole chain
+      std::vector<std::unique_ptr<fc::temp_directory>> dirs;
+      std::vector<std::unique_ptr<application>> apps;
+      std::string seed_nodes;
+      for( uint32_t i = 0; i < 3; ++i )
+      {
+         auto port = fc::network::get_available_port();
+         auto p2p_endpoint_str = string("127.0.0.1:") + std::to_string(port);
+         seed_nodes += ( seed_nodes.empty() ? "[\"" : ",\"" ) + p2p_endpoint_str + "\"";
+         dirs.emplace_back( new fc::temp_directory( graphene::utilities::temp_directory_path() ) );
+         apps.emplace_back( new application() );
+         auto sharable_cfg = std::make_shared<boost::program_options::variables_map>();
+         auto& cfg = *sharable_cfg;
+         fc::set_option( cfg, "p2p-endpoint", p2p_endpoint_str );
+         fc::set_option( cfg, "genesis-json", genesis_file );
+         fc::set_option( cfg, "seed-nodes", string("[]") );
+         apps.back()->initialize( dirs.back()->path(), sharable_cfg );
+         apps.back()->startup();
+         application* app = apps.back().get();
+         fc::wait_for( fc::seconds(15), [app,port] () {
+            const auto status = app->p2p_node()->network_get_info();
+            return status["listening_on"].as<fc::ip::endpoint>( 5 ).port() == port;
+         });
+      }
+      seed_nodes += "]";
+      // the slow app sends a few hundred bytes per second, blocks it is asked for are late
+      apps[2]->p2p_node()->set_total_bandwidth_limit( 500, 1000000 );
+
+      std::shared_ptr<chain::database> db1 = apps[0]->chain_database();
+      std::shared_ptr<chain::database> db2 = apps[1]->chain_database();
+      std::shared_ptr<chain::database> slow_db = apps[2]->chain_database();
+      fc::ecc::private_key committee_key = fc::ecc::private_key::regenerate(fc::sha256::hash(string("nathan")));
+      for( uint32_t i = 0; i < block_count; ++i )
+      {
+         auto block = db1->generate_block( db1->get_slot_time(1), db1->get_scheduled_witness(1), committee_key,
+                                           database::skip_nothing );
+         db2->push_block( block );
+         slow_db->push_block( block );
+      }
+      BOOST_REQUIRE_EQUAL( db2->head_block_num(), block_count );
+      BOOST_REQUIRE_EQUAL( slow_db->head_block_num(), block_count );
+      BOOST_REQUIRE( db1->get_slot_time(1) <= fc::time_point::now() );
+
+      // app3 syncs the chain from all of them
+      fc::temp_directory app3_dir( graphene::utilities::temp_directory_path() );
+      application app3;
+      auto sharable_cfg3 = std::make_shared<boost::program_options::variables_map>();
+      auto& cfg3 = *sharable_cfg3;
+      fc::set_option( cfg3, "genesis-json", genesis_file );
+      fc::set_option( cfg3, "seed-nodes", seed_nodes );
+      app3.initialize( app3_dir.path(), sharable_cfg3 );
+      const fc::time_point start_time = fc::time_point::now();
+      app3.startup();
+      app3.p2p_node()->set_advanced_node_parameters( fc::mutable_variant_object()( "sync_straggler_timeout_ms", 500 ) );
+
+      std::shared_ptr<chain::database> db3 = app3.chain_database();
+      fc::wait_for( fc::seconds(30), [db3,block_count] () {
+         return db3->head_block_num() == block_count;
+      });
+      const fc::microseconds sync_time = fc::time_point::now() - start_time;
+      BOOST_REQUIRE_EQUAL( db3->head_block_num(), block_count );
+      BOOST_CHECK( db3->head_block_id() == db1->head_block_id() );
+      BOOST_CHECK_EQUAL( app3.p2p_node()->get_connection_count(), 3u );
+
+      const auto stats = app3.p2p_node()->network_get_usage_stats()["sync_downloads"]
+                            .as<graphene::net::sync_download_stats>( 1 );
+      BOOST_CHECK_GE( stats.blocks_received, block_count );
+      BOOST_CHECK_GE( stats.blocks_requested, stats.blocks_received + stats.duplicate_blocks_received );
+      // the blocks held up by the slow app were requested from the others
+      BOOST_CHECK_GT( stats.stragglers_rerequested, 0u );
+      BOOST_CHECK_LE( stats.duplicate_blocks_received, stats.stragglers_rerequested );
+      BOOST_CHECK_LT( stats.stragglers_rerequested, stats.blocks_received );
+
+      // the peers were asked for ranges of blocks instead of single blocks
+      BOOST_CHECK_GT( stats.block_ranges_requested, 0u );
+      BOOST_CHECK_LT( stats.block_ranges_requested, stats.blocks_requested );
+      uint64_t ranges_served = 0;
+      for( const auto& app : apps )
+         ranges_served += app->p2p_node()->network_get_usage_stats()["sync_uploads"]
+                             .as<graphene::net::sync_upload_stats>( 1 ).block_ranges_served;
+      BOOST_CHECK_GT( ranges_served, 0u );
+      BOOST_CHECK_LE( ranges_served, stats.block_ranges_requested );
+      BOOST_TEST_MESSAGE( "Synced " << block_count << " blocks from 3 peers in " << sync_time.count() << " us, "
+                          << stats.stragglers_rerequested << " blocks requested again" );
+   } catch( fc::exception& e ) {
+      edump((e.to_detail_string()));
+      throw;
+   }
+}
+
 // a contrived example to test the breaking out of application_impl to a header file
 BOOST_AUTO_TEST_CASE(application_impl_breakout) {
 
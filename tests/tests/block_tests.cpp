@@ -44,6 +44,9 @@
 
 #include "../common/database_fixture.hpp"
 
+#include <chrono>
+#include <thread>
+
 using namespace graphene::chain;
 using namespace graphene::chain::test;
 
@@ -134,6 +137,116 @@ BOOST_AUTO_TEST_CASE( block_database_test )
    }
 }
 
+BOOST_AUTO_TEST_CASE( block_database_remove_test )
+{
+   try {
+      fc::temp_directory data_dir( graphene::utilities::temp_directory_path() );
+
+      block_database bdb;
+      bdb.open( data_dir.path() );
+
+      clearable_block b;
+      std::vector<block_id_type> ids;
+      for( uint32_t i = 0; i < 5; ++i )
+      {
+         if( i > 0 ) b.previous = b.id();
+         b.witness = witness_id_type(i+1);
+         b.clear();
+         bdb.store( b.id(), b );
+         ids.push_back( b.id() );
+      }
+
+      BOOST_CHECK( !bdb.contains( block_id_type() ) );
+      for( uint32_t i = 0; i < 5; ++i )
+      {
+         BOOST_CHECK( bdb.contains( ids[i] ) );
+         BOOST_CHECK( bdb.fetch_block_id( i+1 ) == ids[i] );
+      }
+      BOOST_CHECK( !bdb.fetch_by_number( 6 ).valid() );
+      BOOST_CHECK_THROW( bdb.fetch_block_id( 6 ), fc::key_not_found_exception );
+
+      bdb.remove( ids[4] );
+      BOOST_CHECK( !bdb.contains( ids[4] ) );
+      BOOST_CHECK( !bdb.fetch_optional( ids[4] ).valid() );
+      BOOST_CHECK( bdb.contains( ids[3] ) );
+
+      // the removed tail is dropped from the index on reopen
+      bdb.close();
+      bdb.open( data_dir.path() );
+      auto last_id = bdb.last_id();
+      BOOST_REQUIRE( last_id.valid() );
+      BOOST_CHECK( *last_id == ids[3] );
+      BOOST_CHECK( !bdb.contains( ids[4] ) );
+
+      // appending after the truncation is visible to readers
+      bdb.store( b.id(), b );
+      BOOST_CHECK( bdb.contains( ids[4] ) );
+      auto fetched = bdb.fetch_by_number( 5 );
+      BOOST_REQUIRE( fetched.valid() );
+      BOOST_CHECK( fetched->id() == ids[4] );
+
+   } catch (fc::exception& e) {
+      edump((e.to_detail_string()));
+      throw;
+   }
+}
+
+BOOST_AUTO_TEST_CASE( block_database_compression_test )
+{
+   try {
+      fc::temp_directory data_dir( graphene::utilities::temp_directory_path() );
+
+      block_database bdb;
+      bdb.set_compression( true );
+      bdb.open( data_dir.path() );
+
+      // enough blocks to build the dictionary and compress the rest against it
+      const uint32_t num_blocks = 1000;
+      clearable_block b;
+      std::vector<block_id_type> ids;
+      for( uint32_t i = 0; i < num_blocks; ++i )
+      {
+         if( i > 0 ) b.previous = b.id();
+         b.witness = witness_id_type(i % 10 + 1);
+         b.clear();
+         bdb.store( b.id(), b );
+         ids.push_back( b.id() );
+      }
+      BOOST_CHECK( fc::exists( data_dir.path() / "dictionary" ) );
+
+      auto check_all = [&]() {
+         for( uint32_t i = 0; i < num_blocks; ++i )
+         {
+            auto blk = bdb.fetch_by_number( i+1 );
+            BOOST_REQUIRE( blk.valid() );
+            BOOST_CHECK( blk->id() == ids[i] );
+            BOOST_CHECK( bdb.fetch_optional( ids[i] ).valid() );
+         }
+      };
+      check_all();
+
+      // compressed and uncompressed records can be mixed
+      bdb.close();
+      bdb.set_compression( false );
+      bdb.open( data_dir.path() );
+      check_all();
+      auto last = bdb.last();
+      BOOST_REQUIRE( last.valid() );
+      BOOST_CHECK( last->id() == ids.back() );
+
+      b.previous = b.id();
+      b.clear();
+      bdb.store( b.id(), b );
+      auto fetched = bdb.fetch_by_number( num_blocks + 1 );
+      BOOST_REQUIRE( fetched.valid() );
+      BOOST_CHECK( fetched->id() == b.id() );
+
+   } catch (fc::exception& e) {
+      edump((e.to_detail_string()));
+      throw;
+   }
+}
+
 BOOST_AUTO_TEST_CASE( generate_empty_blocks )
 {
    try {
@@ -193,6 +306,175 @@ BOOST_AUTO_TEST_CASE( generate_empty_blocks )
    }
 }
 
+BOOST_AUTO_TEST_CASE( replay_pipeline_limits )
+{
+   try {
+      fc::temp_directory data_dir( graphene::utilities::temp_directory_path() );
+      auto init_account_priv_key = fc::ecc::private_key::regenerate(fc::sha256::hash(string("null_key")) );
+      block_id_type head_id;
+      uint32_t head_num;
+      {
+         database db;
+         db.open(data_dir.path(), make_genesis, "TEST" );
+         for( uint32_t i = 0; i < 100; ++i )
+            db.generate_block(db.get_slot_time(1), db.get_scheduled_witness(1), init_account_priv_key, database::skip_nothing);
+         head_id = db.head_block_id();
+         head_num = db.head_block_num();
+         db.close();
+      }
+      // replay everything from the block log, once with the smallest possible read-ahead
+      for( uint32_t queue_blocks : { 1u, 1000u } )
+      {
+         database db;
+         db.wipe( data_dir.path(), false );
+         db.node_properties().replay_queue_blocks = queue_blocks;
+         db.node_properties().replay_queue_bytes = queue_blocks;
+         db.open(data_dir.path(), make_genesis, "TEST" );
+         BOOST_CHECK_EQUAL( db.head_block_num(), head_num );
+         BOOST_CHECK( db.head_block_id() == head_id );
+         // the replay records its precomputation
+         BOOST_CHECK_EQUAL( db.get_precompute_stats().blocks, head_num );
+         db.close();
+      }
+   } catch (fc::exception& e) {
+      edump((e.to_detail_string()));
+      throw;
+   }
+}
+
+BOOST_AUTO_TEST_CASE( state_checkpoint_test )
+{
+   try {
+      fc::temp_directory data_dir( graphene::utilities::temp_directory_path() );
+      auto init_account_priv_key = fc::ecc::private_key::regenerate(fc::sha256::hash(string("null_key")) );
+      block_id_type head_id;
+      uint32_t head_num;
+      {
+         database db;
+         db.node_properties().state_checkpoint_interval = 10;
+         db.open(data_dir.path(), make_genesis, "TEST" );
+         for( uint32_t i = 0; i < 55; ++i )
+            db.generate_block(db.get_slot_time(1), db.get_scheduled_witness(1), init_account_priv_key, database::skip_nothing);
+         head_id = db.head_block_id();
+         head_num = db.head_block_num();
+         db.wait_for_checkpoint();
+         // no close(), as if the node had crashed
+      }
+      BOOST_REQUIRE( fc::exists( data_dir.path() / "object_database" ) );
+      BOOST_CHECK( !fc::exists( data_dir.path() / "object_database.tmp" ) );
+      {
+         database db;
+         db.open(data_dir.path(), make_genesis, "TEST" );
+         BOOST_CHECK_EQUAL( db.head_block_num(), head_num );
+         BOOST_CHECK( db.head_block_id() == head_id );
+         db.generate_block(db.get_slot_time(1), db.get_scheduled_witness(1), init_account_priv_key, database::skip_nothing);
+         db.close();
+      }
+   } catch (fc::exception& e) {
+      edump((e.to_detail_string()));
+      throw;
+   }
+}
+
+BOOST_AUTO_TEST_CASE( state_hash_replay_test )
+{
+   try {
+      fc::temp_directory data_dir1( graphene::utilities::temp_directory_path() );
+      fc::temp_directory data_dir2( graphene::utilities::temp_directory_path() );
+      auto init_account_priv_key = fc::ecc::private_key::regenerate(fc::sha256::hash(string("null_key")) );
+      fc::sha256 head_hash;
+      {
+         database db1;
+         db1.node_properties().track_state_hash = true;
+         db1.open(data_dir1.path(), make_genesis, "TEST" );
+         database db2;
+         db2.node_properties().track_state_hash = true;
+         db2.open(data_dir2.path(), make_genesis, "TEST" );
+         BOOST_REQUIRE( db1.head_state_hash().valid() );
+         BOOST_CHECK( *db1.head_state_hash() == *db2.head_state_hash() );
+         fc::sha256 previous = *db1.head_state_hash();
+         for( uint32_t i = 0; i < 20; ++i )
+         {
+            const signed_block b = db1.generate_block(db1.get_slot_time(1), db1.get_scheduled_witness(1),
+                                                      init_account_priv_key, database::skip_nothing);
+            db2.push_block( b );
+            BOOST_REQUIRE( db1.head_state_hash().valid() && db2.head_state_hash().valid() );
+            BOOST_CHECK( *db1.head_state_hash() == *db2.head_state_hash() );
+            BOOST_CHECK( *db1.head_state_hash() != previous );
+            previous = *db1.head_state_hash();
+         }
+         db2.pop_block();
+         BOOST_CHECK( *db2.head_state_hash() != *db1.head_state_hash() );
+         db2.push_block( *db1.fetch_block_by_number( db1.head_block_num() ) );
+         BOOST_CHECK( *db2.head_state_hash() == *db1.head_state_hash() );
+         head_hash = *db1.head_state_hash();
+         db1.close();
+      }
+      {
+         // replays the blocks since the last flush
+         database db;
+         db.node_properties().track_state_hash = true;
+         db.open(data_dir1.path(), make_genesis, "TEST" );
+         BOOST_REQUIRE( db.head_state_hash().valid() );
+         BOOST_CHECK( *db.head_state_hash() == head_hash );
+         db.close();
+      }
+      {
+         database db;
+         db.open(data_dir1.path(), make_genesis, "TEST" );
+         BOOST_CHECK( !db.head_state_hash().valid() );
+         db.close();
+      }
+   } catch (fc::exception& e) {
+      edump((e.to_detail_string()));
+      throw;
+   }
+}
+
+BOOST_AUTO_TEST_CASE( state_checkpoint_while_applying_blocks )
+{
+   try {
+      fc::temp_directory data_dir( graphene::utilities::temp_directory_path() );
+      auto init_account_priv_key = fc::ecc::private_key::regenerate(fc::sha256::hash(string("null_key")) );
+      block_id_type head_id;
+      fc::sha256 state_hash;
+      {
+         database db;
+         db.open(data_dir.path(), make_genesis, "TEST" );
+         for( uint32_t i = 0; i < 20; ++i )
+            db.generate_block(db.get_slot_time(1), db.get_scheduled_witness(1), init_account_priv_key, database::skip_nothing);
+         BOOST_REQUIRE( db.start_checkpoint() );
+         // the checkpoint is serialized one chunk at a time whenever the chain thread yields
+         for( uint32_t i = 0; i < 100; ++i )
+         {
+            db.generate_block(db.get_slot_time(1), db.get_scheduled_witness(1), init_account_priv_key, database::skip_nothing);
+            if( i == 0 )
+               BOOST_CHECK( !db.start_checkpoint() );
+            fc::yield();
+         }
+         db.wait_for_checkpoint();
+         head_id = db.head_block_id();
+         db.enable_state_hash();
+         state_hash = db.get_state_hash();
+         // no close(), as if the node had crashed
+      }
+      BOOST_REQUIRE( fc::exists( data_dir.path() / "object_database" ) );
+      BOOST_CHECK( !fc::exists( data_dir.path() / "object_database.tmp" ) );
+      {
+         database db;
+         db.open(data_dir.path(), make_genesis, "TEST" );
+         BOOST_CHECK( db.head_block_id() == head_id );
+         db.enable_state_hash();
+         BOOST_CHECK( db.get_state_hash() == state_hash );
+         db.generate_block(db.get_slot_time(1), db.get_scheduled_witness(1), init_account_priv_key, database::skip_nothing);
+         db.close();
+      }
+   } catch (fc::exception& e) {
+      edump((e.to_detail_string()));
+      throw;
+   }
+}
+
 BOOST_AUTO_TEST_CASE( undo_block )
 {
    try {
@@ -689,6 +971,169 @@ BOOST_AUTO_TEST_CASE( switch_forks_undo_create )
    }
 }
 
+BOOST_AUTO_TEST_CASE( switch_back_to_fork_from_cached_changes )
+{
+   try {
+      fc::temp_directory dir1( graphene::utilities::temp_directory_path() ),
+                         dir2( graphene::utilities::temp_directory_path() ),
+                         dir3( graphene::utilities::temp_directory_path() );
+      database db1,
+               db2,
+               db3;
+      db1.node_properties().track_state_hash = true;
+      db1.node_properties().cache_block_changes = true;
+      db3.node_properties().track_state_hash = true;
+      db1.open(dir1.path(), make_genesis, "TEST");
+      db2.open(dir2.path(), make_genesis, "TEST");
+      db3.open(dir3.path(), make_genesis, "TEST");
+
+      auto init_account_priv_key  = fc::ecc::private_key::regenerate(fc::sha256::hash(string("null_key")) );
+      public_key_type init_account_pub_key  = init_account_priv_key.get_public_key();
+
+      signed_transaction trx;
+      set_expiration( db1, trx );
+      account_id_type nathan_id = db1.get_index(protocol_ids, account_object_type).get_next_id();
+      account_create_operation cop;
+      cop.registrar = GRAPHENE_TEMP_ACCOUNT;
+      cop.name = "nathan";
+      cop.owner = authority(1, init_account_pub_key, 1);
+      cop.active = cop.owner;
+      trx.operations.push_back(cop);
+      PUSH_TX( db1, trx );
+
+      // db1 : A1 A2, then B1 B2 B3, then A1 A2 A3 A4
+      // db2 : B1 B2 B3
+      // db3 : A1 A2 A3 A4
+      for( uint32_t i = 0; i < 2; ++i )
+         db3.push_block( db1.generate_block(db1.get_slot_time(1), db1.get_scheduled_witness(1),
+                                            init_account_priv_key, database::skip_nothing) );
+      BOOST_CHECK(nathan_id(db1).name == "nathan");
+      for( uint32_t i = 0; i < 3; ++i )
+         db1.push_block( db2.generate_block(db2.get_slot_time(1), db2.get_scheduled_witness(1),
+                                            init_account_priv_key, database::skip_nothing) );
+      BOOST_CHECK_EQUAL( db1.head_block_id().str(), db2.head_block_id().str() );
+      db1.clear_pending();
+      GRAPHENE_REQUIRE_THROW(nathan_id(db1), fc::exception);
+      BOOST_CHECK_EQUAL( db1.get_redone_fork_block_count(), 0u );
+
+      for( uint32_t i = 0; i < 2; ++i )
+         db1.push_block( db3.generate_block(db3.get_slot_time(1), db3.get_scheduled_witness(1),
+                                            init_account_priv_key, database::skip_nothing) );
+      BOOST_CHECK_EQUAL( db1.head_block_id().str(), db3.head_block_id().str() );
+      // A1 and A2 were applied from the changes kept when db1 produced them
+      BOOST_CHECK_EQUAL( db1.get_redone_fork_block_count(), 2u );
+      BOOST_CHECK(nathan_id(db1).name == "nathan");
+      BOOST_REQUIRE( db1.head_state_hash().valid() && db3.head_state_hash().valid() );
+      BOOST_CHECK( *db1.head_state_hash() == *db3.head_state_hash() );
+
+      // the blocks still apply on top of the restored state
+      db3.push_block( db1.generate_block(db1.get_slot_time(1), db1.get_scheduled_witness(1),
+                                         init_account_priv_key, database::skip_nothing) );
+      BOOST_CHECK( *db1.head_state_hash() == *db3.head_state_hash() );
+   } catch (fc::exception& e) {
+      edump((e.to_detail_string()));
+      throw;
+   }
+}
+
+BOOST_AUTO_TEST_CASE( fork_db_compact_blocks )
+{
+   try {
+      fc::temp_directory dir1( graphene::utilities::temp_directory_path() ),
+                         dir2( graphene::utilities::temp_directory_path() );
+      database db1,
+               db2;
+      db1.node_properties().fork_db_full_blocks = 2;
+      db1.open(dir1.path(), make_genesis, "TEST");
+      db2.open(dir2.path(), make_genesis, "TEST");
+
+      auto init_account_priv_key  = fc::ecc::private_key::regenerate(fc::sha256::hash(string("null_key")) );
+      public_key_type init_account_pub_key  = init_account_priv_key.get_public_key();
+
+      signed_transaction trx;
+      set_expiration( db1, trx );
+      account_id_type nathan_id = db1.get_index(protocol_ids, account_object_type).get_next_id();
+      account_create_operation cop;
+      cop.registrar = GRAPHENE_TEMP_ACCOUNT;
+      cop.name = "nathan";
+      cop.owner = authority(1, init_account_pub_key, 1);
+      cop.active = cop.owner;
+      trx.operations.push_back(cop);
+      PUSH_TX( db1, trx );
+
+      const signed_block first = db1.generate_block(db1.get_slot_time(1), db1.get_scheduled_witness(1),
+                                                    init_account_priv_key, database::skip_nothing);
+      BOOST_REQUIRE_EQUAL( first.transactions.size(), 1u );
+      const auto full_usage = db1.get_fork_database_memory_usage();
+      BOOST_CHECK_EQUAL( full_usage.compact_blocks, 0u );
+      BOOST_CHECK_GT( full_usage.block_bytes, 0u );
+      for( uint32_t i = 0; i < 4; ++i )
+         db1.generate_block(db1.get_slot_time(1), db1.get_scheduled_witness(1),
+                            init_account_priv_key, database::skip_nothing);
+
+      // the head block and the 2 before it are held in full
+      const auto usage = db1.get_fork_database_memory_usage();
+      BOOST_CHECK_EQUAL( usage.blocks, 5u );
+      BOOST_CHECK_EQUAL( usage.compact_blocks, 2u );
+      BOOST_CHECK_GE( usage.total_bytes, usage.block_bytes + usage.scheduled_witness_bytes );
+
+      // compact blocks are returned with their transactions
+      optional<signed_block> fetched = db1.fetch_block_by_number( 1 );
+      BOOST_REQUIRE( fetched.valid() );
+      BOOST_CHECK( fetched->id() == first.id() );
+      BOOST_REQUIRE_EQUAL( fetched->transactions.size(), 1u );
+      BOOST_CHECK( fetched->transactions[0].id() == first.transactions[0].id() );
+
+      // switching to a longer fork pops compact blocks, their transactions become pending again
+      for( uint32_t i = 0; i < 6; ++i )
+         db1.push_block( db2.generate_block(db2.get_slot_time(1), db2.get_scheduled_witness(1),
+                                            init_account_priv_key, database::skip_nothing) );
+      BOOST_CHECK_EQUAL( db1.head_block_id().str(), db2.head_block_id().str() );
+      BOOST_CHECK(nathan_id(db1).name == "nathan");
+      GRAPHENE_REQUIRE_THROW(nathan_id(db2), fc::exception);
+   } catch (fc::exception& e) {
+      edump((e.to_detail_string()));
+      throw;
+   }
+}
+
+BOOST_AUTO_TEST_CASE( fetch_packed_block_range )
+{
+   try {
+      fc::temp_directory dir1( graphene::utilities::temp_directory_path() ),
+                         dir2( graphene::utilities::temp_directory_path() );
+      database db1,
+               db2;
+      db1.open(dir1.path(), make_genesis, "TEST");
+      db2.open(dir2.path(), make_genesis, "TEST");
+
+      auto init_account_priv_key  = fc::ecc::private_key::regenerate(fc::sha256::hash(string("null_key")) );
+      for( uint32_t i = 0; i < 5; ++i )
+         db1.generate_block(db1.get_slot_time(1), db1.get_scheduled_witness(1),
+                            init_account_priv_key, database::skip_nothing);
+
+      auto packed_blocks = db1.fetch_packed_blocks_by_number( 2, 3 );
+      BOOST_REQUIRE_EQUAL( packed_blocks.size(), 3u );
+      db2.push_block( *db1.fetch_block_by_number( 1 ) );
+      for( uint32_t i = 0; i < packed_blocks.size(); ++i )
+      {
+         auto block = fc::raw::unpack<signed_block>( packed_blocks[i] );
+         BOOST_CHECK( block.id() == db1.get_block_id_for_num( 2 + i ) );
+         db2.push_block( block );
+      }
+      BOOST_CHECK( db2.head_block_id() == db1.get_block_id_for_num( 4 ) );
+
+      // the range ends at the head block
+      BOOST_CHECK_EQUAL( db1.fetch_packed_blocks_by_number( 4, 10 ).size(), 2u );
+      BOOST_CHECK( db1.fetch_packed_blocks_by_number( 6, 10 ).empty() );
+      BOOST_CHECK( db1.fetch_packed_blocks_by_number( 0, 10 ).empty() );
+      BOOST_CHECK( db1.fetch_packed_blocks_by_number( 1, 0 ).empty() );
+   } catch (fc::exception& e) {
+      edump((e.to_detail_string()));
+      throw;
+   }
+}
+
 BOOST_AUTO_TEST_CASE( duplicate_transactions )
 {
    try {
@@ -1348,6 +1793,553 @@ BOOST_FIXTURE_TEST_CASE( transaction_invalidated_in_cache, database_fixture )
    }
 }
 
+BOOST_FIXTURE_TEST_CASE( parallel_authority_checks, database_fixture )
+{
+   try
+   {
+      ACTORS( (alice)(bob) );
+      transfer( account_id_type(), alice_id, asset( 10000 ) );
+
+      auto generate_block = [&]( database& d, uint32_t skip ) -> signed_block
+      {
+         return d.generate_block(d.get_slot_time(1), d.get_scheduled_witness(1), init_account_priv_key, skip);
+      };
+
+      // tx's created by ACTORS() have bogus authority
+      generate_block(db, database::skip_transaction_signatures);
+
+      // db2 checks authorities in parallel, db3 does not, both apply the same blocks
+      std::string genesis_json;
+      fc::read_file_contents( data_dir.path() / "genesis.json", genesis_json );
+      genesis_state_type genesis = fc::json::from_string( genesis_json ).as<genesis_state_type>( 50 );
+      genesis.initial_chain_id = fc::sha256::hash( genesis_json );
+      fc::temp_directory data_dir2( graphene::utilities::temp_directory_path() );
+      fc::temp_directory data_dir3( graphene::utilities::temp_directory_path() );
+      database db2;
+      database db3;
+      for( auto replica : { std::make_pair( &db2, &data_dir2 ), std::make_pair( &db3, &data_dir3 ) } )
+      {
+         database& d = *replica.first;
+         d.open( replica.second->path(), [&genesis] () { return genesis; }, "TEST" );
+         while( d.head_block_num() < db.head_block_num() )
+         {
+            optional< signed_block > b = db.fetch_block_by_number( d.head_block_num()+1 );
+            d.push_block(*b, database::skip_witness_signature
+                            |database::skip_transaction_signatures );
+         }
+         d.enable_state_hash();
+      }
+      db2.node_properties().parallel_authority_checks = true;
+      db3.node_properties().parallel_authority_checks = false;
+      BOOST_REQUIRE( db2.get_state_hash() == db3.get_state_hash() );
+
+      const fc::ecc::private_key new_key = generate_private_key( "alice_new" );
+      auto update_active = [&]( const fc::ecc::private_key& to, const fc::ecc::private_key& signer )
+      {
+         signed_transaction tx;
+         account_update_operation op;
+         op.account = alice_id;
+         op.active = authority( 1, public_key_type( to.get_public_key() ), 1 );
+         tx.operations.push_back( op );
+         tx.set_expiration( db.head_block_time() + 300 );
+         sign( tx, signer );
+         return tx;
+      };
+      auto generate_xfer_tx = [&]( share_type amount, const fc::ecc::private_key& signer )
+      {
+         signed_transaction tx;
+         transfer_operation xfer_op;
+         xfer_op.from = alice_id;
+         xfer_op.to = bob_id;
+         xfer_op.amount = asset( amount, asset_id_type() );
+         tx.operations.push_back( xfer_op );
+         tx.set_expiration( db.head_block_time() + 300 );
+         sign( tx, signer );
+         return tx;
+      };
+      // the transfer fails the check against the state at the start of the block, but passes when applied
+      PUSH_TX( db, update_active( new_key, alice_private_key ) );
+      PUSH_TX( db, generate_xfer_tx( 100, new_key ) );
+      const signed_block good_block = generate_block( db, database::skip_nothing );
+      db2.push_block( good_block, database::skip_witness_signature );
+      db3.push_block( good_block, database::skip_witness_signature );
+      BOOST_CHECK( db2.head_block_id() == db.head_block_id() );
+      BOOST_CHECK( db3.head_block_id() == db.head_block_id() );
+      BOOST_CHECK_EQUAL( db2.get_balance( bob_id, asset_id_type() ).amount.value, 100 );
+      BOOST_CHECK( db2.get_state_hash() == db3.get_state_hash() );
+
+      // the transfer passes the check against the state at the start of the block, but not when applied
+      PUSH_TX( db, update_active( alice_private_key, new_key ) );
+      PUSH_TX( db, generate_xfer_tx( 200, new_key ), database::skip_transaction_signatures );
+      const signed_block bad_block = generate_block( db, database::skip_transaction_signatures );
+      BOOST_CHECK_EQUAL( db.get_balance( bob_id, asset_id_type() ).amount.value, 300 );
+      GRAPHENE_REQUIRE_THROW( db2.push_block( bad_block, database::skip_witness_signature ), fc::exception );
+      GRAPHENE_REQUIRE_THROW( db3.push_block( bad_block, database::skip_witness_signature ), fc::exception );
+      BOOST_CHECK_EQUAL( db2.head_block_num() + 1, db.head_block_num() );
+      BOOST_CHECK_EQUAL( db2.get_balance( bob_id, asset_id_type() ).amount.value, 100 );
+      BOOST_CHECK( db2.get_state_hash() == db3.get_state_hash() );
+   }
+   catch (fc::exception& e)
+   {
+      edump((e.to_detail_string()));
+      throw;
+   }
+}
+
+BOOST_FIXTURE_TEST_CASE( authority_cache, database_fixture )
+{
+   try
+   {
+      ACTORS( (alice)(bob) );
+      transfer( account_id_type(), alice_id, asset( 10000 ) );
+      generate_block( database::skip_transaction_signatures );
+
+      signed_transaction xfer_tx;
+      transfer_operation xfer_op;
+      xfer_op.from = alice_id;
+      xfer_op.to = bob_id;
+      xfer_op.amount = asset( 100 );
+      xfer_tx.operations.push_back( xfer_op );
+      xfer_tx.set_expiration( db.head_block_time() + 300 );
+      sign( xfer_tx, alice_private_key );
+
+      // verified when pushed, then found in the cache
+      PUSH_TX( db, xfer_tx );
+      db.clear_pending();
+      PUSH_TX( db, xfer_tx );
+      db.clear_pending();
+
+      // same transaction id, other signatures
+      signed_transaction extra_sig_tx = xfer_tx;
+      sign( extra_sig_tx, bob_private_key );
+      GRAPHENE_REQUIRE_THROW( PUSH_TX( db, extra_sig_tx ), fc::exception );
+
+      // a change of the authorities of the account invalidates the cached check
+      const fc::ecc::private_key new_key = generate_private_key( "alice_new" );
+      {
+         signed_transaction tx;
+         account_update_operation op;
+         op.account = alice_id;
+         op.active = authority( 1, public_key_type( new_key.get_public_key() ), 1 );
+         tx.operations.push_back( op );
+         tx.set_expiration( db.head_block_time() + 300 );
+         sign( tx, alice_private_key );
+         PUSH_TX( db, tx );
+      }
+      GRAPHENE_REQUIRE_THROW( PUSH_TX( db, xfer_tx ), fc::exception );
+      BOOST_CHECK_EQUAL( db.get_balance( bob_id, asset_id_type() ).amount.value, 0 );
+
+      // undoing the change invalidates it as well
+      db.clear_pending();
+      PUSH_TX( db, xfer_tx );
+      BOOST_CHECK_EQUAL( db.get_balance( bob_id, asset_id_type() ).amount.value, 100 );
+      generate_block();
+      BOOST_CHECK_EQUAL( db.get_balance( bob_id, asset_id_type() ).amount.value, 100 );
+   }
+   catch (fc::exception& e)
+   {
+      edump((e.to_detail_string()));
+      throw;
+   }
+}
+
+BOOST_FIXTURE_TEST_CASE( pending_transactions_after_block, database_fixture )
+{
+   try
+   {
+      ACTORS( (alice)(bob)(carol)(dan) );
+      transfer( account_id_type(), alice_id, asset( 10000 ) );
+      transfer( account_id_type(), carol_id, asset( 10000 ) );
+      generate_block();
+      // with the dupe check, so that included transactions are known
+      const uint32_t skip = database::skip_nothing;
+
+      auto make_transfer = [this]( account_id_type from, account_id_type to, int64_t amount,
+                                   const fc::ecc::private_key& key ) {
+         signed_transaction tx;
+         transfer_operation op;
+         op.from = from;
+         op.to = to;
+         op.amount = asset( amount );
+         tx.operations.push_back( op );
+         tx.set_expiration( db.head_block_time() + 300 );
+         sign( tx, key );
+         return tx;
+      };
+
+      // a block that changes the active key of alice, received from the network later on
+      const fc::ecc::private_key new_key = generate_private_key( "alice_new" );
+      {
+         signed_transaction tx;
+         account_update_operation op;
+         op.account = alice_id;
+         op.active = authority( 1, public_key_type( new_key.get_public_key() ), 1 );
+         tx.operations.push_back( op );
+         tx.set_expiration( db.head_block_time() + 300 );
+         sign( tx, alice_private_key );
+         PUSH_TX( db, tx );
+      }
+      const signed_transaction carol_tx = make_transfer( carol_id, dan_id, 100, carol_private_key );
+      PUSH_TX( db, carol_tx );
+      const signed_block blk = generate_block( skip );
+      db.clear_pending();
+      db.pop_block();
+
+      // the transfer of alice only reads the account that the block modifies, it fails when applied again
+      PUSH_TX( db, make_transfer( alice_id, bob_id, 100, alice_private_key ) );
+      PUSH_TX( db, make_transfer( carol_id, bob_id, 50, carol_private_key ) );
+      PUSH_TX( db, carol_tx );
+      BOOST_CHECK_EQUAL( get_balance( bob_id, asset_id_type() ), 150 );
+      PUSH_BLOCK( db, blk, skip );
+      BOOST_CHECK_EQUAL( db.get_pending_reapply_stats().included, 1u );
+      BOOST_CHECK_EQUAL( db.get_pending_reapply_stats().reapplied, 1u );
+      BOOST_CHECK_EQUAL( db.get_pending_reapply_stats().failed, 1u );
+      BOOST_CHECK_EQUAL( db.get_pending_transaction_pool().size(), 1u );
+      BOOST_CHECK_EQUAL( db.get_pending_transaction_pool().unapplied_count(), 0u );
+      // the pending state is up to date right after the block
+      BOOST_CHECK_EQUAL( get_balance( bob_id, asset_id_type() ), 50 );
+      BOOST_CHECK_EQUAL( get_balance( dan_id, asset_id_type() ), 100 );
+
+      // block production includes the remaining one, it is dropped as included afterwards
+      generate_block( skip );
+      BOOST_CHECK_EQUAL( db.fetch_block_by_number( db.head_block_num() )->transactions.size(), 1u );
+      BOOST_CHECK_EQUAL( db.get_pending_reapply_stats().included, 1u );
+      BOOST_CHECK_EQUAL( db.get_pending_reapply_stats().reapplied, 0u );
+      BOOST_CHECK( db.get_pending_transaction_pool().empty() );
+      BOOST_CHECK_EQUAL( get_balance( bob_id, asset_id_type() ), 50 );
+
+      // transactions of a popped block are applied again after the next block
+      PUSH_TX( db, make_transfer( carol_id, dan_id, 10, carol_private_key ) );
+      generate_block( skip );
+      db.pop_block();
+      BOOST_CHECK_EQUAL( get_balance( dan_id, asset_id_type() ), 100 );
+      PUSH_TX( db, make_transfer( carol_id, bob_id, 20, carol_private_key ) );
+      generate_block( skip );
+      BOOST_CHECK_EQUAL( db.get_pending_reapply_stats().included, 1u );
+      BOOST_CHECK_EQUAL( db.get_pending_reapply_stats().reapplied, 1u );
+      BOOST_CHECK_EQUAL( get_balance( dan_id, asset_id_type() ), 110 );
+      BOOST_CHECK_EQUAL( get_balance( bob_id, asset_id_type() ), 70 );
+      generate_block( skip );
+      BOOST_CHECK( db.get_pending_transaction_pool().empty() );
+   }
+   catch (fc::exception& e)
+   {
+      edump((e.to_detail_string()));
+      throw;
+   }
+}
+
+BOOST_AUTO_TEST_CASE( pending_transaction_pool_eviction )
+{
+   try
+   {
+      auto make_entry = []( uint16_t n, share_type fee, uint32_t packed_size, bool applied = false ) {
+         pending_transaction entry;
+         entry.trx.ref_block_num = n;
+         entry.id = entry.trx.id();
+         entry.fee = fee;
+         entry.packed_size = packed_size;
+         entry.fee_rate = pending_transaction_pool::fee_rate( fee, packed_size );
+         entry.expiration = fc::time_point_sec( 1000 + n );
+         entry.applied = applied;
+         return entry;
+      };
+      auto fees_by_rate = []( const pending_transaction_pool& pool ) {
+         vector<int64_t> fees;
+         for( const auto& entry : pool.indices().get<pending_transaction_pool::by_fee_rate>() )
+            fees.push_back( entry.fee.value );
+         return fees;
+      };
+
+      // transactions outside of the pending state are evicted
+      pending_transaction_pool pool;
+      pool.set_max_bytes( 3000 );
+      pool.add( make_entry( 1, 100, 1000 ) );
+      pool.add( make_entry( 2, 300, 1000 ) );
+      pool.add( make_entry( 3, 200, 1000 ) );
+      BOOST_CHECK_EQUAL( pool.total_bytes(), 3000u );
+      BOOST_CHECK( fees_by_rate( pool ) == vector<int64_t>({ 300, 200, 100 }) );
+
+      // a transaction paying less than all others is not accepted
+      BOOST_CHECK( !pool.can_accept( 1000, pending_transaction_pool::fee_rate( 50, 1000 ) ) );
+      // one paying more replaces the one paying least
+      pending_transaction better = make_entry( 4, 150, 1000 );
+      BOOST_CHECK( pool.can_accept( better.packed_size, better.fee_rate ) );
+      vector<pending_transaction> evicted = pool.add( std::move(better) );
+      BOOST_REQUIRE_EQUAL( evicted.size(), 1u );
+      BOOST_CHECK_EQUAL( evicted[0].fee.value, 100 );
+      BOOST_CHECK( fees_by_rate( pool ) == vector<int64_t>({ 300, 200, 150 }) );
+      BOOST_CHECK_EQUAL( pool.total_bytes(), 3000u );
+
+      // the oldest one goes when evicting by age
+      pool.set_eviction_policy( pending_transaction_pool::evict_oldest );
+      BOOST_CHECK( pool.can_accept( 1000, 0 ) );
+      evicted = pool.add( make_entry( 5, 10, 1000 ) );
+      BOOST_REQUIRE_EQUAL( evicted.size(), 1u );
+      BOOST_CHECK_EQUAL( evicted[0].fee.value, 300 );
+      BOOST_CHECK( !pool.can_accept( 4000, 0 ) );
+
+      // transactions in the pending state are evicted as well, they are known until it is discarded
+      pending_transaction_pool full;
+      full.set_max_bytes( 2000 );
+      full.add( make_entry( 7, 100, 1000, true ) );
+      full.add( make_entry( 8, 200, 1000, true ) );
+      BOOST_CHECK( !full.can_accept( 1000, pending_transaction_pool::fee_rate( 50, 1000 ) ) );
+      BOOST_CHECK( full.can_accept( 1000, pending_transaction_pool::fee_rate( 1000, 1000 ) ) );
+      evicted = full.add( make_entry( 9, 1000, 1000, true ) );
+      BOOST_REQUIRE_EQUAL( evicted.size(), 1u );
+      BOOST_CHECK_EQUAL( evicted[0].fee.value, 100 );
+      BOOST_CHECK_EQUAL( full.size(), 2u );
+      BOOST_CHECK_EQUAL( full.total_bytes(), 2000u );
+      BOOST_CHECK_EQUAL( full.evicted_applied_count(), 1u );
+      BOOST_CHECK( full.find( evicted[0].id ) == nullptr );
+      BOOST_CHECK( full.contains( evicted[0].id ) );
+      full.set_none_applied();
+      BOOST_CHECK_EQUAL( full.evicted_applied_count(), 0u );
+      BOOST_CHECK( !full.contains( evicted[0].id ) );
+      BOOST_CHECK_EQUAL( full.unapplied_count(), 2u );
+
+      // transactions outside of the pending state are counted
+      pool.set_max_bytes( 0 );
+      pool.add( make_entry( 6, 0, 100, true ) );
+      BOOST_CHECK_EQUAL( pool.unapplied_count(), 3u );
+      pool.set_none_applied();
+      BOOST_CHECK_EQUAL( pool.unapplied_count(), pool.size() );
+
+      BOOST_CHECK_EQUAL( pool.remove_expired( fc::time_point_sec( 1004 ) ), 1u );
+      BOOST_CHECK_EQUAL( pool.size(), 3u );
+      BOOST_CHECK_EQUAL( pool.total_bytes(), 2100u );
+      BOOST_CHECK( pool.remove( make_entry( 6, 0, 100 ).id ).valid() );
+      BOOST_CHECK_EQUAL( pool.unapplied_count(), pool.size() );
+   }
+   catch (fc::exception& e)
+   {
+      edump((e.to_detail_string()));
+      throw;
+   }
+}
+
+BOOST_FIXTURE_TEST_CASE( pending_pool_block_production, database_fixture )
+{
+   try
+   {
+      ACTORS( (alice)(bob)(carol)(dan)(eve) );
+      transfer( account_id_type(), alice_id, asset( 100000 ) );
+      transfer( account_id_type(), bob_id, asset( 100000 ) );
+      transfer( account_id_type(), carol_id, asset( 100000 ) );
+      generate_block();
+
+      auto make_transfer = [this]( account_id_type from, account_id_type to, int64_t amount, int64_t fee,
+                                   const fc::ecc::private_key& key ) {
+         signed_transaction tx;
+         transfer_operation op;
+         op.from = from;
+         op.to = to;
+         op.amount = asset( amount );
+         op.fee = asset( fee );
+         tx.operations.push_back( op );
+         tx.set_expiration( db.head_block_time() + 300 );
+         sign( tx, key );
+         return tx;
+      };
+      auto senders = [this]() {
+         vector<account_id_type> result;
+         for( const auto& tx : db.fetch_block_by_number( db.head_block_num() )->transactions )
+            result.push_back( tx.operations[0].get<transfer_operation>().from );
+         return result;
+      };
+
+      // transactions paying more fee per byte go into the block first
+      PUSH_TX( db, make_transfer( alice_id, dan_id, 10, 1000, alice_private_key ) );
+      PUSH_TX( db, make_transfer( bob_id, dan_id, 10, 3000, bob_private_key ) );
+      PUSH_TX( db, make_transfer( carol_id, dan_id, 10, 2000, carol_private_key ) );
+      generate_block();
+      BOOST_CHECK( senders() == vector<account_id_type>({ bob_id, carol_id, alice_id }) );
+      BOOST_CHECK_EQUAL( get_balance( dan_id, asset_id_type() ), 30 );
+      BOOST_CHECK( db.get_pending_transaction_pool().empty() );
+
+      // one that depends on a transaction paying less fails first, it is tried again after that one
+      PUSH_TX( db, make_transfer( alice_id, eve_id, 5000, 100, alice_private_key ) );
+      PUSH_TX( db, make_transfer( eve_id, dan_id, 200, 1000, eve_private_key ) );
+      generate_block();
+      BOOST_CHECK( senders() == vector<account_id_type>({ alice_id, eve_id }) );
+      BOOST_CHECK_EQUAL( get_balance( eve_id, asset_id_type() ), 3800 );
+      BOOST_CHECK_EQUAL( get_balance( dan_id, asset_id_type() ), 230 );
+      BOOST_CHECK( db.get_pending_transaction_pool().empty() );
+
+      // a full pool rejects transactions paying less than all others
+      PUSH_TX( db, make_transfer( alice_id, dan_id, 1, 100, alice_private_key ) );
+      const uint64_t entry_bytes = db.get_pending_transaction_pool().total_bytes();
+      db.node_properties().pending_pool_bytes = entry_bytes * 5 / 2;
+      const signed_transaction bob_tx = make_transfer( bob_id, dan_id, 2, 100, bob_private_key );
+      PUSH_TX( db, bob_tx );
+      GRAPHENE_REQUIRE_THROW( PUSH_TX( db, make_transfer( carol_id, dan_id, 8, 50, carol_private_key ) ),
+                              fc::exception );
+      BOOST_CHECK_EQUAL( db.get_pending_transaction_pool().size(), 2u );
+
+      // one paying more evicts the newest of those paying least, which stays in the pending state until it is
+      // rebuilt for the next block
+      PUSH_TX( db, make_transfer( carol_id, dan_id, 4, 3000, carol_private_key ) );
+      BOOST_CHECK_EQUAL( db.get_pending_transaction_pool().size(), 2u );
+      BOOST_CHECK( db.get_pending_transaction_pool().find( bob_tx.id() ) == nullptr );
+      BOOST_CHECK_EQUAL( db.get_pending_transaction_pool().evicted_applied_count(), 1u );
+      BOOST_CHECK_EQUAL( get_balance( dan_id, asset_id_type() ), 237 );
+      GRAPHENE_REQUIRE_THROW( PUSH_TX( db, bob_tx ), fc::exception );
+
+      generate_block();
+      BOOST_CHECK( senders() == vector<account_id_type>({ carol_id, alice_id }) );
+      BOOST_CHECK( db.get_pending_transaction_pool().empty() );
+      BOOST_CHECK_EQUAL( db.get_pending_transaction_pool().evicted_applied_count(), 0u );
+      BOOST_CHECK_EQUAL( get_balance( dan_id, asset_id_type() ), 235 );
+      // the evicted transaction can be pushed again
+      PUSH_TX( db, bob_tx );
+      BOOST_CHECK_EQUAL( get_balance( dan_id, asset_id_type() ), 237 );
+   }
+   catch (fc::exception& e)
+   {
+      edump((e.to_detail_string()));
+      throw;
+   }
+}
+
+BOOST_FIXTURE_TEST_CASE( block_apply_timing_of_observers, database_fixture )
+{
+   try
+   {
+      ACTORS( (alice) );
+      generate_block();
+
+      // a slow observer, connected after those of the fixture
+      const size_t slow_observer = db.applied_block.num_slots();
+      boost::signals2::scoped_connection connection = db.applied_block.connect( []( const signed_block& ) {
+         std::this_thread::sleep_for( std::chrono::milliseconds( 20 ) );
+      });
+
+      transfer( account_id_type(), alice_id, asset( 1000 ) );
+      const signed_block block = generate_block();
+
+      const block_apply_timing& timing = db.get_block_apply_timing();
+      BOOST_CHECK_EQUAL( timing.block_num, block.block_num() );
+      BOOST_CHECK_EQUAL( timing.transactions, 1u );
+      BOOST_REQUIRE_EQUAL( timing.applied_block_observers_usec.size(), slow_observer + 1 );
+      BOOST_CHECK_GE( timing.applied_block_observers_usec[slow_observer], 20000u );
+      BOOST_CHECK_GE( timing.applied_block_usec, timing.applied_block_observers_usec[slow_observer] );
+      BOOST_CHECK_GE( timing.total_usec, timing.applied_block_usec + timing.transactions_usec );
+
+      // observers that are gone are not timed any more
+      connection.disconnect();
+      generate_block();
+      BOOST_CHECK_EQUAL( db.get_block_apply_timing().applied_block_observers_usec.size(), slow_observer );
+   }
+   catch (fc::exception& e)
+   {
+      edump((e.to_detail_string()));
+      throw;
+   }
+}
+
+BOOST_FIXTURE_TEST_CASE( precompute_signatures_of_multisig_transactions, database_fixture )
+{
+   try
+   {
+      ACTORS( (alice)(bob)(carol) );
+      const vector<fc::ecc::private_key> keys = { alice_private_key, bob_private_key, carol_private_key };
+
+      // transactions with one, two and three signatures, each of the latter recovered by its own task
+      signed_block block;
+      for( size_t signers = 1; signers <= keys.size(); ++signers )
+      {
+         signed_transaction tx;
+         transfer_operation op;
+         op.from = alice_id;
+         op.to = bob_id;
+         op.amount = asset( signers );
+         tx.operations.push_back( op );
+         tx.set_expiration( db.head_block_time() + 300 );
+         for( size_t i = 0; i < signers; ++i )
+            sign( tx, keys[i] );
+         block.transactions.emplace_back( tx );
+      }
+
+      const database::precompute_stats before = db.get_precompute_stats();
+      db.precompute_parallel( block, database::skip_witness_signature ).wait();
+      for( size_t signers = 1; signers <= keys.size(); ++signers )
+      {
+         flat_set<public_key_type> expected;
+         for( size_t i = 0; i < signers; ++i )
+            expected.insert( keys[i].get_public_key() );
+         BOOST_CHECK( block.transactions[signers - 1].get_signature_keys( db.get_chain_id() ) == expected );
+      }
+      const database::precompute_stats after = db.get_precompute_stats();
+      BOOST_CHECK_EQUAL( after.blocks, before.blocks + 1 );
+      BOOST_CHECK_EQUAL( after.transactions, before.transactions + keys.size() );
+      BOOST_CHECK_GE( after.max_block_usec, after.last_block_usec );
+
+      // a duplicate signature is still detected when the signatures are recovered separately
+      signed_block duplicate;
+      signed_transaction tx( static_cast<const transaction&>( block.transactions[1] ) );
+      tx.signatures = block.transactions[1].signatures;
+      tx.signatures.push_back( tx.signatures[0] );
+      duplicate.transactions.emplace_back( tx );
+      GRAPHENE_REQUIRE_THROW( db.precompute_parallel( duplicate, database::skip_witness_signature ).wait(),
+                              tx_duplicate_sig );
+   }
+   catch (fc::exception& e)
+   {
+      edump((e.to_detail_string()));
+      throw;
+   }
+}
+
+BOOST_FIXTURE_TEST_CASE( produced_block_serialized_once, database_fixture )
+{
+   try
+   {
+      ACTORS( (alice)(bob) );
+      transfer( account_id_type(), alice_id, asset( 10000 ) );
+      generate_block();
+
+      for( int64_t amount = 1; amount <= 5; ++amount )
+      {
+         signed_transaction tx;
+         transfer_operation op;
+         op.from = alice_id;
+         op.to = bob_id;
+         op.amount = asset( amount );
+         tx.operations.push_back( op );
+         tx.set_expiration( db.head_block_time() + 300 );
+         sign( tx, alice_private_key );
+         PUSH_TX( db, tx );
+      }
+      const signed_block produced = generate_block( database::skip_nothing );
+      BOOST_REQUIRE_EQUAL( produced.transactions.size(), 5u );
+
+      // the block assembled from the serialized transactions matches a fresh serialization
+      const vector<char> packed = fc::raw::pack( produced );
+      vector<vector<char>> packed_transactions;
+      for( const auto& trx : produced.transactions )
+         packed_transactions.push_back( fc::raw::pack( trx ) );
+      BOOST_CHECK( produced.pack_with_transactions( packed_transactions ) == packed );
+
+      signed_block unpacked = fc::raw::unpack<signed_block>( packed );
+      BOOST_CHECK( unpacked.calculate_merkle_root() == produced.transaction_merkle_root );
+      BOOST_CHECK( unpacked.id() == produced.id() );
+
+      // it is what the block database stored
+      const optional<signed_block> stored = db.fetch_block_by_number( produced.block_num() );
+      BOOST_REQUIRE( stored.valid() );
+      BOOST_CHECK( fc::raw::pack( *stored ) == packed );
+      const vector<vector<char>> stored_packed = db.fetch_packed_blocks_by_number( produced.block_num(), 1 );
+      BOOST_REQUIRE_EQUAL( stored_packed.size(), 1u );
+      BOOST_CHECK( stored_packed[0] == packed );
+   }
+   catch (fc::exception& e)
+   {
+      edump((e.to_detail_string()));
+      throw;
+   }
+}
+
 BOOST_AUTO_TEST_CASE( genesis_reserve_ids )
 {
    try
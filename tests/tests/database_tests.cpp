@@ -28,10 +28,15 @@
 #include <graphene/chain/database.hpp>
 
 #include <graphene/chain/account_object.hpp>
+#include <graphene/chain/asset_object.hpp>
 #include <graphene/chain/proposal_object.hpp>
 
+#include <graphene/utilities/tempdir.hpp>
+
 #include <fc/crypto/digest.hpp>
 
+#include <boost/filesystem/operations.hpp>
+
 #include "../common/database_fixture.hpp"
 
 using namespace graphene::chain;
@@ -109,6 +114,153 @@ BOOST_AUTO_TEST_CASE( merge_test )
    }
 }
 
+BOOST_AUTO_TEST_CASE( merge_into_smaller_session_test )
+{ try {
+   database db;
+   const auto& first = db.create<account_balance_object>( []( account_balance_object& b ){ b.balance = 1; } );
+   const auto& second = db.create<account_balance_object>( []( account_balance_object& b ){ b.balance = 2; } );
+   const account_balance_id_type first_id = first.id;
+   const account_balance_id_type second_id = second.id;
+   const auto& balances = db.get_index_type<account_balance_index>().indices();
+
+   for( bool larger_inner : { false, true } )
+   {
+      auto outer = db._undo_db.start_undo_session();
+      db.modify( first, []( account_balance_object& b ){ b.balance = 10; } );
+      const account_balance_id_type third_id = db.create<account_balance_object>( []( account_balance_object& b ){
+         b.balance = 3;
+      }).id;
+      const account_balance_id_type fourth_id = db.create<account_balance_object>( []( account_balance_object& b ){
+         b.balance = 4;
+      }).id;
+      {
+         auto inner = db._undo_db.start_undo_session();
+         db.modify( first, []( account_balance_object& b ){ b.balance = 20; } );  // upd + upd
+         db.remove( second );                                                      // nop + del
+         db.modify( third_id(db), []( account_balance_object& b ){ b.balance = 30; } ); // new + upd
+         db.remove( fourth_id(db) );                                               // new + del
+         // decides which of the two states gets walked by merge()
+         for( uint32_t i = 0; larger_inner && i < 20; ++i )
+            db.create<account_balance_object>( []( account_balance_object& b ){ b.balance = 5; } );
+         inner.merge();
+      }
+      BOOST_CHECK_EQUAL( 20, first_id(db).balance.value );
+      BOOST_CHECK( db.find( second_id ) == nullptr );
+      BOOST_CHECK_EQUAL( 30, third_id(db).balance.value );
+      BOOST_CHECK( db.find( fourth_id ) == nullptr );
+
+      outer.undo();
+      BOOST_CHECK_EQUAL( 1, first_id(db).balance.value );
+      BOOST_CHECK_EQUAL( 2, second_id(db).balance.value );
+      BOOST_CHECK( db.find( third_id ) == nullptr );
+      BOOST_CHECK_EQUAL( 2u, balances.size() );
+   }
+} FC_LOG_AND_RETHROW() }
+
+BOOST_AUTO_TEST_CASE( undo_id_map_reserve_test )
+{ try {
+   graphene::db::undo_id_map<uint32_t> map;
+   for( uint32_t i = 0; i < 10; ++i )
+      map[ account_id_type(i) ] = i;
+   map.reserve( 1000 );
+   for( uint32_t i = 10; i < 1000; ++i )
+      BOOST_CHECK( map.emplace( account_id_type(i), i ) );
+   map.reserve( 10 );
+   BOOST_CHECK_EQUAL( 1000u, map.size() );
+   for( uint32_t i = 0; i < 1000; ++i )
+   {
+      auto itr = map.find( account_id_type(i) );
+      BOOST_REQUIRE( itr != map.end() );
+      BOOST_CHECK_EQUAL( i, itr->second );
+   }
+} FC_LOG_AND_RETHROW() }
+
+BOOST_AUTO_TEST_CASE( undo_arena_splice_test )
+{ try {
+   std::vector<std::pair<const account_balance_object*, int64_t>> copies;
+   const auto fill = [&copies]( graphene::db::undo_arena& arena, uint32_t count ) {
+      account_balance_object bal;
+      for( uint32_t i = 0; i < count; ++i )
+      {
+         bal.balance = copies.size();
+         copies.emplace_back( static_cast<const account_balance_object*>( arena.copy( bal ) ), bal.balance.value );
+      }
+   };
+
+   graphene::db::undo_arena parent;
+   fill( parent, 10 );
+   for( uint32_t count : { 0u, 1u, 1000u, 5u } )
+   {
+      graphene::db::undo_arena child;
+      fill( child, count );
+      const size_t blocks = parent.block_count() + child.block_count();
+      parent.splice( child );
+      BOOST_CHECK_EQUAL( blocks, parent.block_count() );
+      BOOST_CHECK_EQUAL( 0u, child.block_count() );
+      fill( parent, 100 );
+   }
+   graphene::db::undo_arena empty;
+   const size_t blocks = parent.block_count();
+   empty.splice( parent );
+   BOOST_CHECK_EQUAL( blocks, empty.block_count() );
+   for( const auto& copy : copies )
+      BOOST_CHECK_EQUAL( copy.second, copy.first->balance.value );
+} FC_LOG_AND_RETHROW() }
+
+BOOST_AUTO_TEST_CASE( held_base_state_test )
+{ try {
+   database db;
+   const uint8_t space = account_balance_object::space_id;
+   const uint8_t type = account_balance_object::type_id;
+   db._undo_db.disable();
+   const account_balance_id_type first_id = db.create<account_balance_object>( []( account_balance_object& b ){
+      b.balance = 1;
+   }).id;
+   const account_balance_id_type second_id = db.create<account_balance_object>( []( account_balance_object& b ){
+      b.balance = 2;
+   }).id;
+   db._undo_db.enable();
+
+   auto outer = db._undo_db.start_undo_session();
+   db.modify( first_id(db), []( account_balance_object& b ){ b.balance = 10; } );
+   db._undo_db.hold_base();
+   const graphene::db::undo_base_state& base = db._undo_db.get_held_base_state( space, type );
+   BOOST_REQUIRE_EQUAL( 1u, base.objects.size() );
+   BOOST_CHECK( base.next_ids.empty() );
+
+   // changes made later are recorded as they happen, the values survive the session they were taken from
+   account_balance_id_type third_id;
+   {
+      auto inner = db._undo_db.start_undo_session();
+      db.modify( first_id(db), []( account_balance_object& b ){ b.balance = 20; } );
+      db.modify( second_id(db), []( account_balance_object& b ){ b.balance = 30; } );
+      third_id = db.create<account_balance_object>( []( account_balance_object& b ){ b.balance = 3; } ).id;
+      inner.undo();
+   }
+   BOOST_CHECK( &db._undo_db.get_held_base_state( space, type ) == &base );
+   BOOST_REQUIRE_EQUAL( 3u, base.objects.size() );
+   BOOST_CHECK_EQUAL( 1, static_cast<const account_balance_object*>( base.objects.at( first_id ) )->balance.value );
+   BOOST_CHECK_EQUAL( 2, static_cast<const account_balance_object*>( base.objects.at( second_id ) )->balance.value );
+   BOOST_CHECK( base.objects.at( third_id ) == nullptr );
+   BOOST_CHECK( base.next_ids.at( object_id_type( space, type, 0 ) ) == object_id_type( third_id ) );
+   db._undo_db.release_base();
+   outer.undo();
+
+   // a held base keeps a limited number of sessions beyond the usual undo history only
+   db._undo_db.set_max_size( 2 );
+   db._undo_db.set_max_held_sessions( 3 );
+   db._undo_db.hold_base();
+   const uint64_t revision = db._undo_db.base_revision();
+   for( uint32_t i = 0; i < 6; ++i )
+      db._undo_db.start_undo_session().commit();
+   BOOST_CHECK_EQUAL( 6u, db._undo_db.size() );
+   BOOST_CHECK_EQUAL( revision, db._undo_db.base_revision() );
+   db._undo_db.start_undo_session().commit();
+   BOOST_CHECK_EQUAL( 6u, db._undo_db.size() );
+   BOOST_CHECK_NE( revision, db._undo_db.base_revision() );
+   db._undo_db.release_base();
+} FC_LOG_AND_RETHROW() }
+
 BOOST_AUTO_TEST_CASE( direct_index_test )
 { try {
    try {
@@ -194,6 +346,266 @@ BOOST_AUTO_TEST_CASE( direct_index_test )
    // but the secondary has not updated its representation
 } FC_LOG_AND_RETHROW() }
 
+BOOST_AUTO_TEST_CASE( auto_direct_index_test )
+{ try {
+   graphene::db::primary_index< account_index, graphene::db::direct_auto > my_accounts( db );
+   const auto& direct = my_accounts.get_secondary_index<graphene::db::auto_direct_index< account_object >>();
+   BOOST_CHECK( nullptr == direct.find( account_id_type( 1 ) ) );
+   BOOST_CHECK( nullptr == direct.find( account_id_type( 1000000 ) ) );
+   BOOST_CHECK_THROW( direct.find( object_id_type( asset_id_type( 1 ) ) ), fc::assert_exception );
+   const size_t empty_usage = direct.memory_usage();
+
+   // chunk boundaries of the growing chunks, the first fixed size chunks, and holes of any size
+   const std::vector<uint64_t> instances = { 0, 1, 63, 64, 191, 192, 65471, 65472, 131007, 131008, 5000000 };
+   account_object test_account;
+   for( uint64_t instance : instances )
+   {
+      test_account.id = account_id_type( instance );
+      test_account.name = "account" + std::to_string( instance );
+      my_accounts.load( fc::raw::pack( test_account ) );
+   }
+   for( uint64_t instance : instances )
+   {
+      const account_object* aptr = dynamic_cast< const account_object* >( my_accounts.find( account_id_type( instance ) ) );
+      BOOST_REQUIRE( aptr != nullptr );
+      BOOST_CHECK_EQUAL( "account" + std::to_string( instance ), aptr->name );
+      BOOST_CHECK( nullptr == my_accounts.find( account_id_type( instance + 2 ) ) );
+   }
+   BOOST_CHECK( nullptr == my_accounts.find( account_id_type( 6000000 ) ) );
+
+   test_account.id = account_id_type( 64 );
+   GRAPHENE_REQUIRE_THROW( direct.object_inserted( test_account ), fc::assert_exception );
+
+   // a chunk is freed with its last object, and allocated again when needed
+   const size_t full_usage = direct.memory_usage();
+   BOOST_CHECK_GT( full_usage, empty_usage );
+   my_accounts.remove( *my_accounts.find( account_id_type( 5000000 ) ) );
+   const size_t usage = direct.memory_usage();
+   BOOST_CHECK_EQUAL( full_usage - ( size_t(1) << 16 ) * sizeof(const account_object*), usage );
+   BOOST_CHECK( nullptr == my_accounts.find( account_id_type( 5000000 ) ) );
+   test_account.id = account_id_type( 5000001 );
+   test_account.name = "account5000001";
+   my_accounts.load( fc::raw::pack( test_account ) );
+   BOOST_CHECK_EQUAL( full_usage, direct.memory_usage() );
+   BOOST_CHECK_EQUAL( "account5000001", dynamic_cast< const account_object& >(
+                                           my_accounts.get( account_id_type( 5000001 ) ) ).name );
+
+   // removing one of several objects of a chunk keeps the chunk
+   my_accounts.remove( *my_accounts.find( account_id_type( 63 ) ) );
+   BOOST_CHECK_EQUAL( full_usage, direct.memory_usage() );
+   BOOST_CHECK( nullptr == my_accounts.find( account_id_type( 63 ) ) );
+   BOOST_CHECK( nullptr != my_accounts.find( account_id_type( 64 ) ) );
+
+   GRAPHENE_REQUIRE_THROW( my_accounts.modify( *my_accounts.find( account_id_type( 1 ) ), [] ( object& acct ) {
+      acct.id = account_id_type(2);
+   }), fc::assert_exception );
+} FC_LOG_AND_RETHROW() }
+
+BOOST_AUTO_TEST_CASE( index_file_format_test )
+{ try {
+   fc::temp_directory data_dir( graphene::utilities::temp_directory_path() );
+   const fc::path legacy_file = data_dir.path() / "legacy";
+   const fc::path chunked_file = data_dir.path() / "chunked";
+   const uint32_t num_accounts = 20000; // enough for several chunks
+
+   graphene::db::primary_index< account_index, 8 > my_accounts( db );
+   account_object test_account;
+   for( uint32_t i = 0; i < num_accounts; ++i )
+   {
+      test_account.id = account_id_type(i);
+      test_account.name = "account" + std::to_string( i );
+      my_accounts.load( fc::raw::pack( test_account ) );
+   }
+   my_accounts.set_next_id( account_id_type( num_accounts ) );
+
+   // legacy layout: next_id, version "1.0", then every object as a packed vector<char>
+   {
+      std::ofstream out( legacy_file.generic_string(), std::ofstream::binary | std::ofstream::out );
+      fc::raw::pack( out, my_accounts.get_next_id() );
+      fc::raw::pack( out, my_accounts.get_legacy_object_version() );
+      my_accounts.inspect_all_objects( [&out]( const object& o ) {
+         auto packed_vec = fc::raw::pack( fc::raw::pack( static_cast<const account_object&>(o) ) );
+         out.write( packed_vec.data(), packed_vec.size() );
+      });
+   }
+   my_accounts.save( chunked_file );
+
+   const auto check_accounts = [num_accounts]( const graphene::db::primary_index< account_index, 8 >& accounts ) {
+      BOOST_CHECK_EQUAL( num_accounts, accounts.indices().size() );
+      BOOST_CHECK( accounts.get_next_id() == account_id_type( num_accounts ) );
+      const auto& direct = accounts.get_secondary_index<graphene::db::direct_index< account_object, 8 >>();
+      for( uint32_t i = 0; i < num_accounts; i += 997 )
+         BOOST_CHECK_EQUAL( "account" + std::to_string( i ), direct.get( account_id_type(i) ).name );
+   };
+
+   graphene::db::primary_index< account_index, 8 > from_legacy( db );
+   BOOST_CHECK_EQUAL( 0u, from_legacy.begin_load( legacy_file ) );
+   from_legacy.end_load();
+   check_accounts( from_legacy );
+
+   graphene::db::primary_index< account_index, 8 > from_chunks( db );
+   const size_t chunks = from_chunks.begin_load( chunked_file );
+   BOOST_CHECK_GT( chunks, 1u );
+   // chunks may be unpacked in any order, objects are still inserted in file order
+   for( size_t chunk = chunks; chunk > 0; --chunk )
+      from_chunks.load_chunk( chunk - 1 );
+   BOOST_CHECK_EQUAL( 0u, from_chunks.indices().size() );
+   // chunks are inserted one at a time in file order, end_load() inserts the rest
+   GRAPHENE_REQUIRE_THROW( from_chunks.insert_chunk( 1 ), fc::exception );
+   from_chunks.insert_chunk( 0 );
+   BOOST_CHECK_GT( from_chunks.indices().size(), 0u );
+   BOOST_CHECK_LT( from_chunks.indices().size(), num_accounts );
+   from_chunks.end_load();
+   check_accounts( from_chunks );
+
+   graphene::db::primary_index< account_index, 8 > reopened( db );
+   reopened.open( chunked_file );
+   check_accounts( reopened );
+
+   // a saved empty index yields no chunks
+   graphene::db::primary_index< account_index, 8 > empty( db );
+   empty.save( data_dir.path() / "empty" );
+   graphene::db::primary_index< account_index, 8 > still_empty( db );
+   BOOST_CHECK_EQUAL( 0u, still_empty.begin_load( data_dir.path() / "empty" ) );
+   still_empty.end_load();
+   BOOST_CHECK_EQUAL( 0u, still_empty.indices().size() );
+} FC_LOG_AND_RETHROW() }
+
+BOOST_AUTO_TEST_CASE( state_hash_test )
+{ try {
+   BOOST_CHECK( db.get_state_hash() == fc::sha256() );
+   db.enable_state_hash();
+   const fc::sha256 initial = db.get_state_hash();
+   BOOST_CHECK( initial != fc::sha256() );
+
+   {
+      auto session = db._undo_db.start_undo_session();
+      const auto& bal = db.create<account_balance_object>( []( account_balance_object& b ) {
+         b.owner = account_id_type(1);
+      } );
+      const fc::sha256 with_balance = db.get_state_hash();
+      BOOST_CHECK( with_balance != initial );
+      db.modify( bal, []( account_balance_object& b ) { b.balance = 5; } );
+      BOOST_CHECK( db.get_state_hash() != with_balance );
+      db.modify( bal, []( account_balance_object& b ) { b.balance = 0; } );
+      BOOST_CHECK( db.get_state_hash() == with_balance );
+      db.remove( bal );
+      BOOST_CHECK( db.get_state_hash() == initial );
+      db.create<account_balance_object>( []( account_balance_object& b ) { b.owner = account_id_type(2); } );
+      BOOST_CHECK( db.get_state_hash() != initial );
+   }
+   // undoing restores the hash
+   BOOST_CHECK( db.get_state_hash() == initial );
+
+   // the hash maintained along the changes matches the one computed from scratch, whatever the order
+   graphene::db::primary_index< account_index, 8 > incremental( db );
+   graphene::db::primary_index< account_index, 8 > from_scratch( db );
+   incremental.set_state_hash_enabled( true );
+   account_object test_account;
+   for( uint32_t i = 0; i < 10; ++i )
+   {
+      test_account.id = account_id_type(i);
+      test_account.name = "account" + std::to_string( i );
+      incremental.load( fc::raw::pack( test_account ) );
+      test_account.id = account_id_type(9 - i);
+      test_account.name = "account" + std::to_string( 9 - i );
+      from_scratch.load( fc::raw::pack( test_account ) );
+   }
+   incremental.modify( incremental.get( account_id_type(3) ), []( object& o ) {
+      static_cast<account_object&>( o ).name = "renamed";
+   } );
+   incremental.modify( incremental.get( account_id_type(3) ), []( object& o ) {
+      static_cast<account_object&>( o ).name = "account3";
+   } );
+   from_scratch.set_state_hash_enabled( true );
+   BOOST_CHECK( incremental.get_state_hash().digest() == from_scratch.get_state_hash().digest() );
+   incremental.remove( incremental.get( account_id_type(5) ) );
+   BOOST_CHECK( incremental.get_state_hash().digest() != from_scratch.get_state_hash().digest() );
+} FC_LOG_AND_RETHROW() }
+
+BOOST_AUTO_TEST_CASE( incremental_flush_test )
+{ try {
+   fc::temp_directory data_dir( graphene::utilities::temp_directory_path() );
+   const fc::path accounts_file = data_dir.path() / "object_database"
+                                  / fc::to_string( account_object::space_id ) / fc::to_string( account_object::type_id );
+   const fc::path assets_file = data_dir.path() / "object_database"
+                                / fc::to_string( asset_object::space_id ) / fc::to_string( asset_object::type_id );
+   {
+      graphene::db::object_database odb;
+      odb.add_index< graphene::db::primary_index< account_index > >();
+      odb.add_index< graphene::db::primary_index< asset_index > >();
+      odb.open( data_dir.path() );
+      const auto& alice = odb.create<account_object>( []( account_object& a ) { a.name = "alice"; } );
+      odb.create<asset_object>( []( asset_object& a ) { a.symbol = "TEST"; } );
+      odb.flush();
+
+      // keep our own links to the flushed files to find out which ones get rewritten
+      fc::create_hard_link( accounts_file, data_dir.path() / "accounts" );
+      fc::create_hard_link( assets_file, data_dir.path() / "assets" );
+
+      odb.modify( alice, []( account_object& a ) { a.name = "alice2"; } );
+      odb.flush();
+      BOOST_CHECK( !boost::filesystem::equivalent( accounts_file, data_dir.path() / "accounts" ) );
+      BOOST_CHECK( boost::filesystem::equivalent( assets_file, data_dir.path() / "assets" ) );
+      BOOST_CHECK( !fc::exists( data_dir.path() / "object_database.tmp" ) );
+      BOOST_CHECK( !fc::exists( data_dir.path() / "object_database.old" ) );
+   }
+   {
+      graphene::db::object_database odb;
+      odb.add_index< graphene::db::primary_index< account_index > >();
+      odb.add_index< graphene::db::primary_index< asset_index > >();
+      odb.open( data_dir.path() );
+      BOOST_CHECK_EQUAL( "alice2", account_id_type()(odb).name );
+      BOOST_CHECK_EQUAL( "TEST", asset_id_type()(odb).symbol );
+
+      // nothing changed since open, so nothing is rewritten
+      fc::remove( data_dir.path() / "accounts" );
+      fc::create_hard_link( accounts_file, data_dir.path() / "accounts" );
+      odb.flush();
+      BOOST_CHECK( boost::filesystem::equivalent( accounts_file, data_dir.path() / "accounts" ) );
+      BOOST_CHECK( boost::filesystem::equivalent( assets_file, data_dir.path() / "assets" ) );
+   }
+} FC_LOG_AND_RETHROW() }
+
+BOOST_AUTO_TEST_CASE( operation_profiling_test )
+{ try {
+   ACTORS( (alice)(bob) );
+   BOOST_CHECK( db.get_operation_profiler() == nullptr );
+
+   db.enable_operation_profiling( true );
+   BOOST_REQUIRE( db.get_operation_profiler() != nullptr );
+   transfer( account_id_type(), alice_id, asset( 10000 ) );
+   transfer( alice_id, bob_id, asset( 100 ) );
+   // fails for lack of funds
+   GRAPHENE_REQUIRE_THROW( transfer( bob_id, alice_id, asset( 1000 ) ), fc::exception );
+   generate_block();
+
+   const vector<operation_profile> profiles = db.get_operation_profiler()->get_profiles();
+   BOOST_REQUIRE_EQUAL( profiles.size(), 1u );
+   const operation_profile& profile = profiles.front();
+   BOOST_CHECK_EQUAL( profile.operation, "transfer_operation" );
+   // pending transactions are evaluated again when the block is produced and applied
+   BOOST_CHECK_GE( profile.count, 2u );
+   BOOST_CHECK_EQUAL( profile.failed, 1u );
+   BOOST_CHECK_GT( profile.evaluate_nsec, 0u );
+   BOOST_CHECK_LE( profile.evaluate_p50_nsec, profile.evaluate_p99_nsec );
+   BOOST_CHECK_LE( profile.evaluate_p99_nsec, profile.evaluate_max_nsec );
+   BOOST_CHECK_LE( profile.apply_p99_nsec, profile.apply_max_nsec );
+
+   latency_histogram histogram;
+   for( uint64_t nsec = 1; nsec <= 1000; ++nsec )
+      histogram.record( nsec );
+   BOOST_CHECK_EQUAL( histogram.count(), 1000u );
+   BOOST_CHECK_EQUAL( histogram.max(), 1000u );
+   // buckets keep 3 significant bits, so percentiles are off by at most 1/8
+   BOOST_CHECK_GE( histogram.percentile( 50 ), 500u );
+   BOOST_CHECK_LE( histogram.percentile( 50 ), 500u + 500u / 8 );
+   BOOST_CHECK_EQUAL( histogram.percentile( 100 ), 1000u );
+
+   db.enable_operation_profiling( false );
+   BOOST_CHECK( db.get_operation_profiler() == nullptr );
+} FC_LOG_AND_RETHROW() }
+
 BOOST_AUTO_TEST_CASE( required_approval_index_test ) // see https://github.com/bitshares/bitshares-core/issues/1719
 { try {
    ACTORS( (alice)(bob)(charlie)(agnetha)(benny)(carlos) );
@@ -0,0 +1,138 @@
+/*
+ * Copyright (c) 2015 Cryptonomex, Inc., and contributors.
+ * Copyright (c) 2020-2023 Revolution Populi Limited, and contributors.
+ *
+ * The MIT License
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+
+/*
+ * Counts the allocations made by undo sessions and pushed transactions. It is a separate executable because
+ * counting needs a replacement of the global operator new, which would slow down every other test.
+ *
+ * Run ``tests/undo_allocation_benchmark``
+ */
+
+#include "../common/init_unit_test_suite.hpp"
+
+#include <graphene/chain/database.hpp>
+#include <graphene/chain/account_object.hpp>
+
+#include "../common/database_fixture.hpp"
+
+#include <atomic>
+#include <cstdlib>
+#include <new>
+
+namespace {
+   std::atomic<bool>     counting_allocations( false );
+   std::atomic<uint64_t> allocation_count( 0 );
+
+   /** Counts calls of the global operator new made while it exists */
+   class allocation_counter
+   {
+      public:
+         allocation_counter()
+         {
+            allocation_count = 0;
+            counting_allocations = true;
+         }
+         ~allocation_counter() { counting_allocations = false; }
+         uint64_t count()const { return allocation_count.load(); }
+   };
+}
+
+void* operator new( std::size_t size )
+{
+   if( counting_allocations.load( std::memory_order_relaxed ) )
+      allocation_count.fetch_add( 1, std::memory_order_relaxed );
+   if( void* p = std::malloc( size == 0 ? 1 : size ) )
+      return p;
+   throw std::bad_alloc();
+}
+void operator delete( void* p ) noexcept { std::free( p ); }
+void operator delete( void* p, std::size_t ) noexcept { std::free( p ); }
+
+using namespace graphene::chain;
+
+BOOST_FIXTURE_TEST_SUITE( undo_allocation_tests, database_fixture )
+
+BOOST_AUTO_TEST_CASE( undo_allocation_benchmark )
+{ try {
+   ACTORS( (alice)(bob) );
+   fund( alice, asset(10000000) );
+
+   const uint32_t cycles = 20000;
+
+   // undo sessions alone, the way _push_transaction nests them into the pending session
+   {
+      const auto& stats = alice_id(db).statistics(db);
+      auto pending = db._undo_db.start_undo_session();
+      uint64_t allocations;
+      auto start = fc::time_point::now();
+      {
+         allocation_counter counter;
+         for( uint32_t i = 0; i < cycles; ++i )
+         {
+            auto session = db._undo_db.start_undo_session();
+            db.modify( stats, []( account_statistics_object& s ) { ++s.total_ops; } );
+            db.create<account_balance_object>( [i]( account_balance_object& b ) { b.owner = account_id_type(i); } );
+            session.merge();
+         }
+         allocations = counter.count();
+      }
+      auto elapsed = fc::time_point::now() - start;
+      pending.undo();
+      wlog( "Undo sessions: ${a} allocations per session, ${s} sessions/s",
+            ("a",double(allocations)/cycles)("s",(cycles*1000000)/elapsed.count()) );
+   }
+
+   // complete transactions pushed to the pending state
+   {
+      std::vector<signed_transaction> transactions;
+      transactions.reserve( cycles );
+      transfer_operation op;
+      op.from = alice_id;
+      op.to = bob_id;
+      op.amount = asset(1);
+      for( uint32_t i = 0; i < cycles; ++i )
+      {
+         trx.clear();
+         trx.operations.push_back( op );
+         trx.set_expiration( db.head_block_time() + fc::seconds( 60 + i ) );
+         transactions.push_back( trx );
+      }
+      trx.clear();
+
+      uint64_t allocations;
+      auto start = fc::time_point::now();
+      {
+         allocation_counter counter;
+         for( const auto& tx : transactions )
+            db.push_transaction( tx, ~0 );
+         allocations = counter.count();
+      }
+      auto elapsed = fc::time_point::now() - start;
+      wlog( "Pushed transfers: ${a} allocations per transaction, ${t} transactions/s",
+            ("a",double(allocations)/cycles)("t",(cycles*1000000)/elapsed.count()) );
+      db.clear_pending();
+   }
+} FC_LOG_AND_RETHROW() }
+
+BOOST_AUTO_TEST_SUITE_END()